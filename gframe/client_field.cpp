@@ -5,6 +5,7 @@
 #include "game.h"
 #include "materials.h"
 #include "../ocgcore/field.h"
+#include "../ocgcore/sumcheck.h"
 
 namespace ygo {
 
@@ -1021,7 +1022,7 @@ bool ClientField::CheckSelectSum() {
 			} else {
 				std::set<ClientCard*> left(selable);
 				left.erase(*sit);
-				if (check_min(left, left.begin(), select_sumval - sums, select_sumval - sums + ms - 1))
+				if (check_min(left, select_sumval - sums, select_sumval - sums + ms - 1))
 					selectsum_cards.insert(*sit);
 			}
 			if (op2 == 0)
@@ -1038,7 +1039,7 @@ bool ClientField::CheckSelectSum() {
 			} else {
 				std::set<ClientCard*> left(selable);
 				left.erase(*sit);
-				if (check_min(left, left.begin(), select_sumval - sums, select_sumval - sums + ms - 1))
+				if (check_min(left, select_sumval - sums, select_sumval - sums + ms - 1))
 					selectsum_cards.insert(*sit);
 			}
 		}
@@ -1050,17 +1051,14 @@ bool ClientField::CheckSelectSum() {
 		return ret;
 	}
 }
-bool ClientField::check_min(std::set<ClientCard*>& left, std::set<ClientCard*>::iterator index, int min, int max) {
-	if (index == left.end())
-		return false;
-	int op1 = (*index)->opParam & 0xffff;
-	int op2 = (*index)->opParam >> 16;
-	int m = (op2 > 0 && op1 > op2) ? op2 : op1;
-	if (m >= min && m <= max)
-		return true;
-	index++;
-	return (min > m && check_min(left, index, min - m, max - m))
-	        || check_min(left, index, min, max);
+bool ClientField::check_min(std::set<ClientCard*>& left, int min, int max) {
+	std::vector<uint32> values;
+	for (auto sit = left.begin(); sit != left.end(); ++sit) {
+		int op1 = (*sit)->opParam & 0xffff;
+		int op2 = (*sit)->opParam >> 16;
+		values.push_back((op2 > 0 && op1 > op2) ? op2 : op1);
+	}
+	return values.size() && check_sum_range(&values[0], values.size(), min, max);
 }
 bool ClientField::check_sel_sum_s(std::set<ClientCard*>& left, int index, int acc) {
 	if (index == (int)selected_cards.size()) {
@@ -1088,25 +1086,22 @@ void ClientField::check_sel_sum_t(std::set<ClientCard*>& left, int acc) {
 		int l = (*sit)->opParam;
 		int l1 = l & 0xffff;
 		int l2 = l >> 16;
-		if (check_sum(testlist, testlist.begin(), acc - l1, selected_cards.size() + 1)
-		        || (l2 > 0 && check_sum(testlist, testlist.begin(), acc - l2, selected_cards.size() + 1))) {
+		if (check_sum(testlist, acc - l1, selected_cards.size() + 1)
+		        || (l2 > 0 && check_sum(testlist, acc - l2, selected_cards.size() + 1))) {
 			selectsum_cards.insert(*sit);
 		}
 	}
 }
-bool ClientField::check_sum(std::set<ClientCard*>& testlist, std::set<ClientCard*>::iterator index, int acc, int count) {
+bool ClientField::check_sum(std::set<ClientCard*>& testlist, int acc, int count) {
 	if (acc == 0)
 		return count >= select_min && count <= select_max;
-	if (acc < 0 || index == testlist.end())
+	if (acc < 0 || testlist.empty())
 		return false;
-	int l = (*index)->opParam;
-	int l1 = l & 0xffff;
-	int l2 = l >> 16;
-	if ((l1 == acc || (l2 > 0 && l2 == acc)) && (count + 1 >= select_min) && (count + 1 <= select_max))
-		return true;
-	index++;
-	return (acc > l1 && check_sum(testlist, index, acc - l1, count + 1))
-	       || (l2 > 0 && acc > l2 && check_sum(testlist, index, acc - l2, count + 1))
-	       || check_sum(testlist, index, acc, count);
+	std::vector<uint32> params;
+	for (auto sit = testlist.begin(); sit != testlist.end(); ++sit) {
+		int l = (*sit)->opParam;
+		params.push_back((l & 0xffff) | (l >> 16 > 0 ? l & 0xffff0000 : 0));
+	}
+	return check_sum_limit(&params[0], params.size(), acc, count, select_min, select_max);
 }
 }
@@ -90,10 +90,10 @@ public:
 	void MoveCard(ClientCard* pcard, int frame);
 	void FadeCard(ClientCard* pcard, int alpha, int frame);
 	bool CheckSelectSum();
-	bool check_min(std::set<ClientCard*>& left, std::set<ClientCard*>::iterator index, int min, int max);
+	bool check_min(std::set<ClientCard*>& left, int min, int max);
 	bool check_sel_sum_s(std::set<ClientCard*>& left, int index, int acc);
 	void check_sel_sum_t(std::set<ClientCard*>& left, int acc);
-	bool check_sum(std::set<ClientCard*>& testlist, std::set<ClientCard*>::iterator index, int acc, int count);
+	bool check_sum(std::set<ClientCard*>& testlist, int acc, int count);
 	
 	irr::gui::IGUIElement* panel;
 	std::vector<int> ancard;
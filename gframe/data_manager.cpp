@@ -257,5 +257,8 @@ int DataManager::CardReader(int code, void* pData) {
 		memset(pData, 0, sizeof(CardData));
 	return 0;
 }
+int DataManager::DuelCardReader(void* payload, int code, void* pData) {
+	return CardReader(code, pData);
+}
 
 }
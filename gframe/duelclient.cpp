@@ -17,6 +17,8 @@ unsigned char DuelClient::response_len = 0;
 unsigned int DuelClient::watching = 0;
 unsigned char DuelClient::selftype = 0;
 bool DuelClient::is_host = false;
+unsigned int DuelClient::room_id = 0;
+std::vector<unsigned char> DuelClient::replay_data;
 event_base* DuelClient::client_base = 0;
 bufferevent* DuelClient::client_bev = 0;
 char DuelClient::duel_client_read[0x2000];
@@ -35,6 +37,7 @@ event* DuelClient::resp_event = 0;
 bool DuelClient::StartClient(unsigned int ip, unsigned short port, bool create_game) {
 	if(connect_state)
 		return false;
+	replay_data.clear();
 	sockaddr_in sin;
 	client_base = event_base_new();
 	if(!client_base)
@@ -124,7 +127,7 @@ void DuelClient::ClientEvent(bufferevent *bev, short events, void *ctx) {
 		} else {
 			CTOS_JoinGame csjg;
 			csjg.version = PRO_VERSION;
-			csjg.gameid = 0;
+			csjg.gameid = room_id;
 			BufferIO::CopyWStr(mainGame->ebJoinPass->getText(), csjg.pass, 20);
 			SendPacketToServer(CTOS_JOIN_GAME, csjg);
 		}
@@ -298,10 +301,20 @@ void DuelClient::HandleSTOCPacketLan(char* data, unsigned int len) {
 		mainGame->gMutex.Unlock();
 		break;
 	}
+	case STOC_CREATE_GAME: {
+		//a multi-room server tells the id others join the new room with
+		STOC_CreateGame* pkt = (STOC_CreateGame*)pdata;
+		room_id = pkt->gameid;
+		break;
+	}
 	case STOC_JOIN_GAME: {
 		STOC_JoinGame* pkt = (STOC_JoinGame*)pdata;
 		std::wstring str;
 		wchar_t msgbuf[256];
+		if(room_id) {
+			myswprintf(msgbuf, L"%ls%d\n", dataManager.GetSysString(1239), room_id);
+			str.append(msgbuf);
+		}
 		myswprintf(msgbuf, L"%ls%ls\n", dataManager.GetSysString(1226), deckManager.GetLFListName(pkt->info.lflist));
 		str.append(msgbuf);
 		myswprintf(msgbuf, L"%ls%ls\n", dataManager.GetSysString(1225), dataManager.GetSysString(1240 + pkt->info.rule));
@@ -517,6 +530,10 @@ void DuelClient::HandleSTOCPacketLan(char* data, unsigned int len) {
 			mainGame->device->closeDevice();
 		break;
 	}
+	case STOC_REPLAY_DATA: {
+		replay_data.insert(replay_data.end(), (unsigned char*)pdata, (unsigned char*)pdata + len - 1);
+		break;
+	}
 	case STOC_REPLAY: {
 		mainGame->gMutex.Lock();
 		mainGame->ebRSName->setText(L"");
@@ -529,12 +546,13 @@ void DuelClient::HandleSTOCPacketLan(char* data, unsigned int len) {
 			Replay new_replay;
 			memcpy(&new_replay.pheader, prep, sizeof(ReplayHeader));
 			prep += sizeof(ReplayHeader);
-			memcpy(new_replay.comp_data, prep, len - sizeof(ReplayHeader) - 1);
-			new_replay.comp_size = len - sizeof(ReplayHeader) - 1;
+			new_replay.comp_data.swap(replay_data);
+			new_replay.comp_data.insert(new_replay.comp_data.end(), prep, prep + len - sizeof(ReplayHeader) - 1);
 			if(mainGame->actionParam)
 				new_replay.SaveReplay(mainGame->ebRSName->getText());
 			else new_replay.SaveReplay(L"_LastReplay");
 		}
+		replay_data.clear();
 		break;
 	}
 	case STOC_TIME_LIMIT: {
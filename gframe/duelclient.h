@@ -73,6 +73,8 @@ protected:
 	static std::set<unsigned int> remotes;
 public:
 	static std::vector<HostPacket> hosts;
+	static unsigned int room_id; // the room on a multi-room server, 0 for a single room host
+	static std::vector<unsigned char> replay_data; // the STOC_REPLAY_DATA parts received so far
 	static void BeginRefreshHost();
 	static int RefreshThread(void* arg);
 	static void BroadcastReply(evutil_socket_t fd, short events, void* arg);
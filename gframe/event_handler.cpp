@@ -79,6 +79,18 @@ bool ClientField::OnEvent(const irr::SEvent& event) {
 				ReplayMode::SwapField();
 				break;
 			}
+			case BUTTON_REPLAY_PREV_TURN: {
+				if(!mainGame->dInfo.isReplay)
+					break;
+				ReplayMode::Seek(-1);
+				break;
+			}
+			case BUTTON_REPLAY_NEXT_TURN: {
+				if(!mainGame->dInfo.isReplay)
+					break;
+				ReplayMode::Seek(1);
+				break;
+			}
 			case BUTTON_REPLAY_SAVE: {
 				if(mainGame->ebRSName->getText()[0] == 0)
 					break;
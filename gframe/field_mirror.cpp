@@ -0,0 +1,129 @@
+#include "field_mirror.h"
+#include "../ocgcore/ocgapi.h"
+
+namespace ygo {
+
+void FieldMirror::Clear() {
+	for(int p = 0; p < 2; ++p)
+		for(int l = 0; l < 5; ++l)
+			for(int v = 0; v < 2; ++v)
+				cards[p][l][v].clear();
+}
+void FieldMirror::ClearLocation(int player, int location) {
+	for(int v = 0; v < 2; ++v) {
+		std::vector<MirrorCard>* mirror = GetCards(player, location, v);
+		if(mirror)
+			mirror->clear();
+	}
+}
+//the card was sent with MSG_UPDATE_CARD, which the mirror does not follow
+void FieldMirror::ClearCard(int player, int location, int sequence) {
+	for(int v = 0; v < 2; ++v) {
+		std::vector<MirrorCard>* mirror = GetCards(player, location, v);
+		if(mirror && sequence >= 0 && (size_t)sequence < mirror->size())
+			(*mirror)[sequence].is_valid = false;
+	}
+}
+/*
+ * Copies query_buffer (MSG_UPDATE_DATA with the result of query_field_card) to delta_buffer
+ * without the fields the view already has. An entry left without fields is sent as
+ * an 8 byte entry with no query flag, which the client skips.
+ * Returns the length of delta_buffer, 0 if the view has nothing to update.
+ */
+int FieldMirror::Update(unsigned long pduel, int view, const char* query_buffer, int len, char* delta_buffer) {
+	int player = query_buffer[1];
+	int location = query_buffer[2];
+	std::vector<MirrorCard>* mirror = GetCards(player, location, view);
+	if(!mirror) {
+		memcpy(delta_buffer, query_buffer, len);
+		return len;
+	}
+	//an entry takes at least 4 bytes of the query buffer
+	unsigned int fieldids[0x400];
+	int count = query_field_ids(pduel, player, location, fieldids, 0x400);
+	if(count > 0x400) {
+		memcpy(delta_buffer, query_buffer, len);
+		return len;
+	}
+	mirror->resize(count);
+	const char* qbuf = query_buffer + 3;
+	char* dbuf = delta_buffer;
+	memcpy(dbuf, query_buffer, 3);
+	dbuf += 3;
+	bool changed = false;
+	for(int i = 0; i < count && qbuf < query_buffer + len; ++i) {
+		int clen = *(int*)qbuf;
+		int flag = (clen > 4) ? *(int*)(qbuf + 4) : 0;
+		MirrorCard& mcard = (*mirror)[i];
+		if(!fieldids[i] || !flag) {
+			//an empty slot, or a card hidden from this view
+			mcard.is_valid = false;
+			if(clen == 4)
+				BufferIO::WriteInt32(dbuf, 4);
+			else {
+				BufferIO::WriteInt32(dbuf, 8);
+				BufferIO::WriteInt32(dbuf, 0);
+			}
+			qbuf += clen;
+			continue;
+		}
+		if(!mcard.is_valid || mcard.fieldid != fieldids[i]) {
+			mcard.is_valid = true;
+			mcard.fieldid = fieldids[i];
+			mcard.flag = 0;
+		}
+		//the fields follow the query flag from the lowest bit, see card::get_infos
+		const char* field = qbuf + 8;
+		char* entry = dbuf;
+		int dflag = 0;
+		dbuf += 8;
+		for(int b = 0; b < 32; ++b) {
+			int bit = 1 << b;
+			if(!(flag & bit))
+				continue;
+			int flen = 4;
+			if(bit & (QUERY_TARGET_CARD | QUERY_OVERLAY_CARD | QUERY_COUNTERS))
+				flen += *(int*)field * 4;
+			if(bit & FIELD_MIRROR_FIELDS) {
+				int value = *(int*)field;
+				if((mcard.flag & bit) && mcard.value[b] == value) {
+					field += flen;
+					continue;
+				}
+				mcard.flag |= bit;
+				mcard.value[b] = value;
+			}
+			memcpy(dbuf, field, flen);
+			dbuf += flen;
+			field += flen;
+			dflag |= bit;
+		}
+		if(dflag)
+			changed = true;
+		*(int*)entry = dbuf - entry;
+		*(int*)(entry + 4) = dflag;
+		qbuf += clen;
+	}
+	if(!changed)
+		return 0;
+	return dbuf - delta_buffer;
+}
+std::vector<MirrorCard>* FieldMirror::GetCards(int player, int location, int view) {
+	if(player != 0 && player != 1)
+		return 0;
+	switch(location) {
+	case LOCATION_MZONE:
+		return &cards[player][0][view];
+	case LOCATION_SZONE:
+		return &cards[player][1][view];
+	case LOCATION_HAND:
+		return &cards[player][2][view];
+	case LOCATION_GRAVE:
+		return &cards[player][3][view];
+	case LOCATION_EXTRA:
+		return &cards[player][4][view];
+	}
+	return 0;
+}
+
+}
@@ -0,0 +1,43 @@
+#ifndef FIELD_MIRROR_H
+#define FIELD_MIRROR_H
+
+#include "config.h"
+#include <vector>
+
+namespace ygo {
+
+//the cards of a location as seen by its controller, or by the opponent and the observers
+#define FIELD_VIEW_OWNER	0
+#define FIELD_VIEW_PUBLIC	1
+
+//query fields that hold one value and are only sent again when the value changes
+#define FIELD_MIRROR_FIELDS	0x7c1fff
+
+struct MirrorCard {
+	bool is_valid;
+	unsigned int fieldid;
+	int flag; //fields the viewer has received for this card
+	int value[32];
+};
+
+/*
+ * Remembers the MSG_UPDATE_DATA entries each view of a location has received,
+ * so a refresh only sends the fields that changed since the last one.
+ * A card is known by its slot and its field id, which changes whenever it moves.
+ */
+class FieldMirror {
+public:
+	void Clear();
+	void ClearLocation(int player, int location);
+	void ClearCard(int player, int location, int sequence);
+	int Update(unsigned long pduel, int view, const char* query_buffer, int len, char* delta_buffer);
+
+private:
+	std::vector<MirrorCard>* GetCards(int player, int location, int view);
+
+	std::vector<MirrorCard> cards[2][5][2];
+};
+
+}
+
+#endif //FIELD_MIRROR_H
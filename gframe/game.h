@@ -192,6 +192,7 @@ public:
 	irr::gui::IGUIEditBox* ebJoinIP;
 	irr::gui::IGUIEditBox* ebJoinPort;
 	irr::gui::IGUIEditBox* ebJoinPass;
+	irr::gui::IGUIEditBox* ebJoinRoom;
 	irr::gui::IGUIButton* btnJoinHost;
 	irr::gui::IGUIButton* btnJoinCancel;
 	irr::gui::IGUIButton* btnCreateHost;
@@ -209,6 +210,7 @@ public:
 	irr::gui::IGUICheckBox* chkEnablePriority;
 	irr::gui::IGUICheckBox* chkNoCheckDeck;
 	irr::gui::IGUICheckBox* chkNoShuffleDeck;
+	irr::gui::IGUICheckBox* chkHostOnServer;
 	irr::gui::IGUIButton* btnHostConfirm;
 	irr::gui::IGUIButton* btnHostCancel;
 	//host panel
@@ -353,6 +355,8 @@ public:
 	irr::gui::IGUIButton* btnReplayStep;
 	irr::gui::IGUIButton* btnReplayExit;
 	irr::gui::IGUIButton* btnReplaySwap;
+	irr::gui::IGUIButton* btnReplayPrevTurn;
+	irr::gui::IGUIButton* btnReplayNextTurn;
 	//surrender/leave
 	irr::gui::IGUIButton* btnLeaveGame;
 
@@ -460,6 +464,8 @@ extern Game* mainGame;
 #define BUTTON_REPLAY_STEP			322
 #define BUTTON_REPLAY_EXIT			323
 #define BUTTON_REPLAY_SWAP			324
+#define BUTTON_REPLAY_PREV_TURN		325
+#define BUTTON_REPLAY_NEXT_TURN		326
 #define BUTTON_REPLAY_SAVE			330
 #define BUTTON_REPLAY_CANCEL		331
 #define LISTBOX_SINGLEPLAY_LIST		350
@@ -1,6 +1,8 @@
 #include "config.h"
 #include "game.h"
 #include "data_manager.h"
+#include "deck_manager.h"
+#include "netserver.h"
 #include <event2/thread.h>
 
 int enable_log = 0;
@@ -16,6 +18,25 @@ int main(int argc, char* argv[]) {
 #else
 	evthread_use_pthreads();
 #endif //_WIN32
+	if(argc > 1 && !strcmp(argv[1], "-m")) {
+		/* -m [port] [threads] [stats]: a dedicated server hosting many rooms, without the window,
+		 * clients create a room on it and join a room by its id;
+		 * with stats > 0 the replay writer counters are printed every stats seconds */
+		unsigned short port = argc > 2 ? atoi(argv[2]) : 7911;
+		int threads = argc > 3 ? atoi(argv[3]) : 4;
+		int stats_interval = argc > 4 ? atoi(argv[4]) : 0;
+		enable_log = 2;
+		srand(time(0));
+		ygo::deckManager.LoadLFList();
+		if(!ygo::dataManager.LoadDB("cards.cdb"))
+			return EXIT_FAILURE;
+		if(!ygo::NetServer::StartServer(port, true, threads, stats_interval)) {
+			fprintf(stderr, "cannot listen on port %d\n", port);
+			return EXIT_FAILURE;
+		}
+		ygo::NetServer::WaitServer();
+		return EXIT_SUCCESS;
+	}
 	ygo::Game _game;
 	ygo::mainGame = &_game;
 	if(!ygo::mainGame->Initialize())
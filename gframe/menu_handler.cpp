@@ -10,6 +10,41 @@
 
 namespace ygo {
 
+//the address in the host info of the lan window, in host byte order
+static unsigned int GetJoinAddress() {
+#if WINVER >= 0x0600
+	struct addrinfo hints, *servinfo;
+	memset(&hints, 0, sizeof(struct addrinfo));
+	hints.ai_family = AF_INET;			/* Allow IPv4 or IPv6 */
+	hints.ai_socktype = SOCK_STREAM;	/* Datagram socket */
+	hints.ai_flags = AI_PASSIVE;		/* For wildcard IP address */
+	hints.ai_protocol = 0;				/* Any protocol */
+	hints.ai_canonname = NULL;
+	hints.ai_addr = NULL;
+	hints.ai_next = NULL;
+	int status;
+	char hostname[100];
+	char ip[20];
+	const wchar_t* pstr = mainGame->ebJoinIP->getText();
+	BufferIO::CopyWStr(pstr, hostname, 100);
+	if ((status = getaddrinfo(hostname, NULL, &hints, &servinfo)) == -1) {
+		fprintf(stderr, "getaddrinfo error: %s\n", gai_strerror(status));
+		//error handling
+		BufferIO::CopyWStr(pstr, ip, 16);
+	} else
+		inet_ntop(AF_INET, &(((struct sockaddr_in *)servinfo->ai_addr)->sin_addr), ip, 20);
+	freeaddrinfo(servinfo);
+#else
+	int status;
+	char hostname[100];
+	char ip[20];
+	const wchar_t* pstr = mainGame->ebJoinIP->getText();
+	BufferIO::CopyWStr(pstr, hostname, 100);
+	BufferIO::CopyWStr(pstr, ip, 16);
+#endif
+	return htonl(inet_addr(ip));
+}
+
 bool MenuHandler::OnEvent(const irr::SEvent& event) {
 	switch(event.EventType) {
 	case irr::EET_GUI_EVENT: {
@@ -31,40 +66,11 @@ bool MenuHandler::OnEvent(const irr::SEvent& event) {
 				break;
 			}
 			case BUTTON_JOIN_HOST: {
-			#if WINVER >= 0x0600
-				struct addrinfo hints, *servinfo;
-				memset(&hints, 0, sizeof(struct addrinfo));
-				hints.ai_family = AF_INET;			/* Allow IPv4 or IPv6 */
-				hints.ai_socktype = SOCK_STREAM;	/* Datagram socket */
-				hints.ai_flags = AI_PASSIVE;		/* For wildcard IP address */
-				hints.ai_protocol = 0;				/* Any protocol */
-				hints.ai_canonname = NULL;
-				hints.ai_addr = NULL;
-				hints.ai_next = NULL;
-				int status;
-				char hostname[100];
-				char ip[20];
-				const wchar_t* pstr = mainGame->ebJoinIP->getText();
-				BufferIO::CopyWStr(pstr, hostname, 100);
-				if ((status = getaddrinfo(hostname, NULL, &hints, &servinfo)) == -1) {
-					fprintf(stderr, "getaddrinfo error: %s\n", gai_strerror(status));
-					//error handling
-					BufferIO::CopyWStr(pstr, ip, 16);
-				} else
-					inet_ntop(AF_INET, &(((struct sockaddr_in *)servinfo->ai_addr)->sin_addr), ip, 20);
-				freeaddrinfo(servinfo);
-			#else
-				int status;
-				char hostname[100];
-				char ip[20];
-				const wchar_t* pstr = mainGame->ebJoinIP->getText();
-				BufferIO::CopyWStr(pstr, hostname, 100);
-				BufferIO::CopyWStr(pstr, ip, 16);
-			#endif
-				unsigned int remote_addr = htonl(inet_addr(ip));
+				unsigned int remote_addr = GetJoinAddress();
 				unsigned int remote_port = _wtoi(mainGame->ebJoinPort->getText());
-				BufferIO::CopyWStr(pstr, mainGame->gameConf.lastip, 20);
+				BufferIO::CopyWStr(mainGame->ebJoinIP->getText(), mainGame->gameConf.lastip, 20);
 				BufferIO::CopyWStr(mainGame->ebJoinPort->getText(), mainGame->gameConf.lastport, 20);
+				DuelClient::room_id = _wtoi(mainGame->ebJoinRoom->getText());
 				if(DuelClient::StartClient(remote_addr, remote_port, false)) {
 					mainGame->btnCreateHost->setEnabled(false);
 					mainGame->btnJoinHost->setEnabled(false);
@@ -90,11 +96,18 @@ bool MenuHandler::OnEvent(const irr::SEvent& event) {
 			}
 			case BUTTON_HOST_CONFIRM: {
 				BufferIO::CopyWStr(mainGame->ebServerName->getText(), mainGame->gameConf.gamename, 20);
-				if(!NetServer::StartServer(mainGame->gameConf.serverport))
-					break;
-				if(!DuelClient::StartClient(0x7f000001, mainGame->gameConf.serverport)) {
-					NetServer::StopServer();
-					break;
+				DuelClient::room_id = 0;
+				if(mainGame->chkHostOnServer->isChecked()) {
+					//the room is created on the multi-room server of the host info, which sends back its id
+					if(!DuelClient::StartClient(GetJoinAddress(), _wtoi(mainGame->ebJoinPort->getText())))
+						break;
+				} else {
+					if(!NetServer::StartServer(mainGame->gameConf.serverport))
+						break;
+					if(!DuelClient::StartClient(0x7f000001, mainGame->gameConf.serverport)) {
+						NetServer::StopServer();
+						break;
+					}
 				}
 				mainGame->btnHostConfirm->setEnabled(false);
 				mainGame->btnHostCancel->setEnabled(false);
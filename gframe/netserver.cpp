@@ -1,24 +1,38 @@
 #include "netserver.h"
 #include "single_duel.h"
 #include "tag_duel.h"
+#include "replay_writer.h"
 
 namespace ygo {
 std::unordered_map<bufferevent*, DuelPlayer> NetServer::users;
 unsigned short NetServer::server_port = 0;
 event_base* NetServer::net_evbase = 0;
 event* NetServer::broadcast_ev = 0;
+event* NetServer::stats_ev = 0;
 evconnlistener* NetServer::listener = 0;
-DuelMode* NetServer::duel_mode = 0;
+std::unordered_map<unsigned int, DuelMode*> NetServer::rooms;
+std::vector<DuelMode*> NetServer::stopped_rooms;
+unsigned int NetServer::room_count = 0;
+bool NetServer::multi_room = false;
+Mutex NetServer::room_mutex;
+std::vector<RoomWorker*> NetServer::workers;
+Signal NetServer::server_exited;
 char NetServer::net_server_read[0x2000];
-char NetServer::net_server_write[0x2000];
-unsigned short NetServer::last_sent = 0;
+THREAD_LOCAL char NetServer::net_server_write[0x2000];
+THREAD_LOCAL unsigned short NetServer::last_sent = 0;
+THREAD_LOCAL SharedPacket* NetServer::last_packet = 0;
+THREAD_LOCAL int NetServer::batch_depth = 0;
+THREAD_LOCAL std::vector<DuelPlayer*>* NetServer::batch_players = 0;
 
-bool NetServer::StartServer(unsigned short port) {
+bool NetServer::StartServer(unsigned short port, bool multi, int threads, int stats_interval) {
 	if(net_evbase)
 		return false;
 	net_evbase = event_base_new();
 	if(!net_evbase)
 		return false;
+	multi_room = multi;
+	room_count = 0;
+	server_exited.Reset();
 	sockaddr_in sin;
 	memset(&sin, 0, sizeof(sin));
 	server_port = port;
@@ -33,9 +47,30 @@ bool NetServer::StartServer(unsigned short port) {
 		return false;
 	}
 	evconnlistener_set_error_cb(listener, ServerAcceptError);
+	if(multi) {
+		for(int i = 0; i < threads; ++i) {
+			RoomWorker* rw = new RoomWorker;
+			rw->base = event_base_new();
+			//the notify event only gets activated from the network thread, the timeout keeps the loop alive
+			rw->notify = event_new(rw->base, -1, EV_PERSIST, WorkerNotify, rw);
+			timeval keepalive = {3600, 0};
+			event_add(rw->notify, &keepalive);
+			workers.push_back(rw);
+			Thread::NewThread(WorkerThread, rw);
+		}
+	}
+	if(stats_interval > 0) {
+		stats_ev = event_new(net_evbase, -1, EV_PERSIST, StatsEvent, NULL);
+		timeval interval = {stats_interval, 0};
+		event_add(stats_ev, &interval);
+	}
 	Thread::NewThread(ServerThread, net_evbase);
 	return true;
 }
+//blocks until the server thread has stopped, for a process that only runs the server
+void NetServer::WaitServer() {
+	server_exited.Wait();
+}
 bool NetServer::StartBroadcast() {
 	if(!net_evbase)
 		return false;
@@ -58,8 +93,11 @@ bool NetServer::StartBroadcast() {
 void NetServer::StopServer() {
 	if(!net_evbase)
 		return;
-	if(duel_mode)
-		duel_mode->EndDuel();
+	//rooms owned by workers are ended in ServerThread once the workers have stopped
+	if(workers.empty()) {
+		for(auto rit = rooms.begin(); rit != rooms.end(); ++rit)
+			rit->second->EndDuel();
+	}
 	event_base_loopexit(net_evbase, 0);
 }
 void NetServer::StopBroadcast() {
@@ -76,6 +114,190 @@ void NetServer::StopListen() {
 	evconnlistener_disable(listener);
 	StopBroadcast();
 }
+DuelMode* NetServer::FindRoom(unsigned int room_id) {
+	DuelMode* dm = 0;
+	room_mutex.Lock();
+	if(!multi_room && room_id == 0) {
+		if(!rooms.empty())
+			dm = rooms.begin()->second;
+	} else {
+		auto rit = rooms.find(room_id);
+		if(rit != rooms.end())
+			dm = rit->second;
+	}
+	room_mutex.Unlock();
+	return dm;
+}
+void NetServer::LockRoom(DuelMode* dm) {
+	room_mutex.Lock();
+	dm->is_locked = true;
+	room_mutex.Unlock();
+	if(!multi_room)
+		StopListen();
+}
+void NetServer::StopRoom(DuelMode* dm) {
+	if(!multi_room) {
+		StopServer();
+		return;
+	}
+	room_mutex.Lock();
+	auto rit = rooms.find(dm->room_id);
+	if(rit == rooms.end() || rit->second != dm) {
+		room_mutex.Unlock();
+		return;
+	}
+	rooms.erase(rit);
+	dm->is_locked = true;
+	//the room may still be on the call stack, release it on the next loop iteration
+	stopped_rooms.push_back(dm);
+	bool schedule = stopped_rooms.size() == 1;
+	room_mutex.Unlock();
+	dm->EndDuel();
+	if(workers.empty()) {
+		for(auto bit = users.begin(); bit != users.end(); ++bit)
+			if(bit->second.game == dm)
+				bit->second.state = 0xff;
+	}
+	if(schedule) {
+		timeval timeout = {0, 0};
+		event_base_once(net_evbase, -1, EV_TIMEOUT, RoomCleanup, 0, &timeout);
+	}
+}
+void NetServer::RoomCleanup(evutil_socket_t fd, short events, void* arg) {
+	std::vector<DuelMode*> stopped;
+	room_mutex.Lock();
+	stopped.swap(stopped_rooms);
+	room_mutex.Unlock();
+	for(auto rit = stopped.begin(); rit != stopped.end(); ++rit)
+		FreeRoom(*rit);
+}
+void NetServer::FreeRoom(DuelMode* dm) {
+	std::vector<bufferevent*> players;
+	room_mutex.Lock();
+	for(auto bit = users.begin(); bit != users.end(); ++bit)
+		if(bit->second.game == dm)
+			players.push_back(bit->first);
+	room_mutex.Unlock();
+	for(auto pit = players.begin(); pit != players.end(); ++pit) {
+		auto bit = users.find(*pit);
+		FreePlayer(bit->first, bit->second);
+		users.erase(bit);
+	}
+	//tasks of this room may still be queued, so the worker deletes it after them
+	if(!workers.empty()) {
+		PostTask(ROOMTASK_DELETE, dm, 0);
+		return;
+	}
+	event_free(dm->etimer);
+	delete dm;
+}
+/*
+ * The callback of Replay::EndRecordAsync for the rooms, runs on the ReplayWriter thread.
+ * The room is not deleted before the writer is done with its replay, see Replay::EndRecord,
+ * but it may be stopped by the time the task is run on the thread of the room.
+ */
+void NetServer::ReplayWritten(void* arg) {
+	DuelMode* dm = (DuelMode*)arg;
+	if(!workers.empty()) {
+		PostTask(ROOMTASK_REPLAY, dm, 0);
+		return;
+	}
+	RoomTask* task = new RoomTask;
+	task->type = ROOMTASK_REPLAY;
+	task->dm = dm;
+	task->room_id = dm->room_id;
+	task->dp = 0;
+	task->bev = 0;
+	timeval timeout = {0, 0};
+	event_base_once(net_evbase, -1, EV_TIMEOUT, ReplayTask, task, &timeout);
+}
+void NetServer::ReplayTask(evutil_socket_t fd, short events, void* arg) {
+	RoomTask* task = (RoomTask*)arg;
+	RoomReplayEnded(task->dm, task->room_id);
+	delete task;
+}
+void NetServer::RoomReplayEnded(DuelMode* dm, unsigned int room_id) {
+	//a stopped room is not touched, it may be gone already
+	if(FindRoom(room_id) != dm)
+		return;
+	dm->ReplayEnded();
+}
+//prints the replay writer counters every stats_interval seconds, when the server was started with one
+void NetServer::StatsEvent(evutil_socket_t fd, short events, void* arg) {
+	ReplayWriterStats stats;
+	ReplayWriter::GetStats(stats);
+	printf("replay writer: %u queued (max %u), %llu blocks, %llu bytes compressed to %llu, %u full waits\n",
+	       stats.queued, stats.max_queued, stats.jobs, stats.raw_bytes, stats.comp_bytes, stats.full_waits);
+	fflush(stdout);
+}
+RoomWorker* NetServer::GetWorker(DuelMode* dm) {
+	return workers[dm->room_id % workers.size()];
+}
+void NetServer::PostTask(unsigned char type, DuelMode* dm, DuelPlayer* dp, char* data, unsigned int len) {
+	RoomWorker* rw = GetWorker(dm);
+	rw->mutex.Lock();
+	rw->tasks.push_back(RoomTask());
+	RoomTask& task = rw->tasks.back();
+	task.type = type;
+	task.dm = dm;
+	task.room_id = dm->room_id;
+	task.dp = dp;
+	task.bev = 0;
+	if(len)
+		task.data.assign(data, data + len);
+	rw->mutex.Unlock();
+	event_active(rw->notify, EV_TIMEOUT, 0);
+}
+void NetServer::WorkerNotify(evutil_socket_t fd, short events, void* arg) {
+	RoomWorker* rw = (RoomWorker*)arg;
+	std::list<RoomTask> tasks;
+	rw->mutex.Lock();
+	tasks.swap(rw->tasks);
+	rw->mutex.Unlock();
+	for(auto tit = tasks.begin(); tit != tasks.end(); ++tit) {
+		DuelMode* dm = tit->dm;
+		if(tit->type == ROOMTASK_RELEASE) {
+			//the tasks of the player queued before are done, the network thread closes the connection
+			timeval timeout = {0, 0};
+			event_base_once(net_evbase, -1, EV_TIMEOUT, ReleasedPlayer, tit->bev, &timeout);
+			continue;
+		}
+		if(tit->type == ROOMTASK_DELETE) {
+			event_free(dm->etimer);
+			delete dm;
+			continue;
+		}
+		if(tit->type == ROOMTASK_REPLAY) {
+			RoomReplayEnded(dm, tit->room_id);
+			continue;
+		}
+		if(FindRoom(dm->room_id) != dm)
+			continue;
+		//packets and the leave of a player the room has let go of, queued before the network thread knew
+		if(tit->dp && tit->dp->released)
+			continue;
+		switch(tit->type) {
+		case ROOMTASK_PACKET:
+			HandleCTOSPacket(tit->dp, &tit->data[0], tit->data.size());
+			break;
+		case ROOMTASK_JOIN:
+			//already checked on the network thread, seat the player like the creator
+			dm->JoinGame(tit->dp, 0, true);
+			break;
+		case ROOMTASK_LEAVE:
+			dm->LeaveGame(tit->dp);
+			break;
+		}
+	}
+}
+int NetServer::WorkerThread(void* param) {
+	RoomWorker* rw = (RoomWorker*)param;
+	event_base_dispatch(rw->base);
+	ReleaseLastPacket();
+	delete batch_players;
+	rw->exited.Set();
+	return 0;
+}
 void NetServer::BroadcastEvent(evutil_socket_t fd, short events, void* arg) {
 	sockaddr_in bc_addr;
 	socklen_t sz = sizeof(sockaddr_in);
@@ -93,13 +315,19 @@ void NetServer::BroadcastEvent(evutil_socket_t fd, short events, void* arg) {
 		hp.identifier = NETWORK_SERVER_ID;
 		hp.port = server_port;
 		hp.version = PRO_VERSION;
-		hp.host = duel_mode->host_info;
-		BufferIO::CopyWStr(duel_mode->name, hp.name, 20);
+		DuelMode* dm = FindRoom(0);
+		if(!dm)
+			return;
+		hp.host = dm->host_info;
+		BufferIO::CopyWStr(dm->name, hp.name, 20);
 		sendto(fd, (const char*)&hp, sizeof(HostPacket), 0, (sockaddr*)&sockTo, sizeof(sockTo));
 	}
 }
 void NetServer::ServerAccept(evconnlistener* listener, evutil_socket_t fd, sockaddr* address, int socklen, void* ctx) {
-	bufferevent* bev = bufferevent_socket_new(net_evbase, fd, BEV_OPT_CLOSE_ON_FREE);
+	int options = BEV_OPT_CLOSE_ON_FREE;
+	if(!workers.empty())
+		options |= BEV_OPT_THREADSAFE;
+	bufferevent* bev = bufferevent_socket_new(net_evbase, fd, options);
 	DuelPlayer dp;
 	dp.name[0] = 0;
 	dp.type = 0xff;
@@ -122,26 +350,52 @@ void NetServer::ServerEchoRead(bufferevent *bev, void *ctx) {
 		if(len < (size_t)packet_len + 2)
 			return;
 		evbuffer_remove(input, net_server_read, packet_len + 2);
-		if(packet_len)
-			HandleCTOSPacket(&users[bev], &net_server_read[2], packet_len);
+		if(packet_len) {
+			DuelPlayer* dp = &users[bev];
+			DuelMode* dm = 0;
+			if(!workers.empty()) {
+				room_mutex.Lock();
+				dm = dp->game;
+				room_mutex.Unlock();
+			}
+			if(dm)
+				PostTask(ROOMTASK_PACKET, dm, dp, &net_server_read[2], packet_len);
+			else
+				HandleCTOSPacket(dp, &net_server_read[2], packet_len);
+		}
 		len -= packet_len + 2;
 	}
 }
 void NetServer::ServerEchoEvent(bufferevent* bev, short events, void* ctx) {
 	if (events & (BEV_EVENT_EOF | BEV_EVENT_ERROR)) {
 		DuelPlayer* dp = &users[bev];
+		room_mutex.Lock();
 		DuelMode* dm = dp->game;
-		if(dm)
-			dm->LeaveGame(dp);
-		else DisconnectPlayer(dp);
+		room_mutex.Unlock();
+		if(dm && FindRoom(dm->room_id) == dm) {
+			if(!workers.empty()) {
+				bufferevent_setcb(bev, NULL, NULL, NULL, NULL);
+				PostTask(ROOMTASK_LEAVE, dm, dp);
+			} else
+				dm->LeaveGame(dp);
+		} else ClosePlayer(bev);
 	}
 }
 int NetServer::ServerThread(void* param) {
 	event_base_dispatch(net_evbase);
-	for(auto bit = users.begin(); bit != users.end(); ++bit) {
-		bufferevent_disable(bit->first, EV_READ);
-		bufferevent_free(bit->first);
+	ReleaseLastPacket();
+	delete batch_players;
+	batch_players = 0;
+	for(auto wit = workers.begin(); wit != workers.end(); ++wit) {
+		event_base_loopexit((*wit)->base, 0);
+		(*wit)->exited.Wait();
+	}
+	if(!workers.empty()) {
+		for(auto rit = rooms.begin(); rit != rooms.end(); ++rit)
+			rit->second->EndDuel();
 	}
+	for(auto bit = users.begin(); bit != users.end(); ++bit)
+		FreePlayer(bit->first, bit->second);
 	users.clear();
 	evconnlistener_free(listener);
 	listener = 0;
@@ -152,24 +406,177 @@ int NetServer::ServerThread(void* param) {
 		event_free(broadcast_ev);
 		broadcast_ev = 0;
 	}
-	if(duel_mode) {
-		event_free(duel_mode->etimer);
-		delete duel_mode;
+	if(stats_ev) {
+		event_free(stats_ev);
+		stats_ev = 0;
 	}
-	duel_mode = 0;
+	for(auto rit = rooms.begin(); rit != rooms.end(); ++rit) {
+		event_free(rit->second->etimer);
+		delete rit->second;
+	}
+	rooms.clear();
+	for(auto rit = stopped_rooms.begin(); rit != stopped_rooms.end(); ++rit) {
+		event_free((*rit)->etimer);
+		delete *rit;
+	}
+	stopped_rooms.clear();
+	for(auto wit = workers.begin(); wit != workers.end(); ++wit) {
+		RoomWorker* rw = *wit;
+		for(auto tit = rw->tasks.begin(); tit != rw->tasks.end(); ++tit) {
+			if(tit->type == ROOMTASK_DELETE) {
+				event_free(tit->dm->etimer);
+				delete tit->dm;
+			}
+		}
+		event_free(rw->notify);
+		event_base_free(rw->base);
+		delete rw;
+	}
+	workers.clear();
 	event_base_free(net_evbase);
 	net_evbase = 0;
+	server_exited.Set();
 	return 0;
 }
 void NetServer::DisconnectPlayer(DuelPlayer* dp) {
-	auto bit = users.find(dp->bev);
-	if(bit != users.end()) {
-		bufferevent_flush(dp->bev, EV_WRITE, BEV_FLUSH);
+	if(!workers.empty() && dp->game) {
+		//called from a room worker, the room lets go of the player and the network thread closes the connection
+		FlushPlayer(dp);
+		bufferevent_setcb(dp->bev, NULL, NULL, NULL, NULL);
 		bufferevent_disable(dp->bev, EV_READ);
-		bufferevent_free(dp->bev);
+		dp->state = 0xff;
+		dp->released = true;
+		PlayerRelease* release = new PlayerRelease;
+		release->bev = dp->bev;
+		release->worker = GetWorker(dp->game);
+		room_mutex.Lock();
+		dp->game = 0;
+		room_mutex.Unlock();
+		timeval timeout = {0, 0};
+		event_base_once(net_evbase, -1, EV_TIMEOUT, ReleasePlayer, release, &timeout);
+		return;
+	}
+	ClosePlayer(dp->bev);
+}
+void NetServer::ClosePlayer(bufferevent* bev) {
+	auto bit = users.find(bev);
+	if(bit != users.end()) {
+		FlushPlayer(&bit->second);
+		bufferevent_flush(bev, EV_WRITE, BEV_FLUSH);
+		FreePlayer(bev, bit->second);
 		users.erase(bit);
 	}
 }
+/*
+ * Runs on the network thread after DisconnectPlayer on a room worker. No more packets of the player
+ * get queued now, the worker is sent a task to come back once it has run the ones queued before.
+ */
+void NetServer::ReleasePlayer(evutil_socket_t fd, short events, void* arg) {
+	PlayerRelease* release = (PlayerRelease*)arg;
+	RoomWorker* rw = release->worker;
+	rw->mutex.Lock();
+	rw->tasks.push_back(RoomTask());
+	RoomTask& task = rw->tasks.back();
+	task.type = ROOMTASK_RELEASE;
+	task.dm = 0;
+	task.room_id = 0;
+	task.dp = 0;
+	task.bev = release->bev;
+	rw->mutex.Unlock();
+	event_active(rw->notify, EV_TIMEOUT, 0);
+	delete release;
+}
+void NetServer::ReleasedPlayer(evutil_socket_t fd, short events, void* arg) {
+	ClosePlayer((bufferevent*)arg);
+}
+/*
+ * Returns the buffer the next packet of len bytes is written to. Short packets use
+ * net_server_write and are copied to every recipient; longer ones are built once in
+ * a SharedPacket, which the output buffers of all recipients reference.
+ */
+char* NetServer::BeginPacket(unsigned short len) {
+	last_sent = len;
+	ReleaseLastPacket();
+	if(len < SHARED_PACKET_SIZE)
+		return net_server_write;
+	last_packet = (SharedPacket*)malloc(sizeof(SharedPacket) + len);
+	last_packet->ref_count = 1;
+	last_packet->len = len;
+	return last_packet->data();
+}
+void NetServer::ReleasePacket(SharedPacket* packet) {
+#ifdef _WIN32
+	long refs = InterlockedDecrement(&packet->ref_count);
+#else
+	long refs = __sync_sub_and_fetch(&packet->ref_count, 1);
+#endif
+	if(refs == 0)
+		free(packet);
+}
+//called by libevent, on any thread, once a recipient has sent the packet or was closed
+void NetServer::PacketCleanup(const void* data, size_t len, void* arg) {
+	ReleasePacket((SharedPacket*)arg);
+}
+void NetServer::SendSharedPacket(DuelPlayer* dp) {
+#ifdef _WIN32
+	InterlockedIncrement(&last_packet->ref_count);
+#else
+	__sync_add_and_fetch(&last_packet->ref_count, 1);
+#endif
+	evbuffer* output = GetOutput(dp);
+	if(evbuffer_add_reference(output, last_packet->data(), last_packet->len, PacketCleanup, last_packet) != 0) {
+		ReleasePacket(last_packet);
+		evbuffer_add(output, last_packet->data(), last_packet->len);
+	}
+}
+/*
+ * Packets sent between BeginBatch and EndBatch are held in the pending buffer of each
+ * player and handed to the connection at once by EndBatch, so a whole run of the duel
+ * engine reaches every player with one write instead of one per packet.
+ */
+void NetServer::BeginBatch() {
+	batch_depth++;
+}
+void NetServer::EndBatch() {
+	if(--batch_depth > 0 || !batch_players)
+		return;
+	for(auto pit = batch_players->begin(); pit != batch_players->end(); ++pit)
+		bufferevent_write_buffer((*pit)->bev, (*pit)->pending);
+	batch_players->clear();
+}
+evbuffer* NetServer::GetOutput(DuelPlayer* dp) {
+	if(!batch_depth)
+		return bufferevent_get_output(dp->bev);
+	if(!dp->pending)
+		dp->pending = evbuffer_new();
+	if(evbuffer_get_length(dp->pending) == 0) {
+		if(!batch_players)
+			batch_players = new std::vector<DuelPlayer*>;
+		batch_players->push_back(dp);
+	}
+	return dp->pending;
+}
+//sends the held back packets of a player that leaves in the middle of a batch
+void NetServer::FlushPlayer(DuelPlayer* dp) {
+	if(!dp->pending || evbuffer_get_length(dp->pending) == 0)
+		return;
+	bufferevent_write_buffer(dp->bev, dp->pending);
+	if(batch_players)
+		batch_players->erase(std::remove(batch_players->begin(), batch_players->end(), dp), batch_players->end());
+}
+void NetServer::FreePlayer(bufferevent* bev, DuelPlayer& dp) {
+	bufferevent_disable(bev, EV_READ);
+	bufferevent_free(bev);
+	if(dp.pending)
+		evbuffer_free(dp.pending);
+	dp.pending = 0;
+}
+void NetServer::ReleaseLastPacket() {
+	if(!last_packet)
+		return;
+	ReleasePacket(last_packet);
+	last_packet = 0;
+}
 void NetServer::HandleCTOSPacket(DuelPlayer* dp, char* data, unsigned int len) {
 	char* pdata = data;
 	unsigned char pktType = BufferIO::ReadUInt8(pdata);
@@ -177,27 +584,27 @@ void NetServer::HandleCTOSPacket(DuelPlayer* dp, char* data, unsigned int len) {
 		return;
 	switch(pktType) {
 	case CTOS_RESPONSE: {
-		if(!dp->game || !duel_mode->pduel)
+		if(!dp->game || !dp->game->pduel)
 			return;
-		duel_mode->GetResponse(dp, pdata, len > 64 ? 64 : len - 1);
+		dp->game->GetResponse(dp, pdata, len > 64 ? 64 : len - 1);
 		break;
 	}
 	case CTOS_TIME_CONFIRM: {
-		if(!dp->game || !duel_mode->pduel)
+		if(!dp->game || !dp->game->pduel)
 			return;
-		duel_mode->TimeConfirm(dp);
+		dp->game->TimeConfirm(dp);
 		break;
 	}
 	case CTOS_CHAT: {
 		if(!dp->game)
 			return;
-		duel_mode->Chat(dp, pdata, len - 1);
+		dp->game->Chat(dp, pdata, len - 1);
 		break;
 	}
 	case CTOS_UPDATE_DECK: {
 		if(!dp->game)
 			return;
-		duel_mode->UpdateDeck(dp, pdata);
+		dp->game->UpdateDeck(dp, pdata);
 		break;
 	}
 	case CTOS_HAND_RESULT: {
@@ -220,19 +627,18 @@ void NetServer::HandleCTOSPacket(DuelPlayer* dp, char* data, unsigned int len) {
 		break;
 	}
 	case CTOS_CREATE_GAME: {
-		if(dp->game || duel_mode)
+		if(dp->game || (!multi_room && !rooms.empty()))
 			return;
 		CTOS_CreateGame* pkt = (CTOS_CreateGame*)pdata;
-		if(pkt->info.mode == MODE_SINGLE) {
-			duel_mode = new SingleDuel(false);
-			duel_mode->etimer = event_new(net_evbase, 0, EV_TIMEOUT | EV_PERSIST, SingleDuel::SingleTimer, duel_mode);
-		} else if(pkt->info.mode == MODE_MATCH) {
-			duel_mode = new SingleDuel(true);
-			duel_mode->etimer = event_new(net_evbase, 0, EV_TIMEOUT | EV_PERSIST, SingleDuel::SingleTimer, duel_mode);
-		} else if(pkt->info.mode == MODE_TAG) {
-			duel_mode = new TagDuel();
-			duel_mode->etimer = event_new(net_evbase, 0, EV_TIMEOUT | EV_PERSIST, TagDuel::TagTimer, duel_mode);
-		}
+		DuelMode* dm = 0;
+		if(pkt->info.mode == MODE_SINGLE)
+			dm = new SingleDuel(false);
+		else if(pkt->info.mode == MODE_MATCH)
+			dm = new SingleDuel(true);
+		else if(pkt->info.mode == MODE_TAG)
+			dm = new TagDuel();
+		if(!dm)
+			return;
 		if(pkt->info.rule > 3)
 			pkt->info.rule = 0;
 		if(pkt->info.mode > 2)
@@ -246,61 +652,125 @@ void NetServer::HandleCTOSPacket(DuelPlayer* dp, char* data, unsigned int len) {
 		}
 		if(hash == 1)
 			pkt->info.lflist = deckManager._lfList[0].hash;
-		duel_mode->host_info = pkt->info;
-		BufferIO::CopyWStr(pkt->name, duel_mode->name, 20);
-		BufferIO::CopyWStr(pkt->pass, duel_mode->pass, 20);
-		duel_mode->JoinGame(dp, 0, true);
-		StartBroadcast();
+		dm->host_info = pkt->info;
+		BufferIO::CopyWStr(pkt->name, dm->name, 20);
+		BufferIO::CopyWStr(pkt->pass, dm->pass, 20);
+		room_mutex.Lock();
+		do {
+			room_count++;
+		} while(room_count == 0 || rooms.count(room_count));
+		dm->room_id = room_count;
+		//room timers run on the thread that processes the room
+		event_base* room_base = workers.empty() ? net_evbase : GetWorker(dm)->base;
+		if(pkt->info.mode == MODE_TAG)
+			dm->etimer = event_new(room_base, 0, EV_TIMEOUT | EV_PERSIST, TagDuel::TagTimer, dm);
+		else
+			dm->etimer = event_new(room_base, 0, EV_TIMEOUT | EV_PERSIST, SingleDuel::SingleTimer, dm);
+		rooms[dm->room_id] = dm;
+		room_mutex.Unlock();
+		if(multi_room) {
+			STOC_CreateGame sccg;
+			sccg.gameid = dm->room_id;
+			SendPacketToPlayer(dp, STOC_CREATE_GAME, sccg);
+		}
+		if(!workers.empty()) {
+			dp->game = dm;
+			PostTask(ROOMTASK_JOIN, dm, dp);
+			break;
+		}
+		dm->JoinGame(dp, 0, true);
+		if(!multi_room)
+			StartBroadcast();
 		break;
 	}
 	case CTOS_JOIN_GAME: {
-		if(!duel_mode)
+		CTOS_JoinGame* pkt = (CTOS_JoinGame*)pdata;
+		if(dp->game) {
+			dp->game->JoinGame(dp, pdata, false);
+			break;
+		}
+		DuelMode* dm = FindRoom(pkt->gameid);
+		bool locked = true;
+		if(dm) {
+			room_mutex.Lock();
+			locked = dm->is_locked;
+			room_mutex.Unlock();
+		}
+		if(locked) {
+			STOC_ErrorMsg scem;
+			scem.msg = ERRMSG_JOINERROR;
+			scem.code = 0;
+			SendPacketToPlayer(dp, STOC_ERROR_MSG, scem);
 			break;
-		duel_mode->JoinGame(dp, pdata, false);
+		}
+		if(!workers.empty()) {
+			//reject here what JoinGame would reject, the room thread only seats the player
+			if(pkt->version != PRO_VERSION) {
+				STOC_ErrorMsg scem;
+				scem.msg = ERRMSG_VERERROR;
+				scem.code = PRO_VERSION;
+				SendPacketToPlayer(dp, STOC_ERROR_MSG, scem);
+				DisconnectPlayer(dp);
+				break;
+			}
+			wchar_t jpass[20];
+			BufferIO::CopyWStr(pkt->pass, jpass, 20);
+			if(wcscmp(jpass, dm->pass)) {
+				STOC_ErrorMsg scem;
+				scem.msg = ERRMSG_JOINERROR;
+				scem.code = 1;
+				SendPacketToPlayer(dp, STOC_ERROR_MSG, scem);
+				break;
+			}
+			dp->game = dm;
+			PostTask(ROOMTASK_JOIN, dm, dp);
+			break;
+		}
+		dm->JoinGame(dp, pdata, false);
 		break;
 	}
 	case CTOS_LEAVE_GAME: {
-		if(!duel_mode)
+		if(!dp->game)
 			break;
-		duel_mode->LeaveGame(dp);
+		dp->game->LeaveGame(dp);
 		break;
 	}
 	case CTOS_SURRENDER: {
-		if(!duel_mode)
+		if(!dp->game)
 			break;
-		duel_mode->Surrender(dp);
+		dp->game->Surrender(dp);
 		break;
 	}
 	case CTOS_HS_TODUELIST: {
-		if(!duel_mode || duel_mode->pduel)
+		if(!dp->game || dp->game->pduel)
 			break;
-		duel_mode->ToDuelist(dp);
+		dp->game->ToDuelist(dp);
 		break;
 	}
 	case CTOS_HS_TOOBSERVER: {
-		if(!duel_mode || duel_mode->pduel)
+		if(!dp->game || dp->game->pduel)
 			break;
-		duel_mode->ToObserver(dp);
+		dp->game->ToObserver(dp);
 		break;
 	}
 	case CTOS_HS_READY:
 	case CTOS_HS_NOTREADY: {
-		if(!duel_mode || duel_mode->pduel)
+		if(!dp->game || dp->game->pduel)
 			break;
-		duel_mode->PlayerReady(dp, (CTOS_HS_NOTREADY - pktType) != 0);
+		dp->game->PlayerReady(dp, (CTOS_HS_NOTREADY - pktType) != 0);
 		break;
 	}
 	case CTOS_HS_KICK: {
-		if(!duel_mode || duel_mode->pduel)
+		if(!dp->game || dp->game->pduel)
 			break;
 		CTOS_Kick* pkt = (CTOS_Kick*)pdata;
-		duel_mode->PlayerKick(dp, pkt->pos);
+		dp->game->PlayerKick(dp, pkt->pos);
 		break;
 	}
 	case CTOS_HS_START: {
-		if(!duel_mode || duel_mode->pduel)
+		if(!dp->game || dp->game->pduel)
 			break;
-		duel_mode->StartDuel(dp);
+		dp->game->StartDuel(dp);
 		break;
 	}
 	}
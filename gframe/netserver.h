@@ -6,28 +6,110 @@
 #include "data_manager.h"
 #include "deck_manager.h"
 #include <set>
+#include <list>
+#include <vector>
+#include <algorithm>
 #include <unordered_map>
 
 namespace ygo {
 
+#define ROOMTASK_PACKET		0x1
+#define ROOMTASK_JOIN		0x2
+#define ROOMTASK_LEAVE		0x3
+#define ROOMTASK_DELETE		0x4
+#define ROOMTASK_RELEASE	0x5
+#define ROOMTASK_REPLAY		0x6
+
+struct RoomTask {
+	unsigned char type;
+	DuelMode* dm;
+	unsigned int room_id; //dm may be deleted already when a replay task is run
+	DuelPlayer* dp;
+	bufferevent* bev;
+	std::vector<char> data;
+};
+
+//packets at least this long are shared by all their recipients instead of copied for each one
+#define SHARED_PACKET_SIZE	64
+
+//a packet referenced by the output buffers it was sent to, freed with the last reference
+struct SharedPacket {
+	volatile long ref_count;
+	unsigned short len;
+	char* data() {
+		return (char*)(this + 1);
+	}
+};
+
+//a worker thread running the rooms pinned to it, with its own event_base for the room timers
+struct RoomWorker {
+	event_base* base;
+	event* notify;
+	Mutex mutex;
+	Signal exited;
+	std::list<RoomTask> tasks;
+};
+
+//a connection a room worker let go of, closed once the worker has run the tasks queued for it
+struct PlayerRelease {
+	bufferevent* bev;
+	RoomWorker* worker;
+};
+
 class NetServer {
 private:
 	static std::unordered_map<bufferevent*, DuelPlayer> users;
 	static unsigned short server_port;
 	static event_base* net_evbase;
 	static event* broadcast_ev;
+	static event* stats_ev;
 	static evconnlistener* listener;
-	static DuelMode* duel_mode;
+	static std::unordered_map<unsigned int, DuelMode*> rooms;
+	static std::vector<DuelMode*> stopped_rooms;
+	static unsigned int room_count;
+	static bool multi_room;
+	static Mutex room_mutex;
+	static std::vector<RoomWorker*> workers;
+	static Signal server_exited;
 	static char net_server_read[0x2000];
-	static char net_server_write[0x2000];
-	static unsigned short last_sent;
+	static THREAD_LOCAL char net_server_write[0x2000];
+	static THREAD_LOCAL unsigned short last_sent;
+	static THREAD_LOCAL SharedPacket* last_packet;
+	static THREAD_LOCAL int batch_depth;
+	static THREAD_LOCAL std::vector<DuelPlayer*>* batch_players;
+
+	static char* BeginPacket(unsigned short len);
+	static void ReleasePacket(SharedPacket* packet);
+	static void PacketCleanup(const void* data, size_t len, void* arg);
+	static void SendSharedPacket(DuelPlayer* dp);
+	static void ReleaseLastPacket();
+	static evbuffer* GetOutput(DuelPlayer* dp);
+	static void FlushPlayer(DuelPlayer* dp);
+	static void FreePlayer(bufferevent* bev, DuelPlayer& dp);
+	static void ClosePlayer(bufferevent* bev);
+	static void ReleasePlayer(evutil_socket_t fd, short events, void* arg);
+	static void ReleasedPlayer(evutil_socket_t fd, short events, void* arg);
+	static void ReplayTask(evutil_socket_t fd, short events, void* arg);
+	static void RoomReplayEnded(DuelMode* dm, unsigned int room_id);
+	static void StatsEvent(evutil_socket_t fd, short events, void* arg);
 
 public:
-	static bool StartServer(unsigned short port);
+	static bool StartServer(unsigned short port, bool multi = false, int threads = 0, int stats_interval = 0);
+	static void WaitServer();
 	static bool StartBroadcast();
 	static void StopServer();
 	static void StopBroadcast();
 	static void StopListen();
+	static DuelMode* FindRoom(unsigned int room_id);
+	static void LockRoom(DuelMode* dm);
+	static void StopRoom(DuelMode* dm);
+	static void RoomCleanup(evutil_socket_t fd, short events, void* arg);
+	static void FreeRoom(DuelMode* dm);
+	static void ReplayWritten(void* arg);
+	static RoomWorker* GetWorker(DuelMode* dm);
+	static void PostTask(unsigned char type, DuelMode* dm, DuelPlayer* dp, char* data = 0, unsigned int len = 0);
+	static void WorkerNotify(evutil_socket_t fd, short events, void* arg);
+	static int WorkerThread(void* param);
 	static void BroadcastEvent(evutil_socket_t fd, short events, void* arg);
 	static void ServerAccept(evconnlistener* listener, evutil_socket_t fd, sockaddr* address, int socklen, void* ctx);
 	static void ServerAcceptError(evconnlistener *listener, void* ctx);
@@ -36,37 +118,37 @@ public:
 	static int ServerThread(void* param);
 	static void DisconnectPlayer(DuelPlayer* dp);
 	static void HandleCTOSPacket(DuelPlayer* dp, char* data, unsigned int len);
+	static void BeginBatch();
+	static void EndBatch();
 	static void SendPacketToPlayer(DuelPlayer* dp, unsigned char proto) {
-		char* p = net_server_write;
+		char* p = BeginPacket(3);
 		BufferIO::WriteInt16(p, 1);
 		BufferIO::WriteInt8(p, proto);
-		last_sent = 3;
-		if(!dp)
-			return;
-		bufferevent_write(dp->bev, net_server_write, last_sent);
+		ReSendToPlayer(dp);
 	}
 	template<typename ST>
 	static void SendPacketToPlayer(DuelPlayer* dp, unsigned char proto, ST& st) {
-		char* p = net_server_write;
+		char* p = BeginPacket(sizeof(ST) + 3);
 		BufferIO::WriteInt16(p, 1 + sizeof(ST));
 		BufferIO::WriteInt8(p, proto);
 		memcpy(p, &st, sizeof(ST));
-		last_sent = sizeof(ST) + 3;
-		if(dp)
-			bufferevent_write(dp->bev, net_server_write, last_sent);
+		ReSendToPlayer(dp);
 	}
 	static void SendBufferToPlayer(DuelPlayer* dp, unsigned char proto, void* buffer, size_t len) {
-		char* p = net_server_write;
+		char* p = BeginPacket(len + 3);
 		BufferIO::WriteInt16(p, 1 + len);
 		BufferIO::WriteInt8(p, proto);
 		memcpy(p, buffer, len);
-		last_sent = len + 3;
-		if(dp)
-			bufferevent_write(dp->bev, net_server_write, last_sent);
+		ReSendToPlayer(dp);
 	}
+	//sends the last packet again, a shared packet is referenced rather than copied
 	static void ReSendToPlayer(DuelPlayer* dp) {
-		if(dp)
-			bufferevent_write(dp->bev, net_server_write, last_sent);
+		if(!dp)
+			return;
+		if(last_packet)
+			SendSharedPacket(dp);
+		else
+			evbuffer_add(GetOutput(dp), net_server_write, last_sent);
 	}
 };
 
@@ -100,21 +100,31 @@ class DuelMode;
 
 struct DuelPlayer {
 	unsigned short name[20];
-	DuelMode* game;
+	DuelMode* game; //with room workers, cleared by the worker and read by the network thread under room_mutex
 	unsigned char type;
 	unsigned char state;
+	bool released; //the room worker has let go of the player, its queued tasks are dropped
 	bufferevent* bev;
+	evbuffer* pending; //packets held back until the end of a batch
 	DuelPlayer() {
 		game = 0;
 		type = 0;
 		state = 0;
+		released = false;
 		bev = 0;
+		pending = 0;
 	}
 };
 
+//what a room does once the replay of the duel it ended is sent
+#define END_ACTION_NONE		0
+#define END_ACTION_STOP		1	//stop the room
+#define END_ACTION_LEAVE	2	//a duelist left, send STOC_DUEL_END and stop the room
+#define END_ACTION_PROC		3	//DuelEndProc()
+
 class DuelMode {
 public:
-	DuelMode(): host_player(0), pduel(0) {}
+	DuelMode(): host_player(0), pduel(0), room_id(0), is_locked(false) {}
 	virtual ~DuelMode() {}
 	virtual void Chat(DuelPlayer* dp, void* pdata, int len) {}
 	virtual void JoinGame(DuelPlayer* dp, void* pdata, bool is_creater) {}
@@ -135,6 +145,7 @@ public:
 	virtual void GetResponse(DuelPlayer* dp, void* pdata, unsigned int len) {}
 	virtual void TimeConfirm(DuelPlayer* dp) {}
 	virtual void EndDuel() {};
+	virtual void ReplayEnded() {}
 
 public:
 	event* etimer;
@@ -143,6 +154,8 @@ public:
 	unsigned long pduel;
 	wchar_t name[20];
 	wchar_t pass[20];
+	unsigned int room_id;
+	bool is_locked;
 };
 
 }
@@ -193,6 +206,7 @@ public:
 #define STOC_REPLAY			0x17
 #define STOC_TIME_LIMIT		0x18
 #define STOC_CHAT			0x19
+#define STOC_REPLAY_DATA	0x1a	//a part of the compressed data of the replay, sent before STOC_REPLAY
 #define STOC_HS_PLAYER_ENTER	0x20
 #define STOC_HS_PLAYER_CHANGE	0x21
 #define STOC_HS_WATCH_CHANGE	0x22
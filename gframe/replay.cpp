@@ -1,4 +1,5 @@
 #include "replay.h"
+#include "replay_writer.h"
 #include "../ocgcore/ocgapi.h"
 #include "../ocgcore/card.h"
 #include <algorithm>
@@ -6,121 +7,156 @@
 
 namespace ygo {
 
+/*
+ * Chunked replays (REPLAY_CHUNKED) store the data after the header as a list of blocks:
+ * int raw_size, int comp_size, comp_size bytes compressed with the props of the header.
+ * Each block is compressed on its own, so a replay is written to disk while the duel
+ * goes on and decoded block by block when it is played.
+ * While recording, the blocks are compressed and written by the ReplayWriter thread,
+ * the file and comp_data belong to it until EndRecord returns.
+ */
 Replay::Replay() {
 	is_recording = false;
 	is_replaying = false;
-	replay_data = new unsigned char[0x20000];
-	comp_data = new unsigned char[0x2000];
+	data_position = 0;
+	chunk_position = 0;
+	pending_jobs = 0;
+	end_callback = 0;
+	end_arg = 0;
 }
 Replay::~Replay() {
-	delete[] replay_data;
-	delete[] comp_data;
+	EndRecord();
 }
-void Replay::BeginRecord() {
+void Replay::BeginRecord(const wchar_t* name) {
+	EndRecord();
+	wchar_t fname[64];
+	myswprintf(fname, L"./replay/%ls.yrp", name);
 #ifdef _WIN32
-	if(is_recording)
-		CloseHandle(recording_fp);
-	recording_fp = CreateFileW(L"./replay/_LastReplay.yrp", GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_FLAG_WRITE_THROUGH, NULL);
+	recording_fp = CreateFileW(fname, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_FLAG_WRITE_THROUGH, NULL);
 	if(recording_fp == INVALID_HANDLE_VALUE)
 		return;
 #else
-	if(is_recording)
-		fclose(fp);
-	fp = fopen("./replay/_LastReplay.yrp", "wb");
+	char fname2[256];
+	BufferIO::EncodeUTF8(fname, fname2);
+	fp = fopen(fname2, "wb");
 	if(!fp)
 		return;
 #endif
-	pdata = replay_data;
+	replay_data.clear();
+	comp_data.clear();
 	is_recording = true;
 }
 void Replay::WriteHeader(ReplayHeader& header) {
 	pheader = header;
+	pheader.flag |= REPLAY_COMPRESSED | REPLAY_CHUNKED;
+	pheader.datasize = 0;
 #ifdef _WIN32
 	DWORD size;
-	WriteFile(recording_fp, &header, sizeof(header), &size, NULL);
+	WriteFile(recording_fp, &pheader, sizeof(pheader), &size, NULL);
 #else
-	fwrite(&header, sizeof(header), 1, fp);
+	fwrite(&pheader, sizeof(pheader), 1, fp);
 	fflush(fp);
 #endif
 }
 void Replay::WriteData(const void* data, unsigned int length, bool flush) {
 	if(!is_recording)
 		return;
-	memcpy(pdata, data, length);
-	pdata += length;
-#ifdef _WIN32
-	DWORD size;
-	WriteFile(recording_fp, data, length, &size, NULL);
-#else
-	fwrite(data, length, 1, fp);
-	if(flush)
-		fflush(fp);
-#endif
+	replay_data.insert(replay_data.end(), (const unsigned char*)data, (const unsigned char*)data + length);
+	if(replay_data.size() >= REPLAY_CHUNK_SIZE)
+		ReplayWriter::PostChunk(this, replay_data, false);
 }
 void Replay::WriteInt32(int data, bool flush) {
-	if(!is_recording)
-		return;
-	*((int*)(pdata)) = data;
-	pdata += 4;
-#ifdef _WIN32
-	DWORD size;
-	WriteFile(recording_fp, &data, sizeof(int), &size, NULL);
-#else
-	fwrite(&data, sizeof(int), 1, fp);
-	if(flush)
-		fflush(fp);
-#endif
+	WriteData(&data, sizeof(int), flush);
 }
 void Replay::WriteInt16(short data, bool flush) {
-	if(!is_recording)
-		return;
-	*((short*)(pdata)) = data;
-	pdata += 2;
-#ifdef _WIN32
-	DWORD size;
-	WriteFile(recording_fp, &data, sizeof(short), &size, NULL);
-#else
-	fwrite(&data, sizeof(short), 1, fp);
-	if(flush)
-		fflush(fp);
-#endif
+	WriteData(&data, sizeof(short), flush);
 }
 void Replay::WriteInt8(char data, bool flush) {
-	if(!is_recording)
-		return;
-	*pdata = data;
-	pdata++;
-#ifdef _WIN32
-	DWORD size;
-	WriteFile(recording_fp, &data, sizeof(char), &size, NULL);
-#else
-	fwrite(&data, sizeof(char), 1, fp);
-	if(flush)
-		fflush(fp);
-#endif
+	WriteData(&data, sizeof(char), flush);
 }
+//hands the data recorded so far to the writer, even if it does not fill a block
 void Replay::Flush() {
-	if(!is_recording)
+	if(!is_recording || replay_data.empty())
+		return;
+	ReplayWriter::PostChunk(this, replay_data, false);
+}
+//ends the recording and waits for the writer, the callback of an EndRecordAsync still pending is dropped
+void Replay::EndRecord() {
+	if(is_recording) {
+		ReplayWriter::PostChunk(this, replay_data, true);
+		is_recording = false;
+	}
+	ReplayWriter::WaitReplay(this);
+}
+//ends the recording without waiting, callback is run once the file is closed and comp_data is complete
+void Replay::EndRecordAsync(ReplayCallback callback, void* arg) {
+	if(!is_recording) {
+		callback(arg);
+		return;
+	}
+	ReplayWriter::PostChunk(this, replay_data, true, callback, arg);
+	is_recording = false;
+}
+/*
+ * Compresses data into a new block, appends it to the file and updates the header
+ * of the file, so the file is always a valid replay. Runs on the writer thread.
+ */
+void Replay::WriteChunk(const std::vector<unsigned char>& data) {
+	size_t raw_size = data.size();
+	if(raw_size == 0)
+		return;
+	size_t block_start = comp_data.size();
+	size_t comp_size = raw_size + raw_size / 3 + 128;
+	size_t propsize = 5;
+	comp_data.resize(block_start + 8 + comp_size);
+	if(LzmaCompress(&comp_data[block_start + 8], &comp_size, &data[0], raw_size, pheader.props, &propsize, 5, REPLAY_CHUNK_DICT, 3, 0, 2, 32, 1) != SZ_OK) {
+		comp_data.resize(block_start);
 		return;
+	}
+	comp_data.resize(block_start + 8 + comp_size);
+	*((int*)&comp_data[block_start]) = raw_size;
+	*((int*)&comp_data[block_start + 4]) = comp_size;
+	pheader.datasize += raw_size;
 #ifdef _WIN32
+	DWORD size;
+	WriteFile(recording_fp, &comp_data[block_start], 8 + comp_size, &size, NULL);
+	SetFilePointer(recording_fp, 0, NULL, FILE_BEGIN);
+	WriteFile(recording_fp, &pheader, sizeof(pheader), &size, NULL);
+	SetFilePointer(recording_fp, 0, NULL, FILE_END);
 #else
+	fwrite(&comp_data[block_start], 8 + comp_size, 1, fp);
+	fseek(fp, 0, SEEK_SET);
+	fwrite(&pheader, sizeof(pheader), 1, fp);
+	fseek(fp, 0, SEEK_END);
 	fflush(fp);
 #endif
 }
-void Replay::EndRecord() {
-	if(!is_recording)
-		return;
+void Replay::CloseRecord() {
 #ifdef _WIN32
 	CloseHandle(recording_fp);
 #else
 	fclose(fp);
 #endif
-	pheader.datasize = pdata - replay_data;
-	pheader.flag |= REPLAY_COMPRESSED;
-	size_t propsize = 5;
-	comp_size = 0x1000;
-	LzmaCompress(comp_data, &comp_size, replay_data, pdata - replay_data, pheader.props, &propsize, 5, 1 << 24, 3, 0, 2, 32, 1);
-	is_recording = false;
+}
+/*
+ * A replay is sent as STOC_REPLAY_DATA packets with the compressed data, cut where the packets are full,
+ * then a STOC_REPLAY packet with the header.
+ * Writes the next part of the data from offset to buf and moves offset past it, returns 0 when all was written.
+ */
+size_t Replay::GetReplayPart(unsigned char* buf, size_t size, size_t& offset) {
+	if(offset >= comp_data.size())
+		return 0;
+	size_t len = std::min(size, comp_data.size() - offset);
+	memcpy(buf, &comp_data[offset], len);
+	offset += len;
+	return len;
+}
+//writes the header, returns its length
+size_t Replay::GetReplayData(unsigned char* buf, size_t size) {
+	if(size < sizeof(ReplayHeader))
+		return 0;
+	memcpy(buf, &pheader, sizeof(ReplayHeader));
+	return sizeof(ReplayHeader);
 }
 void Replay::SaveReplay(const wchar_t* name) {
 	wchar_t fname[64];
@@ -135,7 +171,8 @@ void Replay::SaveReplay(const wchar_t* name) {
 	if(!fp)
 		return;
 	fwrite(&pheader, sizeof(pheader), 1, fp);
-	fwrite(comp_data, comp_size, 1, fp);
+	if(comp_data.size())
+		fwrite(&comp_data[0], comp_data.size(), 1, fp);
 	fclose(fp);
 }
 bool Replay::OpenReplay(const wchar_t* name) {
@@ -150,25 +187,64 @@ bool Replay::OpenReplay(const wchar_t* name) {
 #endif
 	if(!fp)
 		return false;
+	is_replaying = false;
 	fseek(fp, 0, SEEK_END);
-	comp_size = ftell(fp) - sizeof(pheader);
+	long file_size = ftell(fp);
 	fseek(fp, 0, SEEK_SET);
-	fread(&pheader, sizeof(pheader), 1, fp);
-	if(pheader.flag & REPLAY_COMPRESSED) {
-		fread(comp_data, 0x1000, 1, fp);
+	if(file_size < (long)sizeof(pheader) || fread(&pheader, sizeof(pheader), 1, fp) != 1) {
 		fclose(fp);
-		replay_size = pheader.datasize;
-		if(LzmaUncompress(replay_data, &replay_size, comp_data, &comp_size, pheader.props, 5) != SZ_OK)
-			return false;
-	} else {
-		fread(replay_data, 0x20000, 1, fp);
+		return false;
+	}
+	comp_data.resize(file_size - sizeof(pheader));
+	if(comp_data.size() && fread(&comp_data[0], comp_data.size(), 1, fp) != 1) {
 		fclose(fp);
-		replay_size = comp_size;
+		return false;
 	}
-	pdata = replay_data;
+	fclose(fp);
+	replay_data.clear();
+	data_position = 0;
+	chunk_position = 0;
+	if((pheader.flag & REPLAY_CHUNKED) && pheader.version < REPLAY_CHUNKED_VERSION)
+		return false;
+	if(pheader.flag & REPLAY_CHUNKED) {
+		//only the first block is decoded here, the rest when the replay is played
+		if(!DecodeChunk())
+			return false;
+	} else if(pheader.flag & REPLAY_COMPRESSED) {
+		size_t replay_size = pheader.datasize;
+		size_t comp_size = comp_data.size();
+		replay_data.resize(replay_size);
+		if(!replay_size || LzmaUncompress(&replay_data[0], &replay_size, &comp_data[0], &comp_size, pheader.props, 5) != SZ_OK)
+			return false;
+		replay_data.resize(replay_size);
+	} else
+		replay_data = comp_data;
 	is_replaying = true;
 	return true;
 }
+bool Replay::DecodeChunk() {
+	if(!(pheader.flag & REPLAY_CHUNKED) || chunk_position + 8 > comp_data.size())
+		return false;
+	size_t raw_size = *((int*)&comp_data[chunk_position]);
+	size_t comp_size = *((int*)&comp_data[chunk_position + 4]);
+	if(chunk_position + 8 + comp_size > comp_data.size())
+		return false;
+	size_t data_start = replay_data.size();
+	replay_data.resize(data_start + raw_size);
+	if(!raw_size || LzmaUncompress(&replay_data[data_start], &raw_size, &comp_data[chunk_position + 8], &comp_size, pheader.props, 5) != SZ_OK) {
+		replay_data.resize(data_start);
+		return false;
+	}
+	replay_data.resize(data_start + raw_size);
+	chunk_position += 8 + *((int*)&comp_data[chunk_position + 4]);
+	return true;
+}
+bool Replay::IsReadable(size_t length) {
+	while(data_position + length > replay_data.size())
+		if(!DecodeChunk())
+			return false;
+	return true;
+}
 bool Replay::CheckReplay(const wchar_t* name) {
 	wchar_t fname[256];
 	myswprintf(fname, L"./replay/%ls", name);
@@ -187,39 +263,47 @@ bool Replay::CheckReplay(const wchar_t* name) {
 	return rheader.id == 0x31707279 && rheader.version >= 0x12d0;
 }
 bool Replay::ReadNextResponse(unsigned char resp[64]) {
-	if(pdata - replay_data >= (int)replay_size)
+	if(!IsReadable(1))
 		return false;
-	int len = *pdata++;
-	if(len > 64)
+	int len = replay_data[data_position];
+	if(len > 64 || !IsReadable(1 + len))
 		return false;
-	memcpy(resp, pdata, len);
-	pdata += len;
+	data_position++;
+	if(len)
+		memcpy(resp, &replay_data[data_position], len);
+	data_position += len;
 	return true;
 }
 void Replay::ReadData(void* data, unsigned int length) {
 	if(!is_replaying)
 		return;
-	memcpy(data, pdata, length);
-	pdata += length;
+	if(!IsReadable(length)) {
+		memset(data, 0, length);
+		data_position = replay_data.size();
+		return;
+	}
+	if(length)
+		memcpy(data, &replay_data[data_position], length);
+	data_position += length;
 }
 int Replay::ReadInt32() {
-	if(!is_replaying)
+	if(!is_replaying || !IsReadable(4))
 		return -1;
-	int ret = *((int*)pdata);
-	pdata += 4;
+	int ret = *((int*)&replay_data[data_position]);
+	data_position += 4;
 	return ret;
 }
 short Replay::ReadInt16() {
-	if(!is_replaying)
+	if(!is_replaying || !IsReadable(2))
 		return -1;
-	short ret = *((short*)pdata);
-	pdata += 4;
+	short ret = *((short*)&replay_data[data_position]);
+	data_position += 2;
 	return ret;
 }
 char Replay::ReadInt8() {
-	if(!is_replaying)
+	if(!is_replaying || !IsReadable(1))
 		return -1;
-	return *pdata++;
+	return replay_data[data_position++];
 }
 
 }
@@ -2,13 +2,26 @@
 #define REPLAY_H
 
 #include "config.h"
+#include "mysignal.h"
 #include <time.h>
+#include <vector>
 
 namespace ygo {
 
 #define REPLAY_COMPRESSED	0x1
 #define REPLAY_TAG			0x2
 #define REPLAY_DECODED		0x4
+#define REPLAY_CHUNKED		0x8
+
+//the data of a chunked replay is compressed in blocks of this size while it is recorded
+#define REPLAY_CHUNK_SIZE	0x2000
+//the dictionary of the blocks, a block is a little longer than REPLAY_CHUNK_SIZE at most
+#define REPLAY_CHUNK_DICT	(REPLAY_CHUNK_SIZE * 2)
+//the first version that writes chunked replays, the flag is not valid in older ones
+#define REPLAY_CHUNKED_VERSION	0x1333
+
+//called on the ReplayWriter thread once a replay ended by EndRecordAsync is closed
+typedef void (*ReplayCallback)(void* arg);
 
 struct ReplayHeader {
 	unsigned int id;
@@ -24,7 +37,7 @@ class Replay {
 public:
 	Replay();
 	~Replay();
-	void BeginRecord();
+	void BeginRecord(const wchar_t* name = L"_LastReplay");
 	void WriteHeader(ReplayHeader& header);
 	void WriteData(const void* data, unsigned int length, bool flush = true);
 	void WriteInt32(int data, bool flush = true);
@@ -32,6 +45,7 @@ public:
 	void WriteInt8(char data, bool flush = true);
 	void Flush();
 	void EndRecord();
+	void EndRecordAsync(ReplayCallback callback, void* arg);
 	void SaveReplay(const wchar_t* name);
 	bool OpenReplay(const wchar_t* name);
 	static bool CheckReplay(const wchar_t* name);
@@ -41,17 +55,29 @@ public:
 	int ReadInt32();
 	short ReadInt16();
 	char ReadInt8();
+	size_t GetReplayData(unsigned char* buf, size_t size);
+	size_t GetReplayPart(unsigned char* buf, size_t size, size_t& offset);
+	void WriteChunk(const std::vector<unsigned char>& data);
+	void CloseRecord();
 
+private:
+	bool DecodeChunk();
+	bool IsReadable(size_t length);
+
+public:
 	FILE* fp;
 	ReplayHeader pheader;
 #ifdef _WIN32
 	HANDLE recording_fp;
 #endif
-	unsigned char* replay_data;
-	unsigned char* comp_data;
-	unsigned char* pdata;
-	size_t replay_size;
-	size_t comp_size;
+	std::vector<unsigned char> replay_data; //the data not handed to the ReplayWriter yet when recording
+	std::vector<unsigned char> comp_data;
+	size_t data_position; //read position in replay_data
+	size_t chunk_position; //the next block to decode when replaying
+	int pending_jobs; //blocks waiting for the ReplayWriter
+	Signal jobs_done;
+	ReplayCallback end_callback; //guarded by the ReplayWriter like pending_jobs
+	void* end_arg;
 	bool is_recording;
 	bool is_replaying;
 };
@@ -16,6 +16,10 @@ bool ReplayMode::is_paused = false;
 bool ReplayMode::is_swaping = false;
 bool ReplayMode::exit_pending = false;
 int ReplayMode::skip_turn = 0;
+bool ReplayMode::is_seeking = false;
+int ReplayMode::seek_turn = 0;
+Mutex ReplayMode::seek_mutex;
+std::vector<ReplayKeyframe> ReplayMode::keyframes;
 wchar_t ReplayMode::event_string[256];
 
 bool ReplayMode::StartReplay(int skipturn) {
@@ -45,7 +49,110 @@ void ReplayMode::Pause(bool is_pause, bool is_step) {
 		mainGame->actionSignal.Set();
 	}
 }
+//called by the gui thread, the replay thread handles the seek at its next message or step
+void ReplayMode::Seek(int turn_offset) {
+	int turn = mainGame->dInfo.turn + turn_offset;
+	seek_mutex.Lock();
+	seek_turn = turn < 1 ? 1 : turn;
+	is_seeking = true;
+	seek_mutex.Unlock();
+	mainGame->actionSignal.Set();
+}
+/*
+ * Takes the pending seek of the replay thread, if any. With keep_restorable, a seek to a turn
+ * that has a keyframe stays pending for the replay loop, the messages before it are dropped.
+ * Returns the turn, 0 if there is no seek to handle now.
+ */
+int ReplayMode::TakeSeek(bool keep_restorable) {
+	seek_mutex.Lock();
+	int turn = is_seeking ? seek_turn : 0;
+	if(turn && keep_restorable && !keyframes.empty() && keyframes.back().turn >= turn)
+		turn = -1;
+	else
+		is_seeking = false;
+	seek_mutex.Unlock();
+	return turn;
+}
+void ReplayMode::SkipTurns(int count) {
+	if(count <= 0)
+		return;
+	skip_turn = count;
+	if(!mainGame->dInfo.isReplaySkiping) {
+		mainGame->dInfo.isReplaySkiping = true;
+		mainGame->gMutex.Lock();
+	}
+}
+/*
+ * Replaces the duel by the one saved at the last keyframe before the turn,
+ * and skips the remaining turns. The keyframes are saved while the replay
+ * is played, so this is only possible for turns that were reached before.
+ */
+bool ReplayMode::RestoreKeyframe(int turn) {
+	ReplayKeyframe* kf = 0;
+	for(auto kit = keyframes.begin(); kit != keyframes.end() && kit->turn <= turn; ++kit)
+		kf = &(*kit);
+	if(!kf)
+		return false;
+	long restored = load_duel_state(&kf->state[0], kf->state.size(), 0, 0, 0, 0);
+	if(!restored)
+		return false;
+	if(mainGame->dInfo.isReplaySkiping) {
+		mainGame->dInfo.isReplaySkiping = false;
+		mainGame->gMutex.Unlock();
+	}
+	skip_turn = 0;
+	end_duel(pduel);
+	pduel = restored;
+	cur_replay.data_position = kf->data_position;
+	mainGame->dInfo.turn = kf->turn;
+	mainGame->dInfo.tag_player[0] = kf->tag_player[0];
+	mainGame->dInfo.tag_player[1] = kf->tag_player[1];
+	myswprintf(mainGame->dInfo.strTurn, L"Turn:%d", mainGame->dInfo.turn);
+	ReloadField();
+	//the keyframe was saved when the duel waited for this response
+	if(!ReadReplayResponse())
+		return false;
+	SkipTurns(turn - kf->turn);
+	return true;
+}
+//rebuilds the client field from the engine after the duel was replaced
+void ReplayMode::ReloadField() {
+	unsigned char queryBuffer[0x1000];
+	bool swapped = !mainGame->dInfo.isFirst;
+	if(swapped) {
+		mainGame->gMutex.Lock();
+		mainGame->dField.ReplaySwap();
+		mainGame->gMutex.Unlock();
+	}
+	query_field_info(pduel, queryBuffer);
+	DuelClient::ClientAnalyze((char*)queryBuffer, sizeof(queryBuffer));
+	mainGame->gMutex.Lock();
+	ReplayRefresh();
+	for(int p = 0; p < 2; ++p) {
+		ReplayRefreshGrave(p);
+		ReplayRefreshDeck(p);
+		ReplayRefreshExtra(p);
+		query_field_card(pduel, p, LOCATION_REMOVED, 0x181fff, queryBuffer, 0);
+		mainGame->dField.UpdateFieldCard(mainGame->LocalPlayer(p), LOCATION_REMOVED, (char*)queryBuffer);
+	}
+	if(swapped)
+		mainGame->dField.ReplaySwap();
+	mainGame->dField.RefreshAllCards();
+	mainGame->gMutex.Unlock();
+}
 bool ReplayMode::ReadReplayResponse() {
+	//the duel cannot be saved while a script waits in a coroutine, the keyframe is taken at a later response of the turn then
+	int state_size = 0;
+	if((keyframes.empty() || keyframes.back().turn < mainGame->dInfo.turn) && (state_size = save_duel_state(pduel, 0, 0))) {
+		ReplayKeyframe kf;
+		kf.turn = mainGame->dInfo.turn;
+		kf.data_position = cur_replay.data_position;
+		kf.tag_player[0] = mainGame->dInfo.tag_player[0];
+		kf.tag_player[1] = mainGame->dInfo.tag_player[1];
+		kf.state.resize(state_size);
+		save_duel_state(pduel, &kf.state[0], kf.state.size());
+		keyframes.push_back(kf);
+	}
 	unsigned char resp[64];
 	bool result = cur_replay.ReadNextResponse(resp);
 	if(result)
@@ -71,6 +178,10 @@ int ReplayMode::ReplayThread(void* param) {
 	set_card_reader((card_reader)DataManager::CardReader);
 	set_message_handler((message_handler)MessageHandler);
 	pduel = create_duel(rnd.rand());
+	keyframes.clear();
+	seek_mutex.Lock();
+	is_seeking = false;
+	seek_mutex.Unlock();
 	int start_lp = cur_replay.ReadInt32();
 	int start_hand = cur_replay.ReadInt32();
 	int draw_count = cur_replay.ReadInt32();
@@ -133,7 +244,7 @@ int ReplayMode::ReplayThread(void* param) {
 	ReplayRefreshExtra(1);
 	mainGame->dInfo.isStarted = true;
 	mainGame->dInfo.isReplay = true;
-	char engineBuffer[0x1000];
+	std::vector<char> engineBuffer;
 	is_continuing = true;
 	exit_pending = false;
 	if(skip_turn < 0)
@@ -145,12 +256,16 @@ int ReplayMode::ReplayThread(void* param) {
 		mainGame->dInfo.isReplaySkiping = false;
 	int len = 0;
 	while (is_continuing && !exit_pending) {
+		int turn = TakeSeek(false);
+		if(turn && !RestoreKeyframe(turn))
+			SkipTurns(turn - mainGame->dInfo.turn);
 		int result = process(pduel);
 		len = result & 0xffff;
 		/*int flag = result >> 16;*/
 		if (len > 0) {
-			get_message(pduel, (byte*)engineBuffer);
-			is_continuing = ReplayAnalyze(engineBuffer, len);
+			engineBuffer.resize(get_message_length(pduel));
+			get_message(pduel, (byte*)&engineBuffer[0]);
+			is_continuing = ReplayAnalyze(&engineBuffer[0], engineBuffer.size());
 		}
 	}
 	if(mainGame->dInfo.isReplaySkiping) {
@@ -189,6 +304,12 @@ bool ReplayMode::ReplayAnalyze(char* msg, unsigned int len) {
 	while (pbuf - msg < (int)len) {
 		if(is_closing)
 			return false;
+		//a turn that was played before is restored from its keyframe, the rest of the messages is dropped
+		int turn = TakeSeek(true);
+		if(turn < 0)
+			return true;
+		if(turn)
+			SkipTurns(turn - mainGame->dInfo.turn);
 		if(is_swaping) {
 			mainGame->gMutex.Lock();
 			mainGame->dField.ReplaySwap();
@@ -660,7 +781,7 @@ bool ReplayMode::ReplayAnalyze(char* msg, unsigned int len) {
 			break;
 		}
 		}
-		if(pauseable && is_pausing) {
+		if(pauseable && is_pausing && !mainGame->dInfo.isReplaySkiping) {
 			is_paused = true;
 			mainGame->actionSignal.Reset();
 			mainGame->actionSignal.Wait();
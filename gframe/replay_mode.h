@@ -6,9 +6,18 @@
 #include "deck_manager.h"
 #include "replay.h"
 #include "../ocgcore/mtrandom.h"
+#include <vector>
 
 namespace ygo {
 
+//the duel at the first response of a turn it could be saved at
+struct ReplayKeyframe {
+	int turn;
+	size_t data_position;
+	bool tag_player[2];
+	std::vector<unsigned char> state;
+};
+
 class ReplayMode {
 private:
 	static long pduel;
@@ -19,6 +28,10 @@ private:
 	static bool is_swaping;
 	static bool exit_pending;
 	static int skip_turn;
+	static bool is_seeking; //set by the gui thread, guarded by seek_mutex
+	static int seek_turn;
+	static Mutex seek_mutex;
+	static std::vector<ReplayKeyframe> keyframes;
 	static wchar_t event_string[256];
 public:
 	static Replay cur_replay;
@@ -28,6 +41,11 @@ public:
 	static void StopReplay(bool is_exiting = false);
 	static void SwapField();
 	static void Pause(bool is_pause, bool is_step);
+	static void Seek(int turn_offset);
+	static int TakeSeek(bool keep_restorable);
+	static void SkipTurns(int count);
+	static bool RestoreKeyframe(int turn);
+	static void ReloadField();
 	static bool ReadReplayResponse();
 	static int ReplayThread(void* param);
 	static bool ReplayAnalyze(char* msg, unsigned int len);
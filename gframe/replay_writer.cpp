@@ -0,0 +1,102 @@
+#include "replay_writer.h"
+#include "mythread.h"
+
+namespace ygo {
+
+std::deque<ReplayJob> ReplayWriter::jobs;
+Mutex ReplayWriter::job_mutex;
+Signal ReplayWriter::job_signal;
+Signal ReplayWriter::space_signal;
+bool ReplayWriter::is_running = false;
+ReplayWriterStats ReplayWriter::stats;
+
+/*
+ * Hands the recorded data of a replay to the writer thread, data is left empty.
+ * The blocks of one replay are written in the order they are posted, callback is run after the last one.
+ */
+void ReplayWriter::PostChunk(Replay* replay, std::vector<unsigned char>& data, bool is_end, ReplayCallback callback, void* arg) {
+	job_mutex.Lock();
+	if(!is_running) {
+		is_running = true;
+		Thread::NewThread(WriterThread, 0);
+	}
+	if(jobs.size() >= REPLAY_QUEUE_SIZE) {
+		stats.full_waits++;
+		while(jobs.size() >= REPLAY_QUEUE_SIZE) {
+			job_mutex.Unlock();
+			space_signal.Wait();
+			job_mutex.Lock();
+		}
+	}
+	jobs.push_back(ReplayJob());
+	ReplayJob& job = jobs.back();
+	job.replay = replay;
+	job.data.swap(data);
+	job.is_end = is_end;
+	replay->pending_jobs++;
+	if(is_end) {
+		replay->end_callback = callback;
+		replay->end_arg = arg;
+	}
+	if(jobs.size() > stats.max_queued)
+		stats.max_queued = jobs.size();
+	job_mutex.Unlock();
+	job_signal.Set();
+}
+//waits until all the blocks of the replay are written, a callback not run yet is dropped
+void ReplayWriter::WaitReplay(Replay* replay) {
+	job_mutex.Lock();
+	replay->end_callback = 0;
+	while(replay->pending_jobs) {
+		job_mutex.Unlock();
+		replay->jobs_done.Wait();
+		job_mutex.Lock();
+	}
+	job_mutex.Unlock();
+}
+void ReplayWriter::GetStats(ReplayWriterStats& result) {
+	job_mutex.Lock();
+	result = stats;
+	result.queued = jobs.size();
+	job_mutex.Unlock();
+}
+int ReplayWriter::WriterThread(void* param) {
+	ReplayJob job;
+	while(true) {
+		job_mutex.Lock();
+		if(jobs.empty()) {
+			job_mutex.Unlock();
+			job_signal.Wait();
+			continue;
+		}
+		job.replay = jobs.front().replay;
+		job.data.swap(jobs.front().data);
+		job.is_end = jobs.front().is_end;
+		jobs.pop_front();
+		job_mutex.Unlock();
+		space_signal.Set();
+		Replay* replay = job.replay;
+		size_t comp_size = replay->comp_data.size();
+		replay->WriteChunk(job.data);
+		if(job.is_end)
+			replay->CloseRecord();
+		job_mutex.Lock();
+		stats.jobs++;
+		stats.raw_bytes += job.data.size();
+		stats.comp_bytes += replay->comp_data.size() - comp_size;
+		replay->pending_jobs--;
+		//run while locked so that WaitReplay either drops the callback or finds it done
+		if(job.is_end && replay->end_callback) {
+			ReplayCallback callback = replay->end_callback;
+			replay->end_callback = 0;
+			callback(replay->end_arg);
+		}
+		//set while locked, the replay may be gone as soon as WaitReplay sees no pending jobs
+		replay->jobs_done.Set();
+		job_mutex.Unlock();
+		job.data.clear();
+	}
+	return 0;
+}
+
+}
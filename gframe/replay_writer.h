@@ -0,0 +1,49 @@
+#ifndef REPLAY_WRITER_H
+#define REPLAY_WRITER_H
+
+#include "config.h"
+#include "mysignal.h"
+#include "replay.h"
+#include <vector>
+#include <deque>
+
+namespace ygo {
+
+//the most blocks waiting for the writer, recording rooms wait when it is reached
+#define REPLAY_QUEUE_SIZE	64
+
+struct ReplayJob {
+	Replay* replay;
+	std::vector<unsigned char> data;
+	bool is_end;
+};
+
+struct ReplayWriterStats {
+	unsigned int queued;
+	unsigned int max_queued;
+	unsigned long long jobs;
+	unsigned long long raw_bytes;
+	unsigned long long comp_bytes;
+	unsigned int full_waits; //times a room had to wait because the queue was full
+};
+
+//compresses replay blocks and writes them to disk on its own thread
+class ReplayWriter {
+private:
+	static std::deque<ReplayJob> jobs;
+	static Mutex job_mutex;
+	static Signal job_signal;
+	static Signal space_signal;
+	static bool is_running;
+	static ReplayWriterStats stats;
+
+public:
+	static void PostChunk(Replay* replay, std::vector<unsigned char>& data, bool is_end, ReplayCallback callback = 0, void* arg = 0);
+	static void WaitReplay(Replay* replay);
+	static void GetStats(ReplayWriterStats& result);
+	static int WriterThread(void* param);
+};
+
+}
+
+#endif //REPLAY_WRITER_H
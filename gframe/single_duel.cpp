@@ -18,6 +18,8 @@ SingleDuel::SingleDuel(bool is_match) {
 	}
 	duel_count = 0;
 	memset(match_result, 0, 3);
+	replay_pending = false;
+	end_action = END_ACTION_NONE;
 }
 SingleDuel::~SingleDuel() {
 }
@@ -67,7 +69,9 @@ void SingleDuel::JoinGame(DuelPlayer* dp, void* pdata, bool is_creater) {
 			return;
 		}
 	}
-	dp->game = this;
+	//with room workers the network thread has set it before posting the join
+	if(dp->game != this)
+		dp->game = this;
 	if(!players[0] && !players[1] && observers.size() == 0)
 		host_player = dp;
 	STOC_JoinGame scjg;
@@ -141,8 +145,7 @@ void SingleDuel::JoinGame(DuelPlayer* dp, void* pdata, bool is_creater) {
 }
 void SingleDuel::LeaveGame(DuelPlayer* dp) {
 	if(dp == host_player) {
-		EndDuel();
-		NetServer::StopServer();
+		FinishDuel(END_ACTION_STOP);
 	} else if(dp->type == NETPLAYER_TYPE_OBSERVER) {
 		observers.erase(dp);
 		if(!pduel) {
@@ -169,6 +172,9 @@ void SingleDuel::LeaveGame(DuelPlayer* dp) {
 			for(auto pit = observers.begin(); pit != observers.end(); ++pit)
 				NetServer::SendPacketToPlayer(*pit, STOC_HS_PLAYER_CHANGE, scpc);
 			NetServer::DisconnectPlayer(dp);
+		} else if(replay_pending) {
+			//the duel is over already, the room stops once its replay is sent
+			end_action = END_ACTION_LEAVE;
 		} else {
 			if(!pduel) {
 				if(!ready[0])
@@ -184,12 +190,7 @@ void SingleDuel::LeaveGame(DuelPlayer* dp) {
 			NetServer::ReSendToPlayer(players[1]);
 			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
 				NetServer::ReSendToPlayer(*oit);
-			EndDuel();
-			NetServer::SendPacketToPlayer(players[0], STOC_DUEL_END);
-			NetServer::ReSendToPlayer(players[1]);
-			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
-				NetServer::ReSendToPlayer(*oit);
-			NetServer::StopServer();
+			FinishDuel(END_ACTION_LEAVE);
 		}
 	}
 }
@@ -308,7 +309,7 @@ void SingleDuel::StartDuel(DuelPlayer* dp) {
 		return;
 	if(!ready[0] || !ready[1])
 		return;
-	NetServer::StopListen();
+	NetServer::LockRoom(this);
 	//NetServer::StopBroadcast();
 	NetServer::SendPacketToPlayer(players[0], STOC_DUEL_START);
 	NetServer::ReSendToPlayer(players[1]);
@@ -386,7 +387,9 @@ void SingleDuel::TPResult(DuelPlayer* dp, unsigned char tp) {
 	rh.flag = 0;
 	time_t seed = time(0);
 	rh.seed = seed;
-	last_replay.BeginRecord();
+	wchar_t replay_name[32];
+	myswprintf(replay_name, room_id ? L"_LastReplay_%u" : L"_LastReplay", room_id);
+	last_replay.BeginRecord(replay_name);
 	last_replay.WriteHeader(rh);
 	rnd.reset(seed);
 	last_replay.WriteData(players[0]->name, 40, false);
@@ -403,10 +406,9 @@ void SingleDuel::TPResult(DuelPlayer* dp, unsigned char tp) {
 	}
 	time_limit[0] = host_info.time_limit;
 	time_limit[1] = host_info.time_limit;
-	set_card_reader((card_reader)DataManager::CardReader);
-	set_message_handler((message_handler)SingleDuel::MessageHandler);
 	rnd.reset(seed);
-	pduel = create_duel(rnd.rand());
+	pduel = create_duel_ex(rnd.rand(), 0, (card_reader_ex)DataManager::DuelCardReader, (message_handler_ex)SingleDuel::MessageHandler, this);
+	set_message_sink(pduel, (message_sink)SingleDuel::MessageSink, this);
 	set_player_info(pduel, 0, host_info.start_lp, host_info.start_hand, host_info.draw_count);
 	set_player_info(pduel, 1, host_info.start_lp, host_info.start_hand, host_info.draw_count);
 	int opt = 0;
@@ -457,28 +459,25 @@ void SingleDuel::TPResult(DuelPlayer* dp, unsigned char tp) {
 	else startbuf[1] = 0x11;
 	for(auto oit = observers.begin(); oit != observers.end(); ++oit)
 		NetServer::SendBufferToPlayer(*oit, STOC_GAME_MSG, startbuf, 18);
+	field_mirror.Clear();
 	RefreshExtra(0);
 	RefreshExtra(1);
 	start_duel(pduel, opt);
 	Process();
 }
 void SingleDuel::Process() {
-	char engineBuffer[0x1000];
-	unsigned int engFlag = 0, engLen = 0;
-	int stop = 0;
-	while (!stop) {
+	unsigned int engFlag = 0;
+	engine_stop = 0;
+	NetServer::BeginBatch();
+	while (!engine_stop) {
 		if (engFlag == 2)
 			break;
-		int result = process(pduel);
-		engLen = result & 0xffff;
-		engFlag = result >> 16;
-		if (engLen > 0) {
-			get_message(pduel, (byte*)&engineBuffer);
-			stop = Analyze(engineBuffer, engLen);
-		}
+		engFlag = process(pduel) >> 16;
 	}
-	if(stop == 2)
-		DuelEndProc();
+	//the duel is not ended in MessageSink, the engine is still running there
+	if(engine_stop == 2)
+		FinishDuel(END_ACTION_PROC);
+	NetServer::EndBatch();
 }
 void SingleDuel::DuelEndProc() {
 	if(!match_mode) {
@@ -486,7 +485,7 @@ void SingleDuel::DuelEndProc() {
 		NetServer::ReSendToPlayer(players[1]);
 		for(auto oit = observers.begin(); oit != observers.end(); ++oit)
 			NetServer::ReSendToPlayer(*oit);
-		NetServer::StopServer();
+		NetServer::StopRoom(this);
 	} else {
 		int winc[3] = {0, 0, 0};
 		for(int i = 0; i < duel_count; ++i)
@@ -499,7 +498,7 @@ void SingleDuel::DuelEndProc() {
 			NetServer::ReSendToPlayer(players[1]);
 			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
 				NetServer::ReSendToPlayer(*oit);
-			NetServer::StopServer();
+			NetServer::StopRoom(this);
 		} else {
 			if(players[0] != pplayer[0]) {
 				players[0] = pplayer[0];
@@ -540,8 +539,7 @@ void SingleDuel::Surrender(DuelPlayer* dp) {
 		match_result[duel_count++] = player;
 		tp_player = 1 - player;
 	}
-	EndDuel();
-	DuelEndProc();
+	FinishDuel(END_ACTION_PROC);
 	event_del(etimer);
 }
 int SingleDuel::Analyze(char* msgbuffer, unsigned int len) {
@@ -605,7 +603,6 @@ int SingleDuel::Analyze(char* msgbuffer, unsigned int len) {
 				match_result[duel_count++] = 1 - player;
 				tp_player = player;
 			}
-			EndDuel();
 			return 2;
 		}
 		case MSG_SELECT_BATTLECMD: {
@@ -1305,20 +1302,60 @@ void SingleDuel::GetResponse(DuelPlayer* dp, void* pdata, unsigned int len) {
 	}
 	Process();
 }
+//ends the duel, ReplayEnded sends the replay once the ReplayWriter has closed it
 void SingleDuel::EndDuel() {
 	if(!pduel)
 		return;
-	last_replay.EndRecord();
-	char replaybuf[0x2000], *pbuf = replaybuf;
-	memcpy(pbuf, &last_replay.pheader, sizeof(ReplayHeader));
-	pbuf += sizeof(ReplayHeader);
-	memcpy(pbuf, last_replay.comp_data, last_replay.comp_size);
-	NetServer::SendBufferToPlayer(players[0], STOC_REPLAY, replaybuf, sizeof(ReplayHeader) + last_replay.comp_size);
+	end_duel(pduel);
+	pduel = 0;
+	replay_pending = true;
+	last_replay.EndRecordAsync(NetServer::ReplayWritten, this);
+}
+void SingleDuel::ReplayEnded() {
+	replay_pending = false;
+	SendReplay();
+	RunEndAction();
+}
+//ends the duel and runs action after its replay is sent, at once if no duel is running
+void SingleDuel::FinishDuel(unsigned char action) {
+	end_action = action;
+	EndDuel();
+	if(!replay_pending)
+		RunEndAction();
+}
+void SingleDuel::SendReplay() {
+	unsigned char replaybuf[0x2000 - 3];
+	size_t offset = 0, part_len;
+	while((part_len = last_replay.GetReplayPart(replaybuf, sizeof(replaybuf), offset))) {
+		NetServer::SendBufferToPlayer(players[0], STOC_REPLAY_DATA, replaybuf, part_len);
+		NetServer::ReSendToPlayer(players[1]);
+		for(auto oit = observers.begin(); oit != observers.end(); ++oit)
+			NetServer::ReSendToPlayer(*oit);
+	}
+	size_t replay_len = last_replay.GetReplayData(replaybuf, sizeof(replaybuf));
+	NetServer::SendBufferToPlayer(players[0], STOC_REPLAY, replaybuf, replay_len);
 	NetServer::ReSendToPlayer(players[1]);
 	for(auto oit = observers.begin(); oit != observers.end(); ++oit)
 		NetServer::ReSendToPlayer(*oit);
-	end_duel(pduel);
-	pduel = 0;
+}
+void SingleDuel::RunEndAction() {
+	unsigned char action = end_action;
+	end_action = END_ACTION_NONE;
+	switch(action) {
+	case END_ACTION_STOP:
+		NetServer::StopRoom(this);
+		break;
+	case END_ACTION_LEAVE:
+		NetServer::SendPacketToPlayer(players[0], STOC_DUEL_END);
+		NetServer::ReSendToPlayer(players[1]);
+		for(auto oit = observers.begin(); oit != observers.end(); ++oit)
+			NetServer::ReSendToPlayer(*oit);
+		NetServer::StopRoom(this);
+		break;
+	case END_ACTION_PROC:
+		DuelEndProc();
+		break;
+	}
 }
 void SingleDuel::WaitforResponse(int playerid) {
 	last_response = playerid;
@@ -1351,7 +1388,12 @@ void SingleDuel::RefreshMzone(int player, int flag, int use_cache) {
 	BufferIO::WriteInt8(qbuf, player);
 	BufferIO::WriteInt8(qbuf, LOCATION_MZONE);
 	int len = query_field_card(pduel, player, LOCATION_MZONE, flag, (unsigned char*)qbuf, use_cache);
-	NetServer::SendBufferToPlayer(players[player], STOC_GAME_MSG, query_buffer, len + 3);
+	if(!use_cache)
+		field_mirror.ClearLocation(player, LOCATION_MZONE);
+	char delta_buffer[0x1000];
+	int dlen = field_mirror.Update(pduel, FIELD_VIEW_OWNER, query_buffer, len + 3, delta_buffer);
+	if(dlen)
+		NetServer::SendBufferToPlayer(players[player], STOC_GAME_MSG, delta_buffer, dlen);
 	for (int i = 0; i < 5; ++i) {
 		int clen = BufferIO::ReadInt32(qbuf);
 		if (clen == 4)
@@ -1360,7 +1402,10 @@ void SingleDuel::RefreshMzone(int player, int flag, int use_cache) {
 			memset(qbuf, 0, clen - 4);
 		qbuf += clen - 4;
 	}
-	NetServer::SendBufferToPlayer(players[1 - player], STOC_GAME_MSG, query_buffer, len + 3);
+	dlen = field_mirror.Update(pduel, FIELD_VIEW_PUBLIC, query_buffer, len + 3, delta_buffer);
+	if(!dlen)
+		return;
+	NetServer::SendBufferToPlayer(players[1 - player], STOC_GAME_MSG, delta_buffer, dlen);
 	for(auto pit = observers.begin(); pit != observers.end(); ++pit)
 		NetServer::ReSendToPlayer(*pit);
 }
@@ -1371,7 +1416,12 @@ void SingleDuel::RefreshSzone(int player, int flag, int use_cache) {
 	BufferIO::WriteInt8(qbuf, player);
 	BufferIO::WriteInt8(qbuf, LOCATION_SZONE);
 	int len = query_field_card(pduel, player, LOCATION_SZONE, flag, (unsigned char*)qbuf, use_cache);
-	NetServer::SendBufferToPlayer(players[player], STOC_GAME_MSG, query_buffer, len + 3);
+	if(!use_cache)
+		field_mirror.ClearLocation(player, LOCATION_SZONE);
+	char delta_buffer[0x1000];
+	int dlen = field_mirror.Update(pduel, FIELD_VIEW_OWNER, query_buffer, len + 3, delta_buffer);
+	if(dlen)
+		NetServer::SendBufferToPlayer(players[player], STOC_GAME_MSG, delta_buffer, dlen);
 	for (int i = 0; i < 8; ++i) {
 		int clen = BufferIO::ReadInt32(qbuf);
 		if (clen == 4)
@@ -1380,7 +1430,10 @@ void SingleDuel::RefreshSzone(int player, int flag, int use_cache) {
 			memset(qbuf, 0, clen - 4);
 		qbuf += clen - 4;
 	}
-	NetServer::SendBufferToPlayer(players[1 - player], STOC_GAME_MSG, query_buffer, len + 3);
+	dlen = field_mirror.Update(pduel, FIELD_VIEW_PUBLIC, query_buffer, len + 3, delta_buffer);
+	if(!dlen)
+		return;
+	NetServer::SendBufferToPlayer(players[1 - player], STOC_GAME_MSG, delta_buffer, dlen);
 	for(auto pit = observers.begin(); pit != observers.end(); ++pit)
 		NetServer::ReSendToPlayer(*pit);
 }
@@ -1391,7 +1444,12 @@ void SingleDuel::RefreshHand(int player, int flag, int use_cache) {
 	BufferIO::WriteInt8(qbuf, player);
 	BufferIO::WriteInt8(qbuf, LOCATION_HAND);
 	int len = query_field_card(pduel, player, LOCATION_HAND, flag | QUERY_IS_PUBLIC, (unsigned char*)qbuf, use_cache);
-	NetServer::SendBufferToPlayer(players[player], STOC_GAME_MSG, query_buffer, len + 3);
+	if(!use_cache)
+		field_mirror.ClearLocation(player, LOCATION_HAND);
+	char delta_buffer[0x1000];
+	int dlen = field_mirror.Update(pduel, FIELD_VIEW_OWNER, query_buffer, len + 3, delta_buffer);
+	if(dlen)
+		NetServer::SendBufferToPlayer(players[player], STOC_GAME_MSG, delta_buffer, dlen);
 	int qlen = 0, slen;
 	while(qlen < len) {
 		slen = BufferIO::ReadInt32(qbuf);
@@ -1406,7 +1464,10 @@ void SingleDuel::RefreshHand(int player, int flag, int use_cache) {
 		qbuf += slen - 4;
 		qlen += slen;
 	}
-	NetServer::SendBufferToPlayer(players[1 - player], STOC_GAME_MSG, query_buffer, len + 3);
+	dlen = field_mirror.Update(pduel, FIELD_VIEW_PUBLIC, query_buffer, len + 3, delta_buffer);
+	if(!dlen)
+		return;
+	NetServer::SendBufferToPlayer(players[1 - player], STOC_GAME_MSG, delta_buffer, dlen);
 	for(auto pit = observers.begin(); pit != observers.end(); ++pit)
 		NetServer::ReSendToPlayer(*pit);
 }
@@ -1417,7 +1478,14 @@ void SingleDuel::RefreshGrave(int player, int flag, int use_cache) {
 	BufferIO::WriteInt8(qbuf, player);
 	BufferIO::WriteInt8(qbuf, LOCATION_GRAVE);
 	int len = query_field_card(pduel, player, LOCATION_GRAVE, flag, (unsigned char*)qbuf, use_cache);
-	NetServer::SendBufferToPlayer(players[0], STOC_GAME_MSG, query_buffer, len + 3);
+	if(!use_cache)
+		field_mirror.ClearLocation(player, LOCATION_GRAVE);
+	//everyone sees the same graveyard
+	char delta_buffer[0x1000];
+	int dlen = field_mirror.Update(pduel, FIELD_VIEW_PUBLIC, query_buffer, len + 3, delta_buffer);
+	if(!dlen)
+		return;
+	NetServer::SendBufferToPlayer(players[0], STOC_GAME_MSG, delta_buffer, dlen);
 	NetServer::ReSendToPlayer(players[1]);
 	for(auto pit = observers.begin(); pit != observers.end(); ++pit)
 		NetServer::ReSendToPlayer(*pit);
@@ -1429,7 +1497,12 @@ void SingleDuel::RefreshExtra(int player, int flag, int use_cache) {
 	BufferIO::WriteInt8(qbuf, player);
 	BufferIO::WriteInt8(qbuf, LOCATION_EXTRA);
 	int len = query_field_card(pduel, player, LOCATION_EXTRA, flag, (unsigned char*)qbuf, use_cache);
-	NetServer::SendBufferToPlayer(players[player], STOC_GAME_MSG, query_buffer, len + 3);
+	if(!use_cache)
+		field_mirror.ClearLocation(player, LOCATION_EXTRA);
+	char delta_buffer[0x1000];
+	int dlen = field_mirror.Update(pduel, FIELD_VIEW_OWNER, query_buffer, len + 3, delta_buffer);
+	if(dlen)
+		NetServer::SendBufferToPlayer(players[player], STOC_GAME_MSG, delta_buffer, dlen);
 }
 void SingleDuel::RefreshSingle(int player, int location, int sequence, int flag) {
 	char query_buffer[0x1000];
@@ -1439,6 +1512,7 @@ void SingleDuel::RefreshSingle(int player, int location, int sequence, int flag)
 	BufferIO::WriteInt8(qbuf, location);
 	BufferIO::WriteInt8(qbuf, sequence);
 	int len = query_card(pduel, player, location, sequence, flag, (unsigned char*)qbuf, 0);
+	field_mirror.ClearCard(player, location, sequence);
 	NetServer::SendBufferToPlayer(players[player], STOC_GAME_MSG, query_buffer, len + 4);
 	if(location == LOCATION_REMOVED && (qbuf[15] & POS_FACEDOWN))
 		return;
@@ -1448,7 +1522,13 @@ void SingleDuel::RefreshSingle(int player, int location, int sequence, int flag)
 			NetServer::ReSendToPlayer(*pit);
 	}
 }
-int SingleDuel::MessageHandler(long fduel, int type) {
+//called by the engine with the messages of every processor step
+int SingleDuel::MessageSink(void* payload, unsigned char* msg, unsigned int len) {
+	SingleDuel* sd = static_cast<SingleDuel*>(payload);
+	sd->engine_stop = sd->Analyze((char*)msg, len);
+	return sd->engine_stop;
+}
+int SingleDuel::MessageHandler(void* payload, long fduel, int type) {
 	if(!enable_log)
 		return 0;
 	char msgbuf[1024];
@@ -1486,8 +1566,7 @@ void SingleDuel::SingleTimer(evutil_socket_t fd, short events, void* arg) {
 			sd->match_result[sd->duel_count++] = player;
 			sd->tp_player = 1 - player;
 		}
-		sd->EndDuel();
-		sd->DuelEndProc();
+		sd->FinishDuel(END_ACTION_PROC);
 		event_del(sd->etimer);
 	}
 }
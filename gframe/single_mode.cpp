@@ -75,7 +75,7 @@ int SingleMode::SinglePlayThread(void* param) {
 	mainGame->device->setEventReceiver(&mainGame->dField);
 	mainGame->gMutex.Unlock();
 	start_duel(pduel, 0);
-	char engineBuffer[0x1000];
+	std::vector<char> engineBuffer;
 	is_closing = false;
 	is_continuing = true;
 	int len = 0;
@@ -84,8 +84,9 @@ int SingleMode::SinglePlayThread(void* param) {
 		len = result & 0xffff;
 		/* int flag = result >> 16; */
 		if (len > 0) {
-			get_message(pduel, (byte*)engineBuffer);
-			is_continuing = SinglePlayAnalyze(engineBuffer, len);
+			engineBuffer.resize(get_message_length(pduel));
+			get_message(pduel, (byte*)&engineBuffer[0]);
+			is_continuing = SinglePlayAnalyze(&engineBuffer[0], engineBuffer.size());
 		}
 	}
 	end_duel(pduel);
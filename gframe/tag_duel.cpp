@@ -14,6 +14,8 @@ TagDuel::TagDuel() {
 		players[i] = 0;
 		ready[i] = false;
 	}
+	replay_pending = false;
+	end_action = END_ACTION_NONE;
 }
 TagDuel::~TagDuel() {
 }
@@ -55,7 +57,9 @@ void TagDuel::JoinGame(DuelPlayer* dp, void* pdata, bool is_creater) {
 			return;
 		}
 	}
-	dp->game = this;
+	//with room workers the network thread has set it before posting the join
+	if(dp->game != this)
+		dp->game = this;
 	if(!players[0] && !players[1] && !players[2] && !players[3] && observers.size() == 0)
 		host_player = dp;
 	STOC_JoinGame scjg;
@@ -115,8 +119,7 @@ void TagDuel::JoinGame(DuelPlayer* dp, void* pdata, bool is_creater) {
 }
 void TagDuel::LeaveGame(DuelPlayer* dp) {
 	if(dp == host_player) {
-		EndDuel();
-		NetServer::StopServer();
+		FinishDuel(END_ACTION_STOP);
 	} else if(dp->type == NETPLAYER_TYPE_OBSERVER) {
 		observers.erase(dp);
 		if(!pduel) {
@@ -130,7 +133,7 @@ void TagDuel::LeaveGame(DuelPlayer* dp) {
 		}
 		NetServer::DisconnectPlayer(dp);
 	} else {
-		if(!pduel) {
+		if(!pduel && !replay_pending) {
 			STOC_HS_PlayerChange scpc;
 			players[dp->type] = 0;
 			ready[dp->type] = false;
@@ -142,8 +145,7 @@ void TagDuel::LeaveGame(DuelPlayer* dp) {
 				NetServer::SendPacketToPlayer(*pit, STOC_HS_PLAYER_CHANGE, scpc);
 			NetServer::DisconnectPlayer(dp);
 		} else {
-			EndDuel();
-			DuelEndProc();
+			FinishDuel(END_ACTION_PROC);
 		}
 	}
 }
@@ -262,7 +264,7 @@ void TagDuel::StartDuel(DuelPlayer* dp) {
 		return;
 	if(!ready[0] || !ready[1] || !ready[2] || !ready[3])
 		return;
-	NetServer::StopListen();
+	NetServer::LockRoom(this);
 	//NetServer::StopBroadcast();
 	for(int i = 0; i < 4; ++i)
 		NetServer::SendPacketToPlayer(players[i], STOC_DUEL_START);
@@ -346,7 +348,9 @@ void TagDuel::TPResult(DuelPlayer* dp, unsigned char tp) {
 	rh.flag = REPLAY_TAG;
 	time_t seed = time(0);
 	rh.seed = seed;
-	last_replay.BeginRecord();
+	wchar_t replay_name[32];
+	myswprintf(replay_name, room_id ? L"_LastReplay_%u" : L"_LastReplay", room_id);
+	last_replay.BeginRecord(replay_name);
 	last_replay.WriteHeader(rh);
 	rnd.reset(seed);
 	last_replay.WriteData(players[0]->name, 40, false);
@@ -373,10 +377,9 @@ void TagDuel::TPResult(DuelPlayer* dp, unsigned char tp) {
 	}
 	time_limit[0] = host_info.time_limit;
 	time_limit[1] = host_info.time_limit;
-	set_card_reader((card_reader)DataManager::CardReader);
-	set_message_handler((message_handler)TagDuel::MessageHandler);
 	rnd.reset(seed);
-	pduel = create_duel(rnd.rand());
+	pduel = create_duel_ex(rnd.rand(), 0, (card_reader_ex)DataManager::DuelCardReader, (message_handler_ex)TagDuel::MessageHandler, this);
+	set_message_sink(pduel, (message_sink)TagDuel::MessageSink, this);
 	set_player_info(pduel, 0, host_info.start_lp, host_info.start_hand, host_info.draw_count);
 	set_player_info(pduel, 1, host_info.start_lp, host_info.start_hand, host_info.draw_count);
 	int opt = 0;
@@ -454,28 +457,25 @@ void TagDuel::TPResult(DuelPlayer* dp, unsigned char tp) {
 	else startbuf[1] = 0x11;
 	for(auto oit = observers.begin(); oit != observers.end(); ++oit)
 		NetServer::SendBufferToPlayer(*oit, STOC_GAME_MSG, startbuf, 18);
+	field_mirror.Clear();
 	RefreshExtra(0);
 	RefreshExtra(1);
 	start_duel(pduel, opt);
 	Process();
 }
 void TagDuel::Process() {
-	char engineBuffer[0x1000];
-	unsigned int engFlag = 0, engLen = 0;
-	int stop = 0;
-	while (!stop) {
+	unsigned int engFlag = 0;
+	engine_stop = 0;
+	NetServer::BeginBatch();
+	while (!engine_stop) {
 		if (engFlag == 2)
 			break;
-		int result = process(pduel);
-		engLen = result & 0xffff;
-		engFlag = result >> 16;
-		if (engLen > 0) {
-			get_message(pduel, (byte*)&engineBuffer);
-			stop = Analyze(engineBuffer, engLen);
-		}
+		engFlag = process(pduel) >> 16;
 	}
-	if(stop == 2)
-		DuelEndProc();
+	//the duel is not ended in MessageSink, the engine is still running there
+	if(engine_stop == 2)
+		FinishDuel(END_ACTION_PROC);
+	NetServer::EndBatch();
 }
 void TagDuel::DuelEndProc() {
 	NetServer::SendPacketToPlayer(players[0], STOC_DUEL_END);
@@ -484,7 +484,7 @@ void TagDuel::DuelEndProc() {
 	NetServer::ReSendToPlayer(players[3]);
 	for(auto oit = observers.begin(); oit != observers.end(); ++oit)
 		NetServer::ReSendToPlayer(*oit);
-	NetServer::StopServer();
+	NetServer::StopRoom(this);
 }
 void TagDuel::Surrender(DuelPlayer* dp) {
 	return;
@@ -538,7 +538,6 @@ int TagDuel::Analyze(char* msgbuffer, unsigned int len) {
 			NetServer::ReSendToPlayer(players[3]);
 			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
 				NetServer::ReSendToPlayer(*oit);
-			EndDuel();
 			return 2;
 		}
 		case MSG_SELECT_BATTLECMD: {
@@ -1335,7 +1334,8 @@ int TagDuel::Analyze(char* msgbuffer, unsigned int len) {
 					NetServer::SendBufferToPlayer(players[i], STOC_GAME_MSG, offset, pbuf - offset);
 			for(auto oit = observers.begin(); oit != observers.end(); ++oit)
 				NetServer::ReSendToPlayer(*oit);
-			RefreshExtra(player);
+			//the extra deck now belongs to the other player of the team
+			RefreshExtra(player, 0x81fff, 0);
 			RefreshMzone(0, 0x81fff, 0);
 			RefreshMzone(1, 0x81fff, 0);
 			RefreshSzone(0, 0x681fff, 0);
@@ -1368,22 +1368,58 @@ void TagDuel::GetResponse(DuelPlayer* dp, void* pdata, unsigned int len) {
 	}
 	Process();
 }
+//ends the duel, ReplayEnded sends the replay once the ReplayWriter has closed it
 void TagDuel::EndDuel() {
 	if(!pduel)
 		return;
-	last_replay.EndRecord();
-	char replaybuf[0x2000], *pbuf = replaybuf;
-	memcpy(pbuf, &last_replay.pheader, sizeof(ReplayHeader));
-	pbuf += sizeof(ReplayHeader);
-	memcpy(pbuf, last_replay.comp_data, last_replay.comp_size);
-	NetServer::SendBufferToPlayer(players[0], STOC_REPLAY, replaybuf, sizeof(ReplayHeader) + last_replay.comp_size);
+	end_duel(pduel);
+	pduel = 0;
+	replay_pending = true;
+	last_replay.EndRecordAsync(NetServer::ReplayWritten, this);
+}
+void TagDuel::ReplayEnded() {
+	replay_pending = false;
+	SendReplay();
+	RunEndAction();
+}
+//ends the duel and runs action after its replay is sent, at once if no duel is running
+void TagDuel::FinishDuel(unsigned char action) {
+	end_action = action;
+	EndDuel();
+	if(!replay_pending)
+		RunEndAction();
+}
+void TagDuel::SendReplay() {
+	unsigned char replaybuf[0x2000 - 3];
+	size_t offset = 0, part_len;
+	while((part_len = last_replay.GetReplayPart(replaybuf, sizeof(replaybuf), offset))) {
+		NetServer::SendBufferToPlayer(players[0], STOC_REPLAY_DATA, replaybuf, part_len);
+		NetServer::ReSendToPlayer(players[1]);
+		NetServer::ReSendToPlayer(players[2]);
+		NetServer::ReSendToPlayer(players[3]);
+		for(auto oit = observers.begin(); oit != observers.end(); ++oit)
+			NetServer::ReSendToPlayer(*oit);
+	}
+	size_t replay_len = last_replay.GetReplayData(replaybuf, sizeof(replaybuf));
+	NetServer::SendBufferToPlayer(players[0], STOC_REPLAY, replaybuf, replay_len);
 	NetServer::ReSendToPlayer(players[1]);
 	NetServer::ReSendToPlayer(players[2]);
 	NetServer::ReSendToPlayer(players[3]);
 	for(auto oit = observers.begin(); oit != observers.end(); ++oit)
 		NetServer::ReSendToPlayer(*oit);
-	end_duel(pduel);
-	pduel = 0;
+}
+void TagDuel::RunEndAction() {
+	unsigned char action = end_action;
+	end_action = END_ACTION_NONE;
+	switch(action) {
+	case END_ACTION_STOP:
+		NetServer::StopRoom(this);
+		break;
+	case END_ACTION_LEAVE:
+	case END_ACTION_PROC:
+		DuelEndProc();
+		break;
+	}
 }
 void TagDuel::WaitforResponse(int playerid) {
 	last_response = playerid;
@@ -1420,9 +1456,15 @@ void TagDuel::RefreshMzone(int player, int flag, int use_cache) {
 	BufferIO::WriteInt8(qbuf, player);
 	BufferIO::WriteInt8(qbuf, LOCATION_MZONE);
 	int len = query_field_card(pduel, player, LOCATION_MZONE, flag, (unsigned char*)qbuf, use_cache);
+	if(!use_cache)
+		field_mirror.ClearLocation(player, LOCATION_MZONE);
+	char delta_buffer[0x1000];
+	int dlen = field_mirror.Update(pduel, FIELD_VIEW_OWNER, query_buffer, len + 3, delta_buffer);
 	int pid = (player == 0) ? 0 : 2;
-	NetServer::SendBufferToPlayer(players[pid], STOC_GAME_MSG, query_buffer, len + 3);
-	NetServer::ReSendToPlayer(players[pid + 1]);
+	if(dlen) {
+		NetServer::SendBufferToPlayer(players[pid], STOC_GAME_MSG, delta_buffer, dlen);
+		NetServer::ReSendToPlayer(players[pid + 1]);
+	}
 	for (int i = 0; i < 5; ++i) {
 		int clen = BufferIO::ReadInt32(qbuf);
 		if (clen == 4)
@@ -1431,8 +1473,11 @@ void TagDuel::RefreshMzone(int player, int flag, int use_cache) {
 			memset(qbuf, 0, clen - 4);
 		qbuf += clen - 4;
 	}
+	dlen = field_mirror.Update(pduel, FIELD_VIEW_PUBLIC, query_buffer, len + 3, delta_buffer);
+	if(!dlen)
+		return;
 	pid = 2 - pid;
-	NetServer::SendBufferToPlayer(players[pid], STOC_GAME_MSG, query_buffer, len + 3);
+	NetServer::SendBufferToPlayer(players[pid], STOC_GAME_MSG, delta_buffer, dlen);
 	NetServer::ReSendToPlayer(players[pid + 1]);
 	for(auto pit = observers.begin(); pit != observers.end(); ++pit)
 		NetServer::ReSendToPlayer(*pit);
@@ -1444,9 +1489,15 @@ void TagDuel::RefreshSzone(int player, int flag, int use_cache) {
 	BufferIO::WriteInt8(qbuf, player);
 	BufferIO::WriteInt8(qbuf, LOCATION_SZONE);
 	int len = query_field_card(pduel, player, LOCATION_SZONE, flag, (unsigned char*)qbuf, use_cache);
+	if(!use_cache)
+		field_mirror.ClearLocation(player, LOCATION_SZONE);
+	char delta_buffer[0x1000];
+	int dlen = field_mirror.Update(pduel, FIELD_VIEW_OWNER, query_buffer, len + 3, delta_buffer);
 	int pid = (player == 0) ? 0 : 2;
-	NetServer::SendBufferToPlayer(players[pid], STOC_GAME_MSG, query_buffer, len + 3);
-	NetServer::ReSendToPlayer(players[pid + 1]);
+	if(dlen) {
+		NetServer::SendBufferToPlayer(players[pid], STOC_GAME_MSG, delta_buffer, dlen);
+		NetServer::ReSendToPlayer(players[pid + 1]);
+	}
 	for (int i = 0; i < 8; ++i) {
 		int clen = BufferIO::ReadInt32(qbuf);
 		if (clen == 4)
@@ -1455,8 +1506,11 @@ void TagDuel::RefreshSzone(int player, int flag, int use_cache) {
 			memset(qbuf, 0, clen - 4);
 		qbuf += clen - 4;
 	}
+	dlen = field_mirror.Update(pduel, FIELD_VIEW_PUBLIC, query_buffer, len + 3, delta_buffer);
+	if(!dlen)
+		return;
 	pid = 2 - pid;
-	NetServer::SendBufferToPlayer(players[pid], STOC_GAME_MSG, query_buffer, len + 3);
+	NetServer::SendBufferToPlayer(players[pid], STOC_GAME_MSG, delta_buffer, dlen);
 	NetServer::ReSendToPlayer(players[pid + 1]);
 	for(auto pit = observers.begin(); pit != observers.end(); ++pit)
 		NetServer::ReSendToPlayer(*pit);
@@ -1468,7 +1522,12 @@ void TagDuel::RefreshHand(int player, int flag, int use_cache) {
 	BufferIO::WriteInt8(qbuf, player);
 	BufferIO::WriteInt8(qbuf, LOCATION_HAND);
 	int len = query_field_card(pduel, player, LOCATION_HAND, flag | QUERY_IS_PUBLIC, (unsigned char*)qbuf, use_cache);
-	NetServer::SendBufferToPlayer(cur_player[player], STOC_GAME_MSG, query_buffer, len + 3);
+	if(!use_cache)
+		field_mirror.ClearLocation(player, LOCATION_HAND);
+	char delta_buffer[0x1000];
+	int dlen = field_mirror.Update(pduel, FIELD_VIEW_OWNER, query_buffer, len + 3, delta_buffer);
+	if(dlen)
+		NetServer::SendBufferToPlayer(cur_player[player], STOC_GAME_MSG, delta_buffer, dlen);
 	int qlen = 0, slen;
 	while(qlen < len) {
 		slen = BufferIO::ReadInt32(qbuf);
@@ -1483,9 +1542,12 @@ void TagDuel::RefreshHand(int player, int flag, int use_cache) {
 		qbuf += slen - 4;
 		qlen += slen;
 	}
+	dlen = field_mirror.Update(pduel, FIELD_VIEW_PUBLIC, query_buffer, len + 3, delta_buffer);
+	if(!dlen)
+		return;
 	for(int i = 0; i < 4; ++i)
 		if(players[i] != cur_player[player])
-			NetServer::SendBufferToPlayer(players[i], STOC_GAME_MSG, query_buffer, len + 3);
+			NetServer::SendBufferToPlayer(players[i], STOC_GAME_MSG, delta_buffer, dlen);
 	for(auto pit = observers.begin(); pit != observers.end(); ++pit)
 		NetServer::ReSendToPlayer(*pit);
 }
@@ -1496,7 +1558,14 @@ void TagDuel::RefreshGrave(int player, int flag, int use_cache) {
 	BufferIO::WriteInt8(qbuf, player);
 	BufferIO::WriteInt8(qbuf, LOCATION_GRAVE);
 	int len = query_field_card(pduel, player, LOCATION_GRAVE, flag, (unsigned char*)qbuf, use_cache);
-	NetServer::SendBufferToPlayer(players[0], STOC_GAME_MSG, query_buffer, len + 3);
+	if(!use_cache)
+		field_mirror.ClearLocation(player, LOCATION_GRAVE);
+	//everyone sees the same graveyard
+	char delta_buffer[0x1000];
+	int dlen = field_mirror.Update(pduel, FIELD_VIEW_PUBLIC, query_buffer, len + 3, delta_buffer);
+	if(!dlen)
+		return;
+	NetServer::SendBufferToPlayer(players[0], STOC_GAME_MSG, delta_buffer, dlen);
 	NetServer::ReSendToPlayer(players[1]);
 	NetServer::ReSendToPlayer(players[2]);
 	NetServer::ReSendToPlayer(players[3]);
@@ -1510,7 +1579,12 @@ void TagDuel::RefreshExtra(int player, int flag, int use_cache) {
 	BufferIO::WriteInt8(qbuf, player);
 	BufferIO::WriteInt8(qbuf, LOCATION_EXTRA);
 	int len = query_field_card(pduel, player, LOCATION_EXTRA, flag, (unsigned char*)qbuf, use_cache);
-	NetServer::SendBufferToPlayer(cur_player[player], STOC_GAME_MSG, query_buffer, len + 3);
+	if(!use_cache)
+		field_mirror.ClearLocation(player, LOCATION_EXTRA);
+	char delta_buffer[0x1000];
+	int dlen = field_mirror.Update(pduel, FIELD_VIEW_OWNER, query_buffer, len + 3, delta_buffer);
+	if(dlen)
+		NetServer::SendBufferToPlayer(cur_player[player], STOC_GAME_MSG, delta_buffer, dlen);
 }
 void TagDuel::RefreshSingle(int player, int location, int sequence, int flag) {
 	char query_buffer[0x1000];
@@ -1520,6 +1594,7 @@ void TagDuel::RefreshSingle(int player, int location, int sequence, int flag) {
 	BufferIO::WriteInt8(qbuf, location);
 	BufferIO::WriteInt8(qbuf, sequence);
 	int len = query_card(pduel, player, location, sequence, flag, (unsigned char*)qbuf, 0);
+	field_mirror.ClearCard(player, location, sequence);
 	if(location & LOCATION_ONFIELD) {
 		int pid = (player == 0) ? 0 : 2;
 		NetServer::SendBufferToPlayer(players[pid], STOC_GAME_MSG, query_buffer, len + 4);
@@ -1546,7 +1621,13 @@ void TagDuel::RefreshSingle(int player, int location, int sequence, int flag) {
 		}
 	}
 }
-int TagDuel::MessageHandler(long fduel, int type) {
+//called by the engine with the messages of every processor step
+int TagDuel::MessageSink(void* payload, unsigned char* msg, unsigned int len) {
+	TagDuel* sd = static_cast<TagDuel*>(payload);
+	sd->engine_stop = sd->Analyze((char*)msg, len);
+	return sd->engine_stop;
+}
+int TagDuel::MessageHandler(void* payload, long fduel, int type) {
 	if(!enable_log)
 		return 0;
 	char msgbuf[1024];
@@ -1577,8 +1658,7 @@ void TagDuel::TagTimer(evutil_socket_t fd, short events, void* arg) {
 		NetServer::ReSendToPlayer(sd->players[1]);
 		NetServer::ReSendToPlayer(sd->players[2]);
 		NetServer::ReSendToPlayer(sd->players[3]);
-		sd->EndDuel();
-		sd->DuelEndProc();
+		sd->FinishDuel(END_ACTION_PROC);
 		event_del(sd->etimer);
 	}
 }
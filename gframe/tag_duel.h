@@ -4,6 +4,7 @@
 #include "config.h"
 #include "network.h"
 #include "replay.h"
+#include "field_mirror.h"
 
 namespace ygo {
 
@@ -28,7 +29,11 @@ public:
 	virtual void GetResponse(DuelPlayer* dp, void* pdata, unsigned int len);
 	virtual void TimeConfirm(DuelPlayer* dp);
 	virtual void EndDuel();
+	virtual void ReplayEnded();
 	
+	void FinishDuel(unsigned char action);
+	void SendReplay();
+	void RunEndAction();
 	void DuelEndProc();
 	void WaitforResponse(int playerid);
 	void RefreshMzone(int player, int flag = 0x81fff, int use_cache = 1);
@@ -38,7 +43,8 @@ public:
 	void RefreshExtra(int player, int flag = 0x81fff, int use_cache = 1);
 	void RefreshSingle(int player, int location, int sequence, int flag = 0x781fff);
 	
-	static int MessageHandler(long fduel, int type);
+	static int MessageHandler(void* payload, long fduel, int type);
+	static int MessageSink(void* payload, unsigned char* msg, unsigned int len);
 	static void TagTimer(evutil_socket_t fd, short events, void* arg);
 	
 protected:
@@ -51,6 +57,10 @@ protected:
 	unsigned char hand_result[2];
 	unsigned char last_response;
 	Replay last_replay;
+	bool replay_pending; //EndDuel is waiting for the ReplayWriter to close the replay
+	unsigned char end_action;
+	FieldMirror field_mirror;
+	int engine_stop;
 	unsigned char turn_count;
 	unsigned short time_limit[2];
 	unsigned short time_elapsed;
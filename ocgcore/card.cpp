@@ -90,6 +90,7 @@ card::~card() {
 	single_effect.clear();
 	field_effect.clear();
 	equip_effect.clear();
+	candidates.clear();
 	relate_effect.clear();
 }
 
@@ -283,7 +284,7 @@ uint32 card::get_code() {
 			code = data.alias;
 	} else {
 		card_data dat;
-		read_card(code, &dat);
+		read_card(pduel, code, &dat);
 		if (dat.alias)
 			code = dat.alias;
 	}
@@ -316,7 +317,7 @@ int32 card::is_set_card(uint32 set_code) {
 		setcode = data.setcode;
 	} else {
 		card_data dat;
-		::read_card(code, &dat);
+		::read_card(pduel, code, &dat);
 		setcode = dat.setcode;
 	}
 	uint32 settype = set_code & 0xfff;
@@ -912,6 +913,7 @@ void card::equip(card *target, uint32 send_msg) {
 	if (equiping_target) // if this card is already enquipped, it can't be enquipped to yet another card
 		return;
 	target->equiping_cards.insert(this); // target must know it's equipped cards
+	pduel->game_field->effects.version++;
 	equiping_target = target;
 	// effect taking place ?
 	for (auto it = equip_effect.begin(); it != equip_effect.end(); ++it) {
@@ -939,6 +941,7 @@ void card::unequip() {
 			pduel->game_field->add_to_disable_check_list(equiping_target);
 	}
 	equiping_target->equiping_cards.erase(this); // remove the card from its target's equip list
+	pduel->game_field->effects.version++;
 	pre_equip_target = equiping_target; // remember what target was (for what purpose ?)
 	equiping_target = 0; // remove the target
 	return;
@@ -1189,10 +1192,12 @@ int32 card::add_effect(effect* peffect) {
 			}
 		}
 		it = single_effect.insert(make_pair(peffect->code, peffect));
+		pduel->game_field->effects.version++;
 	} else if (peffect->type & EFFECT_TYPE_FIELD)
 		it = field_effect.insert(make_pair(peffect->code, peffect));
 	else if (peffect->type & EFFECT_TYPE_EQUIP) {
 		it = equip_effect.insert(make_pair(peffect->code, peffect));
+		pduel->game_field->effects.version++;
 		if (equiping_target)
 			check_target = equiping_target;
 		else
@@ -1260,9 +1265,10 @@ void card::remove_effect(effect* peffect) {
  */
 void card::remove_effect(effect* peffect, effect_container::iterator it) {
 	card* check_target = this;
-	if (peffect->type & EFFECT_TYPE_SINGLE)
+	if (peffect->type & EFFECT_TYPE_SINGLE) {
 		single_effect.erase(it);
-	else if (peffect->type & EFFECT_TYPE_FIELD) {
+		pduel->game_field->effects.version++;
+	} else if (peffect->type & EFFECT_TYPE_FIELD) {
 		check_target = 0;
 		if (peffect->in_range(current.location, current.sequence) && get_status(STATUS_EFFECT_ENABLED) && !get_status(STATUS_DISABLED)) {
 			if (peffect->is_disable_related())
@@ -1273,6 +1279,7 @@ void card::remove_effect(effect* peffect, effect_container::iterator it) {
 			pduel->game_field->remove_effect(peffect);
 	} else if (peffect->type & EFFECT_TYPE_EQUIP) {
 		equip_effect.erase(it);
+		pduel->game_field->effects.version++;
 		if (equiping_target)
 			check_target = equiping_target;
 		else
@@ -1322,7 +1329,7 @@ void card::remove_effect(effect* peffect, effect_container::iterator it) {
  */
 int32 card::copy_effect(uint32 code, uint32 reset, uint32 count) {
 	card_data cdata;
-	read_card(code, &cdata);
+	read_card(pduel, code, &cdata);
 	if(cdata.type & TYPE_NORMAL) // effect of normal monsters can't be copied, duh
 		return -1;
 	set_status(STATUS_COPYING_EFFECT, TRUE); // this card is now copying an effect
@@ -1713,28 +1720,48 @@ void card::cancel_card_target(card* pcard) {
 }
 
 /*
- * ?
+ * Returns the effects with this code from the containers filter_effect(...) and is_affected_by_effect(...) look at.
+ * The list is rebuilt when an effect container changed since it was built.
  */
-void card::filter_effect(int32 code, effect_set* eset, uint8 sort) {
-	effect* peffect;
+effect_candidates& card::get_candidate_effects(int32 code) {
+	effect_candidates& cand = candidates[code];
+	uint32 version = pduel->game_field->effects.version;
+	if (cand.version == version)
+		return cand;
+	cand.version = version;
+	cand.list.clear();
 	auto rg = single_effect.equal_range(code);
-	for (; rg.first != rg.second; ++rg.first) {
-		peffect = rg.first->second;
-		if (peffect->is_available() && (!(peffect->flag & EFFECT_FLAG_SINGLE_RANGE) || is_affect_by_effect(peffect)))
-			eset->add_item(peffect);
-	}
+	for (; rg.first != rg.second; ++rg.first)
+		cand.list.push_back(rg.first->second);
+	cand.single_end = cand.list.size();
 	for (auto cit = equiping_cards.begin(); cit != equiping_cards.end(); ++cit) {
 		rg = (*cit)->equip_effect.equal_range(code);
-		for (; rg.first != rg.second; ++rg.first) {
-			peffect = rg.first->second;
+		for (; rg.first != rg.second; ++rg.first)
+			cand.list.push_back(rg.first->second);
+	}
+	cand.equip_end = cand.list.size();
+	auto arg = pduel->game_field->effects.aura_effect.equal_range(code);
+	for (; arg.first != arg.second; ++arg.first)
+		cand.list.push_back(arg.first->second);
+	return cand;
+}
+
+/*
+ * ?
+ */
+void card::filter_effect(int32 code, effect_set* eset, uint8 sort) {
+	effect* peffect;
+	effect_candidates& cand = get_candidate_effects(code);
+	// the checks below can run scripts, so the list is not iterated with iterators
+	for (uint32 i = 0; i < cand.list.size(); ++i) {
+		peffect = cand.list[i];
+		if (i < cand.single_end) {
+			if (peffect->is_available() && (!(peffect->flag & EFFECT_FLAG_SINGLE_RANGE) || is_affect_by_effect(peffect)))
+				eset->add_item(peffect);
+		} else if (i < cand.equip_end) {
 			if (peffect->is_available() && is_affect_by_effect(peffect))
 				eset->add_item(peffect);
-		}
-	}
-	rg = pduel->game_field->effects.aura_effect.equal_range(code);
-	for (; rg.first != rg.second; ++rg.first) {
-		peffect = rg.first->second;
-		if (!(peffect->flag & EFFECT_FLAG_PLAYER_TARGET) && peffect->is_available()
+		} else if (!(peffect->flag & EFFECT_FLAG_PLAYER_TARGET) && peffect->is_available()
 			&& peffect->is_target(this) && is_affect_by_effect(peffect))
 			eset->add_item(peffect);
 	}
@@ -1778,9 +1805,9 @@ void card::filter_immune_effect() {
 				immune_effect.add_item(peffect);
 		}
 	}
-	rg = pduel->game_field->effects.aura_effect.equal_range(EFFECT_IMMUNE_EFFECT);
-	for (; rg.first != rg.second; ++rg.first) {
-		peffect = rg.first->second;
+	auto arg = pduel->game_field->effects.aura_effect.equal_range(EFFECT_IMMUNE_EFFECT);
+	for (; arg.first != arg.second; ++arg.first) {
+		peffect = arg.first->second;
 		if (peffect->is_target(this) && peffect->is_available())
 			immune_effect.add_item(peffect);
 	}
@@ -1939,24 +1966,16 @@ void card::filter_spsummon_procedure_g(uint8 playerid, effect_set* peset) {
  */
 effect* card::is_affected_by_effect(int32 code) {
 	effect* peffect;
-	auto rg = single_effect.equal_range(code);
-	for (; rg.first != rg.second; ++rg.first) {
-		peffect = rg.first->second;
-		if (peffect->is_available() && (!(peffect->flag & EFFECT_FLAG_SINGLE_RANGE) || is_affect_by_effect(peffect)))
-			return peffect;
-	}
-	for (auto cit = equiping_cards.begin(); cit != equiping_cards.end(); ++cit) {
-		rg = (*cit)->equip_effect.equal_range(code);
-		for (; rg.first != rg.second; ++rg.first) {
-			peffect = rg.first->second;
+	effect_candidates& cand = get_candidate_effects(code);
+	for (uint32 i = 0; i < cand.list.size(); ++i) {
+		peffect = cand.list[i];
+		if (i < cand.single_end) {
+			if (peffect->is_available() && (!(peffect->flag & EFFECT_FLAG_SINGLE_RANGE) || is_affect_by_effect(peffect)))
+				return peffect;
+		} else if (i < cand.equip_end) {
 			if (peffect->is_available() && is_affect_by_effect(peffect))
 				return peffect;
-		}
-	}
-	rg = pduel->game_field->effects.aura_effect.equal_range(code);
-	for (; rg.first != rg.second; ++rg.first) {
-		peffect = rg.first->second;
-		if (!(peffect->flag & EFFECT_FLAG_PLAYER_TARGET) && peffect->is_available()
+		} else if (!(peffect->flag & EFFECT_FLAG_PLAYER_TARGET) && peffect->is_available()
 			&& peffect->is_target(this) && is_affect_by_effect(peffect))
 			return peffect;
 	}
@@ -1968,25 +1987,17 @@ effect* card::is_affected_by_effect(int32 code) {
  */
 effect* card::is_affected_by_effect(int32 code, card* target) {
 	effect* peffect;
-	auto rg = single_effect.equal_range(code);
-	for (; rg.first != rg.second; ++rg.first) {
-		peffect = rg.first->second;
-		if (peffect->is_available() && (!(peffect->flag & EFFECT_FLAG_SINGLE_RANGE) || is_affect_by_effect(peffect))
-			&& peffect->get_value(target))
-			return peffect;
-	}
-	for (auto cit = equiping_cards.begin(); cit != equiping_cards.end(); ++cit) {
-		rg = (*cit)->equip_effect.equal_range(code);
-		for (; rg.first != rg.second; ++rg.first) {
-			peffect = rg.first->second;
+	effect_candidates& cand = get_candidate_effects(code);
+	for (uint32 i = 0; i < cand.list.size(); ++i) {
+		peffect = cand.list[i];
+		if (i < cand.single_end) {
+			if (peffect->is_available() && (!(peffect->flag & EFFECT_FLAG_SINGLE_RANGE) || is_affect_by_effect(peffect))
+				&& peffect->get_value(target))
+				return peffect;
+		} else if (i < cand.equip_end) {
 			if (peffect->is_available() && is_affect_by_effect(peffect) && peffect->get_value(target))
 				return peffect;
-		}
-	}
-	rg = pduel->game_field->effects.aura_effect.equal_range(code);
-	for (; rg.first != rg.second; ++rg.first) {
-		peffect = rg.first->second;
-		if (!(peffect->flag & EFFECT_FLAG_PLAYER_TARGET) && peffect->is_available()
+		} else if (!(peffect->flag & EFFECT_FLAG_PLAYER_TARGET) && peffect->is_available()
 			&& peffect->is_target(this) && is_affect_by_effect(peffect) && peffect->get_value(target))
 			return peffect;
 	}
@@ -12,8 +12,11 @@
 
 #include "common.h"
 #include "effectset.h"
+#include "cardset.h"
 #include <set>
 #include <map>
+#include <vector>
+#include <unordered_map>
 
 class card;
 class duel;
@@ -85,6 +88,18 @@ struct query_cache {
 	uint32 rscale;
 };
 
+/*
+ * The effects with one code that can apply to a card, see card::get_candidate_effects(...).
+ * Only the containers are cached, whether an effect applies is still checked on every query.
+ */
+struct effect_candidates {
+	effect_candidates(): version(0), single_end(0), equip_end(0) {}
+	uint32 version; // the field_effect::version the list was built for
+	uint32 single_end; // the single effects of the card come first
+	uint32 equip_end; // then the equip effects of the equiping cards, the aura effects last
+	std::vector<effect*> list;
+};
+
 /*
  * A representation of a card, that can be used for duels.
  */
@@ -92,11 +107,12 @@ class card {
 public:
 	typedef std::vector<card*> card_vector; // a list of cards
 	typedef std::multimap<uint32, effect*> effect_container; // saves a list of effects with uint32 keys
-	typedef std::set<card*, card_sort> card_set; // a list of cards with a comparator
+	typedef card_id_set card_set; // a list of cards ordered by cardid
 	typedef std::map<effect*, effect_container::iterator> effect_indexer; // ?
 	typedef std::map<effect*, uint32> effect_relation; // saves effect relations ?
 	typedef std::map<card*, uint32> relation_map; // saves relations ?
 	typedef std::map<uint16, uint16> counter_map; // Saves all counters on this card. Probably there are uint16 constants for the different counters somewhere ?
+	typedef std::unordered_map<uint32, effect_candidates> candidate_cache; // candidate effects by effect code
 	typedef std::map<uint16, card*> attacker_map; // Associates an uint16 with a card to indicate a proposed/done/etc attack. The uint16 is a simple index for the attack ?
 	int32 scrtype; // ?
 	int32 ref_handle; // ?
@@ -145,6 +161,7 @@ public:
 	effect_indexer indexer; // ?
 	effect_relation relate_effect; // ?
 	effect_set_v immune_effect; // ?
+	candidate_cache candidates; // filled by get_candidate_effects(...)
 
 	card(); // constructor
 	~card(); // destructor
@@ -209,6 +226,7 @@ public:
 	void add_card_target(card* pcard);
 	void cancel_card_target(card* pcard);
 	
+	effect_candidates& get_candidate_effects(int32 code);
 	void filter_effect(int32 code, effect_set* eset, uint8 sort = TRUE);
 	void filter_single_continuous_effect(int32 code, effect_set* eset, uint8 sort = TRUE);
 	void filter_immune_effect();
@@ -0,0 +1,41 @@
+/*
+ * cardfilter.cpp
+ */
+
+#include "cardfilter.h"
+#include "card.h"
+#include "duel.h"
+#include "field.h"
+
+card_filter::card_filter() {
+	scrtype = 4;
+	flag = 0;
+	code = 0;
+	setcode = 0;
+	type = 0;
+	race = 0;
+	attribute = 0;
+}
+/*
+ * Checks the conditions as the Card functions of the same name do, the cheap ones first.
+ */
+int32 card_filter::is_match(card* pcard) {
+	if((flag & CARD_FILTER_CODE) && pcard->get_code() != code && pcard->get_another_code() != code)
+		return FALSE;
+	if((flag & CARD_FILTER_FACEUP) && !pcard->is_position(POS_FACEUP))
+		return FALSE;
+	if((flag & CARD_FILTER_TYPE) && !(pcard->get_type() & type))
+		return FALSE;
+	if((flag & CARD_FILTER_RACE) && !(pcard->get_race() & race))
+		return FALSE;
+	if((flag & CARD_FILTER_ATTRIBUTE) && !(pcard->get_attribute() & attribute))
+		return FALSE;
+	if((flag & CARD_FILTER_SETCODE) && !pcard->is_set_card(setcode))
+		return FALSE;
+	uint32 p = pcard->pduel->game_field->core.reason_player;
+	if((flag & CARD_FILTER_TO_HAND) && !pcard->is_capable_send_to_hand(p))
+		return FALSE;
+	if((flag & CARD_FILTER_TO_GRAVE) && !pcard->is_capable_send_to_grave(p))
+		return FALSE;
+	return TRUE;
+}
@@ -0,0 +1,39 @@
+/*
+ * cardfilter.h
+ * A filter for the matching card functions made by Duel.CreateFilter from a table of conditions,
+ * e.g. {type=TYPE_MONSTER, race=RACE_WARRIOR, abletohand=true}.
+ * The engine checks it without calling into Lua, it can still be called like a Lua filter.
+ */
+
+#ifndef CARDFILTER_H_
+#define CARDFILTER_H_
+
+#include "common.h"
+
+class card;
+
+class card_filter {
+public:
+	int32 scrtype; // 4, as for the other script objects
+	uint32 flag; // the conditions that are set
+	uint32 code;
+	uint32 setcode;
+	uint32 type;
+	uint32 race;
+	uint32 attribute;
+
+	card_filter();
+	int32 is_match(card* pcard);
+};
+
+//Conditions
+#define CARD_FILTER_CODE		0x01	//IsCode
+#define CARD_FILTER_SETCODE		0x02	//IsSetCard
+#define CARD_FILTER_TYPE		0x04	//IsType
+#define CARD_FILTER_RACE		0x08	//IsRace
+#define CARD_FILTER_ATTRIBUTE	0x10	//IsAttribute
+#define CARD_FILTER_FACEUP		0x20	//IsFaceup
+#define CARD_FILTER_TO_HAND		0x40	//IsAbleToHand
+#define CARD_FILTER_TO_GRAVE	0x80	//IsAbleToGrave
+
+#endif /* CARDFILTER_H_ */
@@ -0,0 +1,86 @@
+/*
+ * cardset.cpp
+ */
+
+#include "cardset.h"
+#include "card.h"
+
+void card_id_set::reserve_id(uint32 id) {
+	if(id < slots.size())
+		return;
+	slots.resize(id + 1, 0);
+	bits.resize((id >> 6) + 1, 0);
+}
+// a card with the cardid of a card in the set is not added, as with std::set
+std::pair<card_id_set::iterator, bool> card_id_set::insert(card* pcard) {
+	uint32 id = pcard->cardid;
+	reserve_id(id);
+	uint64 bit = 1ULL << (id & 63);
+	if(bits[id >> 6] & bit)
+		return std::make_pair(iterator(this, id), false);
+	bits[id >> 6] |= bit;
+	slots[id] = pcard;
+	total++;
+	return std::make_pair(iterator(this, id), true);
+}
+// merges whole words when the range is a complete set
+void card_id_set::insert(iterator first, iterator last) {
+	const card_id_set* cset = first.set;
+	if(!cset || first == last)
+		return;
+	if(last.index != END || first.index != cset->next(0) || cset == this) {
+		for(; first != last; ++first)
+			insert(*first);
+		return;
+	}
+	if(cset->slots.size() > slots.size())
+		reserve_id(cset->slots.size() - 1);
+	for(uint32 word = 0; word < cset->bits.size(); ++word) {
+		uint64 added = cset->bits[word] & ~bits[word];
+		if(!added)
+			continue;
+		bits[word] |= added;
+		while(added) {
+			uint32 id = (word << 6) + lowest_bit(added);
+			slots[id] = cset->slots[id];
+			total++;
+			added &= added - 1;
+		}
+	}
+}
+card_id_set::size_type card_id_set::erase(card* pcard) {
+	uint32 id = pcard->cardid;
+	if(id >= slots.size() || !(bits[id >> 6] & (1ULL << (id & 63))))
+		return 0;
+	bits[id >> 6] &= ~(1ULL << (id & 63));
+	slots[id] = 0;
+	total--;
+	return 1;
+}
+card_id_set::iterator card_id_set::erase(iterator it) {
+	uint32 id = it.index;
+	if(bits[id >> 6] & (1ULL << (id & 63))) {
+		bits[id >> 6] &= ~(1ULL << (id & 63));
+		slots[id] = 0;
+		total--;
+	}
+	return iterator(this, next(id + 1));
+}
+card_id_set::iterator card_id_set::find(card* pcard) const {
+	uint32 id = pcard->cardid;
+	if(id >= slots.size() || !(bits[id >> 6] & (1ULL << (id & 63))))
+		return end();
+	return iterator(this, id);
+}
+card_id_set::size_type card_id_set::count(card* pcard) const {
+	uint32 id = pcard->cardid;
+	return (id < slots.size() && (bits[id >> 6] & (1ULL << (id & 63)))) ? 1 : 0;
+}
+bool card_id_set::operator==(const card_id_set& cset) const {
+	if(total != cset.total)
+		return false;
+	for(iterator it = begin(), cit = cset.begin(); it != end(); ++it, ++cit)
+		if(*it != *cit)
+			return false;
+	return true;
+}
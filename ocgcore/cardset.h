@@ -0,0 +1,153 @@
+/*
+ * cardset.h
+ * A set of cards indexed by cardid, which is a small number given to every card of a duel.
+ * It iterates in the order of cardid like std::set<card*, card_sort> did; membership is
+ * a bit test and merging two sets works on whole words of the bitmap.
+ * Iterators keep their position when cards are inserted or erased, a card added behind
+ * an iterator is visited by it, as with std::set.
+ */
+
+#ifndef CARDSET_H_
+#define CARDSET_H_
+
+#include "common.h"
+#include <vector>
+#include <iterator>
+#include <utility>
+#include <stddef.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+class card;
+
+class card_id_set {
+public:
+	static const uint32 END = 0xffffffff;
+
+	class iterator {
+	public:
+		typedef std::forward_iterator_tag iterator_category;
+		typedef card* value_type;
+		typedef ptrdiff_t difference_type;
+		typedef card* const* pointer;
+		typedef card* const& reference;
+
+		iterator(): set(0), index(END) {}
+		iterator(const card_id_set* s, uint32 i): set(s), index(i) {}
+		reference operator*() const {
+			return set->slots[index];
+		}
+		pointer operator->() const {
+			return &set->slots[index];
+		}
+		iterator& operator++() {
+			index = set->next(index + 1);
+			return *this;
+		}
+		iterator operator++(int) {
+			iterator it = *this;
+			index = set->next(index + 1);
+			return it;
+		}
+		// an iterator moved past a card that is erased afterwards goes on to the next one
+		bool operator==(const iterator& it) const {
+			settle();
+			it.settle();
+			return index == it.index;
+		}
+		bool operator!=(const iterator& it) const {
+			return !(*this == it);
+		}
+	private:
+		friend class card_id_set;
+		void settle() const {
+			if(index != END && (index >= set->slots.size() || !set->slots[index]))
+				index = set->next(index);
+		}
+		const card_id_set* set;
+		mutable uint32 index;
+	};
+	typedef iterator const_iterator;
+	typedef card* key_type;
+	typedef card* value_type;
+	typedef uint32 size_type;
+
+	card_id_set(): total(0) {}
+	template<class InputIt>
+	card_id_set(InputIt first, InputIt last): total(0) {
+		insert(first, last);
+	}
+
+	iterator begin() const {
+		return iterator(this, next(0));
+	}
+	iterator end() const {
+		return iterator(this, END);
+	}
+	size_type size() const {
+		return total;
+	}
+	bool empty() const {
+		return total == 0;
+	}
+	void clear() {
+		bits.clear();
+		slots.clear();
+		total = 0;
+	}
+	void swap(card_id_set& cset) {
+		bits.swap(cset.bits);
+		slots.swap(cset.slots);
+		std::swap(total, cset.total);
+	}
+	std::pair<iterator, bool> insert(card* pcard);
+	iterator insert(iterator hint, card* pcard) {
+		return insert(pcard).first;
+	}
+	void insert(iterator first, iterator last);
+	template<class InputIt>
+	void insert(InputIt first, InputIt last) {
+		for(; first != last; ++first)
+			insert(*first);
+	}
+	size_type erase(card* pcard);
+	iterator erase(iterator it);
+	iterator find(card* pcard) const;
+	size_type count(card* pcard) const;
+	bool operator==(const card_id_set& cset) const;
+	bool operator!=(const card_id_set& cset) const {
+		return !(*this == cset);
+	}
+
+private:
+	// the first index from i on that holds a card, END if there is none
+	uint32 next(uint32 i) const {
+		uint32 word = i >> 6;
+		if(i == END || word >= bits.size())
+			return END;
+		uint64 mask = bits[word] & (~0ULL << (i & 63));
+		while(!mask) {
+			if(++word >= bits.size())
+				return END;
+			mask = bits[word];
+		}
+		return (word << 6) + lowest_bit(mask);
+	}
+	static uint32 lowest_bit(uint64 mask) {
+#ifdef _MSC_VER
+		unsigned long index;
+		_BitScanForward64(&index, mask);
+		return index;
+#else
+		return __builtin_ctzll(mask);
+#endif
+	}
+	void reserve_id(uint32 id);
+
+	std::vector<uint64> bits; // bit i is set if slots[i] holds the card with cardid i
+	std::vector<card*> slots;
+	uint32 total;
+};
+
+#endif /* CARDSET_H_ */
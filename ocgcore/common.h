@@ -41,6 +41,12 @@ typedef int BOOL;
 #define NULL 0
 #endif
 
+#ifdef _MSC_VER
+#define THREAD_LOCAL __declspec(thread)
+#else
+#define THREAD_LOCAL __thread
+#endif
+
 /*
  * A structure that contains an operation to compare two cards.
  */
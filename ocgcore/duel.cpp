@@ -12,32 +12,33 @@
 #include "effect.h"
 #include "group.h"
 #include "ocgapi.h"
+#include "tracer.h"
 #include <memory.h>
 
 
 /*
  * Constructor of the duel class. Initializes some values.
  */
-duel::duel() {
+duel::duel(script_reader_ex sr, card_reader_ex cr, message_handler_ex mh, void* payload):
+	sreader(sr), creader(cr), mhandler(mh), handler_payload(payload), msink(0), sink_payload(0), tracer(0) {
+	// the callbacks are set before the interpreter loads the common scripts
 	lua = new interpreter(this); // the effect interpreter (?) for this duel
 	game_field = new field(this); // the game field for this duel
 	game_field->temp_card = new_card(0); // ?
+	buffer.resize(0x1000);
 	bufferlen = 0;
-	bufferp = buffer;
 }
 
 /*
  * Destructor of the duel class. Releases the reserved memory.
  */
 duel::~duel() {
-	for(std::set<card*>::iterator cit = cards.begin(); cit != cards.end(); ++cit)
-		delete *cit; // release all cards (?)
-	for(std::set<group*>::iterator git = groups.begin(); git != groups.end(); ++git)
-		delete *git; // release all card groups
-	for(std::set<effect*>::iterator eit = effects.begin(); eit != effects.end(); ++eit)
-		delete *eit; // release all effects
+	cards.clear(); // release all cards (?)
+	groups.clear(); // release all card groups
+	effects.clear(); // release all effects
 	delete lua; // release the interpreter
 	delete game_field; // and the game field
+	delete tracer;
 }
 
 
@@ -45,18 +46,11 @@ duel::~duel() {
  * Resets the duel.
  */
 void duel::clear() {
-	// release cards, card groups and effects
-	for(std::set<card*>::iterator cit = cards.begin(); cit != cards.end(); ++cit)
-		delete *cit;
-	for(std::set<group*>::iterator git = groups.begin(); git != groups.end(); ++git)
-		delete *git;
-	for(std::set<effect*>::iterator eit = effects.begin(); eit != effects.end(); ++eit)
-		delete *eit;
-	delete game_field; // release the game field
-	// clear up the three sets
+	// release cards, card groups and effects, keeping their slabs
 	cards.clear();
 	groups.clear();
 	effects.clear();
+	delete game_field; // release the game field
 	// restart
 	game_field = new field(this);
 	game_field->temp_card = new_card(0);
@@ -66,10 +60,9 @@ void duel::clear() {
  * Adds a card to the duel by code.
  */
 card* duel::new_card(uint32 code) {
-	card* pcard = new card();
-	cards.insert(pcard);
+	card* pcard = cards.alloc();
 	if(code)
-		::read_card(code, &(pcard->data)); // ???
+		::read_card(this, code, &(pcard->data)); // ???
 	pcard->data.code = code;
 	pcard->pduel = this;
 	lua->register_card(pcard);
@@ -81,8 +74,7 @@ card* duel::new_card(uint32 code) {
  * If pcard is not defined, the group will be empty.
  */
 group* duel::new_group(card* pcard) {
-	group* pgroup = new group();
-	groups.insert(pgroup);
+	group* pgroup = groups.alloc();
 	if (pcard)
 		pgroup->container.insert(pcard);
 	if(lua->call_depth) // ?
@@ -96,9 +88,8 @@ group* duel::new_group(card* pcard) {
  * Adds an empty effect to the duel.
  */
 effect* duel::new_effect() {
-	effect* peffect = new effect();
+	effect* peffect = effects.alloc();
 	peffect->pduel = this;
-	effects.insert(peffect);
 	lua->register_effect(peffect);
 	return peffect;
 }
@@ -107,8 +98,7 @@ effect* duel::new_effect() {
  * Deletes a specified card from the duel.
  */
 void duel::delete_card(card* pcard) {
-	cards.erase(pcard);
-	delete pcard;
+	cards.free(pcard);
 }
 
 /*
@@ -116,9 +106,8 @@ void duel::delete_card(card* pcard) {
  */
 void duel::delete_group(group* pgroup) {
 	lua->unregister_group(pgroup);
-	groups.erase(pgroup);
 	sgroups.erase(pgroup);
-	delete pgroup;
+	groups.free(pgroup);
 }
 
 /*
@@ -126,15 +115,15 @@ void duel::delete_group(group* pgroup) {
  */
 void duel::delete_effect(effect* peffect) {
 	lua->unregister_effect(peffect);
-	effects.erase(peffect);
-	delete peffect;
+	effects.free(peffect);
 }
 
 /*
  * Reads the specified byte array into the buffer and returns its length.
  */
 int32 duel::read_buffer(byte* buf) {
-	memcpy(buf, buffer, bufferlen);
+	if(bufferlen)
+		memcpy(buf, &buffer[0], bufferlen);
 	return bufferlen;
 }
 
@@ -147,8 +136,7 @@ void duel::release_script_group() {
 		group* pgroup = *sit;
 		if(pgroup->is_readonly == 0) {
 			lua->unregister_group(pgroup);
-			groups.erase(pgroup);
-			delete pgroup;
+			groups.free(pgroup);
 		}
 	}
 	sgroups.clear();
@@ -168,27 +156,33 @@ void duel::restore_assumes() {
  * Writes to the buffer. (32 bit)
  */
 void duel::write_buffer32(uint32 value) {
-	*((uint32*)bufferp) = value;
-	bufferp += 4;
-	bufferlen += 4;
+	write_buffer(&value, 4);
 }
 
 /*
  * Writes to the buffer. (16 bit)
  */
 void duel::write_buffer16(uint16 value) {
-	*((uint16*)bufferp) = value;
-	bufferp += 2;
-	bufferlen += 2;
+	write_buffer(&value, 2);
 }
 
 /*
  * Writes to the buffer. (8 bit)
  */
 void duel::write_buffer8(uint8 value) {
-	*((uint8*)bufferp) = value;
-	bufferp += 1;
-	bufferlen += 1;
+	if(bufferlen == buffer.size())
+		buffer.resize(buffer.size() * 2);
+	buffer[bufferlen++] = value;
+}
+
+/*
+ * Writes a byte array to the buffer, the buffer doubles when it is full.
+ */
+void duel::write_buffer(const void* data, uint32 len) {
+	if(bufferlen + len > buffer.size())
+		buffer.resize((bufferlen + len) * 2);
+	memcpy(&buffer[bufferlen], data, len);
+	bufferlen += len;
 }
 
 /*
@@ -196,7 +190,6 @@ void duel::write_buffer8(uint8 value) {
  */
 void duel::clear_buffer() {
 	bufferlen = 0;
-	bufferp = buffer;
 }
 
 /*
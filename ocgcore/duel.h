@@ -11,14 +11,18 @@
 #define DUEL_H_
 
 #include "common.h"
+#include "ocgapi.h"
 #include "mtrandom.h"
+#include "slabpool.h"
 #include <set>
+#include <vector>
 
 class card;
 class group;
 class effect;
 class field;
 class interpreter;
+class processor_tracer;
 
 /*
  * A structure for initial arguments, that are: start life points, start hand and draw count.
@@ -32,20 +36,26 @@ struct duel_arg {
 class duel {
 public:
 	char strbuffer[256]; // ?
-	byte buffer[0x1000]; // maybe for queries ?
-	uint32 bufferlen; // the length of the buffer, use with read_buffer
-	byte* bufferp; // the position on the buffer
+	std::vector<byte> buffer; // the messages written since the last get_message, grows as needed
+	uint32 bufferlen; // the length of the messages in the buffer, use with read_buffer
 	interpreter* lua; // the interpreter for effects
 	field* game_field; // the game field
 	mtrandom random; // the RNG
-	std::set<card*> cards; // the cards in the duel
+	slab_pool<card> cards; // the cards in the duel
 	std::set<card*> assumes; // assumptions for certain cards ?
-	std::set<group*> groups; // card groups in the duel
+	slab_pool<group> groups; // card groups in the duel
 	std::set<group*> sgroups; // script groups in the game
-	std::set<effect*> effects; // the effects currently in place
+	slab_pool<effect, 256> effects; // the effects currently in place
 	std::set<effect*> uncopy;
+	script_reader_ex sreader; // per duel callbacks, the global ones are used when not set
+	card_reader_ex creader;
+	message_handler_ex mhandler;
+	void* handler_payload;
+	message_sink msink; // receives the messages instead of get_message when set
+	void* sink_payload;
+	processor_tracer* tracer; // records the processor steps when set, see set_tracing(...)
 	
-	duel(); 
+	duel(script_reader_ex sreader = 0, card_reader_ex creader = 0, message_handler_ex mhandler = 0, void* payload = 0);
 	~duel();  
 	void clear(); // resets the duel object
 	
@@ -61,6 +71,7 @@ public:
 	void write_buffer32(uint32 value); // writes to the buffer
 	void write_buffer16(uint16 value);
 	void write_buffer8(uint8 value);
+	void write_buffer(const void* data, uint32 len);
 	void clear_buffer(); // clears the buffer
 	void set_responsei(uint32 resp); // Sets a integer response?
 	void set_responseb(byte* resp); // Sets a byte response?
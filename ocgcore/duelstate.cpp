@@ -0,0 +1,1261 @@
+/*
+ * duelstate.cpp
+ */
+
+#include "duelstate.h"
+#include "duel.h"
+#include "field.h"
+#include "card.h"
+#include "group.h"
+#include "effect.h"
+#include "cardfilter.h"
+#include "interpreter.h"
+#include <string.h>
+#include <stdio.h>
+#include <new>
+#include <string>
+#include <algorithm>
+#include <unordered_map>
+
+//Lua values
+#define STATE_NIL			0
+#define STATE_FALSE			1
+#define STATE_TRUE			2
+#define STATE_NUMBER		3
+#define STATE_STRING		4
+#define STATE_TABLE			5	//the pairs, a nil and the metatable
+#define STATE_FUNCTION		6	//the bytecode and the upvalues
+#define STATE_PERMANENT		7	//the name, then the pairs and the metatable of a table or the upvalues of a function
+#define STATE_OBJECT		8	//the userdata of a card, group or effect, then the metatable
+#define STATE_FILTER		9	//the userdata of a card filter, then the metatable
+#define STATE_REFERENCE		10	//a value written before
+#define STATE_SHARED		11	//an upvalue shared with a function written before
+//Words
+#define STATE_WORD			0
+#define STATE_CARD			1
+#define STATE_GROUP			2
+#define STATE_EFFECT		3
+
+template<class A>
+static void transfer(A& ar, card_state& state) {
+	ar.io(state.code);
+	ar.io(state.type);
+	ar.io(state.level);
+	ar.io(state.rank);
+	ar.io(state.lscale);
+	ar.io(state.rscale);
+	ar.io(state.attribute);
+	ar.io(state.race);
+	ar.io(state.attack);
+	ar.io(state.defence);
+	ar.io(state.base_attack);
+	ar.io(state.base_defence);
+	ar.io(state.controler);
+	ar.io(state.location);
+	ar.io(state.sequence);
+	ar.io(state.position);
+	ar.io(state.reason);
+	ar.io(state.reason_card);
+	ar.io(state.reason_player);
+	ar.io(state.reason_effect);
+}
+template<class A>
+static void transfer(A& ar, tevent& e) {
+	// events are compared with memcmp, the padding has to be zero
+	if(A::reading)
+		memset(&e, 0, sizeof(tevent));
+	ar.io(e.trigger_card);
+	ar.io(e.event_cards);
+	ar.io(e.reason_effect);
+	ar.io(e.event_code);
+	ar.io(e.event_value);
+	ar.io(e.reason);
+	ar.io(e.event_player);
+	ar.io(e.reason_player);
+}
+template<class A>
+static void transfer(A& ar, optarget& target) {
+	ar.io(target.op_cards);
+	ar.io(target.op_count);
+	ar.io(target.op_player);
+	ar.io(target.op_param);
+}
+template<class A>
+static void transfer(A& ar, chain& ch) {
+	ar.io(ch.chain_id);
+	ar.io(ch.chain_count);
+	ar.io(ch.triggering_player);
+	ar.io(ch.triggering_controler);
+	ar.io(ch.triggering_location);
+	ar.io(ch.triggering_sequence);
+	ar.io(ch.triggering_effect);
+	ar.io(ch.target_cards);
+	ar.io(ch.replace_op);
+	ar.io(ch.target_player);
+	ar.io(ch.target_param);
+	ar.io(ch.disable_reason);
+	ar.io(ch.disable_player);
+	ar.io(ch.evt);
+	ar.io(ch.opinfos);
+	ar.io(ch.flag);
+}
+// the pointers of a unit may also hold integers, and the arguments pointers
+template<class A>
+static void transfer(A& ar, processor_unit& unit) {
+	ar.io(unit.type);
+	ar.io(unit.step);
+	ar.io(unit.peffect);
+	ar.io(unit.ptarget);
+	ar.word(unit.arg1);
+	ar.word(unit.arg2);
+}
+
+static int state_dump_writer(lua_State* L, const void* p, size_t sz, void* ud) {
+	std::vector<byte>* bytecode = (std::vector<byte>*)ud;
+	bytecode->insert(bytecode->end(), (const byte*)p, (const byte*)p + sz);
+	return 0;
+}
+
+class state_writer {
+public:
+	static const bool reading = false;
+	// orders the containers sorted by pointer by the numbers of the objects
+	struct by_number {
+		state_writer* writer;
+		explicit by_number(state_writer* w): writer(w) {}
+		template<class T>
+		bool operator()(const T& v1, const T& v2) const {
+			return writer->number(v1) < writer->number(v2);
+		}
+	};
+	typedef std::unordered_map<void*, std::pair<uint8, uint32> > id_map;
+	typedef std::unordered_map<void*, std::pair<uint32, uint8> > upvalue_map;
+
+	std::vector<byte>* data;
+	duel* pduel;
+	lua_State* L;
+	id_map ids; // the kind and the number of the cards, groups and effects
+	upvalue_map upvalues; // the function an upvalue was first written with and its index
+	uint32 refs;
+	int32 seen; // the table of the written values and their references
+	int32 permanents;
+
+	state_writer(duel* pd, std::vector<byte>* out): data(out), pduel(pd), L(pd->lua->lua_state), refs(0), seen(0), permanents(0) {}
+	void bytes(const void* p, uint32 len) {
+		data->insert(data->end(), (const byte*)p, (const byte*)p + len);
+	}
+	template<class T>
+	void io(T& value) {
+		bytes(&value, sizeof(T));
+	}
+	template<class T>
+	void io(T*& pointer) {
+		ptr value = (ptr)pointer;
+		word(value);
+	}
+	void word(ptr& value) {
+		id_map::iterator it = ids.find((void*)value);
+		if(it == ids.end()) {
+			uint8 kind = STATE_WORD;
+			int64 raw = value;
+			io(kind);
+			io(raw);
+			return;
+		}
+		io(it->second.first);
+		io(it->second.second);
+	}
+	void io(card_state& state) {
+		transfer(*this, state);
+	}
+	void io(tevent& e) {
+		transfer(*this, e);
+	}
+	void io(optarget& target) {
+		transfer(*this, target);
+	}
+	void io(chain& ch) {
+		transfer(*this, ch);
+	}
+	void io(processor_unit& unit) {
+		transfer(*this, unit);
+	}
+	void io(card_id_set& cset) {
+		std::vector<card*> list(cset.begin(), cset.end());
+		io(list);
+	}
+	void io(effect_set_v& eset) {
+		io(eset.container);
+	}
+	template<class T>
+	void io(std::vector<T>& list) {
+		uint32 count = list.size();
+		io(count);
+		for(uint32 i = 0; i < count; ++i)
+			io(list[i]);
+	}
+	template<class T>
+	void io(std::list<T>& list) {
+		uint32 count = list.size();
+		io(count);
+		for(auto it = list.begin(); it != list.end(); ++it)
+			io(*it);
+	}
+	template<class K, class V>
+	void io(std::pair<K, V>& value) {
+		io(value.first);
+		io(value.second);
+	}
+	template<class T>
+	void io(std::set<T>& values) {
+		write_sorted<T>(values.begin(), values.end());
+	}
+	template<class T>
+	void io(std::unordered_set<T>& values) {
+		write_sorted<T>(values.begin(), values.end());
+	}
+	template<class K, class V, class C>
+	void io(std::map<K, V, C>& values) {
+		write_sorted<std::pair<K, V> >(values.begin(), values.end());
+	}
+	template<class K, class V>
+	void io(std::unordered_map<K, V>& values) {
+		write_sorted<std::pair<K, V> >(values.begin(), values.end());
+	}
+	template<class T, class It>
+	void write_sorted(It first, It last) {
+		std::vector<T> list(first, last);
+		std::stable_sort(list.begin(), list.end(), by_number(this));
+		io(list);
+	}
+	template<class T>
+	uint64 number(T* pointer) {
+		id_map::iterator it = ids.find((void*)pointer);
+		if(it == ids.end())
+			return ~0ULL;
+		return ((uint64)it->second.first << 32) | it->second.second;
+	}
+	template<class T>
+	uint64 number(const T& value) {
+		return (uint64)value;
+	}
+	template<class K, class V>
+	uint64 number(const std::pair<K, V>& value) {
+		return number(value.first);
+	}
+
+	int32 write_lua();
+	int32 write_value(int32 index);
+	int32 write_table(int32 index);
+	int32 write_upvalues(int32 index, uint32 ref);
+	int32 write_metatable(int32 index);
+	void write_string(const char* s, uint32 len) {
+		io(len);
+		bytes(s, len);
+	}
+};
+
+class state_reader {
+public:
+	static const bool reading = true;
+
+	const byte* pos;
+	const byte* end;
+	bool failed;
+	duel* pduel;
+	lua_State* L;
+	std::vector<card*> cards;
+	std::vector<group*> groups;
+	std::vector<effect*> effects;
+	uint32 refs;
+	int32 references; // the table of the values read, by their reference
+	int32 names; // the permanents by name
+
+	state_reader(duel* pd, const byte* buf, int32 len): pos(buf), end(buf + len), failed(false), pduel(pd), L(pd->lua->lua_state), refs(0), references(0), names(0) {}
+	void bytes(void* p, uint32 len) {
+		if(failed || (uint32)(end - pos) < len) {
+			failed = true;
+			memset(p, 0, len);
+			return;
+		}
+		memcpy(p, pos, len);
+		pos += len;
+	}
+	// the size of a container, every element takes at least a byte
+	uint32 count() {
+		uint32 value = 0;
+		io(value);
+		if(value > (uint32)(end - pos)) {
+			failed = true;
+			return 0;
+		}
+		return value;
+	}
+	template<class T>
+	void io(T& value) {
+		bytes(&value, sizeof(T));
+	}
+	template<class T>
+	void io(T*& pointer) {
+		ptr value;
+		word(value);
+		pointer = (T*)value;
+	}
+	void word(ptr& value) {
+		uint8 kind = STATE_WORD;
+		io(kind);
+		value = 0;
+		if(kind == STATE_WORD) {
+			int64 raw = 0;
+			io(raw);
+			value = (ptr)raw;
+			return;
+		}
+		uint32 index = 0;
+		io(index);
+		if(kind == STATE_CARD && index < cards.size())
+			value = (ptr)cards[index];
+		else if(kind == STATE_GROUP && index < groups.size())
+			value = (ptr)groups[index];
+		else if(kind == STATE_EFFECT && index < effects.size())
+			value = (ptr)effects[index];
+		else
+			failed = true;
+	}
+	void io(card_state& state) {
+		transfer(*this, state);
+	}
+	void io(tevent& e) {
+		transfer(*this, e);
+	}
+	void io(optarget& target) {
+		transfer(*this, target);
+	}
+	void io(chain& ch) {
+		transfer(*this, ch);
+	}
+	void io(processor_unit& unit) {
+		transfer(*this, unit);
+	}
+	void io(card_id_set& cset) {
+		std::vector<card*> list;
+		io(list);
+		cset.clear();
+		for(auto it = list.begin(); it != list.end(); ++it)
+			if(*it)
+				cset.insert(*it);
+	}
+	void io(effect_set_v& eset) {
+		io(eset.container);
+		eset.count = eset.container.size();
+	}
+	template<class T>
+	void io(std::vector<T>& list) {
+		uint32 size = count();
+		list.resize(size);
+		for(uint32 i = 0; i < size; ++i)
+			io(list[i]);
+	}
+	template<class T>
+	void io(std::list<T>& list) {
+		uint32 size = count();
+		list.clear();
+		for(uint32 i = 0; i < size; ++i) {
+			list.push_back(T());
+			io(list.back());
+		}
+	}
+	template<class K, class V>
+	void io(std::pair<K, V>& value) {
+		io(value.first);
+		io(value.second);
+	}
+	template<class T>
+	void io(std::set<T>& values) {
+		std::vector<T> list;
+		io(list);
+		values.clear();
+		values.insert(list.begin(), list.end());
+	}
+	template<class T>
+	void io(std::unordered_set<T>& values) {
+		std::vector<T> list;
+		io(list);
+		values.clear();
+		values.insert(list.begin(), list.end());
+	}
+	template<class K, class V, class C>
+	void io(std::map<K, V, C>& values) {
+		std::vector<std::pair<K, V> > list;
+		io(list);
+		values.clear();
+		values.insert(list.begin(), list.end());
+	}
+	template<class K, class V>
+	void io(std::unordered_map<K, V>& values) {
+		std::vector<std::pair<K, V> > list;
+		io(list);
+		values.clear();
+		values.insert(list.begin(), list.end());
+	}
+
+	int32 read_lua();
+	int32 read_value();
+	int32 read_table(int32 index);
+	int32 read_upvalues(int32 index);
+	int32 read_metatable(int32 index);
+	void add_reference() {
+		lua_pushvalue(L, -1);
+		lua_rawseti(L, references, ++refs);
+	}
+};
+
+// containers in an order other than that of their keys, written in their order
+template<class A, class T, class C>
+static void transfer_ordered(A& ar, C& container) {
+	std::vector<T> list;
+	if(!A::reading)
+		list.assign(container.begin(), container.end());
+	ar.io(list);
+	if(A::reading) {
+		container.clear();
+		container.insert(list.begin(), list.end());
+	}
+}
+template<class A>
+static void transfer_effects(A& ar, card* pcard, card::effect_container& container) {
+	std::vector<std::pair<uint32, effect*> > list;
+	if(!A::reading)
+		list.assign(container.begin(), container.end());
+	ar.io(list);
+	if(A::reading) {
+		container.clear();
+		for(auto it = list.begin(); it != list.end(); ++it)
+			pcard->indexer[it->second] = container.insert(*it);
+	}
+}
+template<class A>
+static void transfer_index(A& ar, effect_index& index) {
+	std::vector<effect*> list;
+	if(!A::reading)
+		index.collect(&list);
+	ar.io(list);
+	if(A::reading)
+		for(auto it = list.begin(); it != list.end(); ++it)
+			if(*it)
+				index.insert(*it);
+}
+// the values of a card, its sets are written after all cards have their cardid
+template<class A>
+static void transfer_card(A& ar, card* pcard) {
+	ar.io(pcard->ref_handle);
+	ar.io(pcard->data);
+	ar.io(pcard->previous);
+	ar.io(pcard->temp);
+	ar.io(pcard->current);
+	ar.io(pcard->q_cache);
+	ar.io(pcard->owner);
+	ar.io(pcard->summon_player);
+	ar.io(pcard->summon_type);
+	ar.io(pcard->status);
+	ar.io(pcard->operation_param);
+	ar.io(pcard->announce_count);
+	ar.io(pcard->attacked_count);
+	ar.io(pcard->attack_all_target);
+	ar.io(pcard->cardid);
+	ar.io(pcard->fieldid);
+	ar.io(pcard->fieldid_r);
+	ar.io(pcard->turnid);
+	ar.io(pcard->turn_counter);
+	ar.io(pcard->unique_pos);
+	ar.io(pcard->unique_uid);
+	ar.io(pcard->unique_code);
+	ar.io(pcard->assume_type);
+	ar.io(pcard->assume_value);
+	ar.io(pcard->unique_effect);
+	ar.io(pcard->equiping_target);
+	ar.io(pcard->pre_equip_target);
+	ar.io(pcard->overlay_target);
+}
+template<class A>
+static void transfer_card_sets(A& ar, card* pcard) {
+	ar.io(pcard->relations);
+	ar.io(pcard->counters);
+	ar.io(pcard->announced_cards);
+	ar.io(pcard->attacked_cards);
+	ar.io(pcard->battled_cards);
+	ar.io(pcard->equiping_cards);
+	ar.io(pcard->material_cards);
+	ar.io(pcard->effect_target_owner);
+	ar.io(pcard->effect_target_cards);
+	ar.io(pcard->xyz_materials);
+	if(A::reading)
+		pcard->indexer.clear();
+	transfer_effects(ar, pcard, pcard->single_effect);
+	transfer_effects(ar, pcard, pcard->field_effect);
+	transfer_effects(ar, pcard, pcard->equip_effect);
+	ar.io(pcard->relate_effect);
+	ar.io(pcard->immune_effect);
+}
+template<class A>
+static void transfer_group(A& ar, group* pgroup) {
+	ar.io(pgroup->ref_handle);
+	ar.io(pgroup->container);
+	ar.io(pgroup->is_readonly);
+	// the iterator of GetFirst and GetNext, by its card
+	card* current = 0;
+	if(!A::reading && pgroup->it != pgroup->container.end())
+		current = *pgroup->it;
+	ar.io(current);
+	if(A::reading)
+		pgroup->it = current ? pgroup->container.find(current) : pgroup->container.end();
+}
+template<class A>
+static void transfer_effect(A& ar, effect* peffect) {
+	ar.io(peffect->ref_handle);
+	ar.io(peffect->owner);
+	ar.io(peffect->handler);
+	ar.io(peffect->effect_owner);
+	ar.io(peffect->description);
+	ar.io(peffect->code);
+	ar.io(peffect->flag);
+	ar.io(peffect->id);
+	ar.io(peffect->type);
+	ar.io(peffect->copy_id);
+	ar.io(peffect->range);
+	ar.io(peffect->s_range);
+	ar.io(peffect->o_range);
+	ar.io(peffect->reset_count);
+	ar.io(peffect->reset_flag);
+	ar.io(peffect->count_code);
+	ar.io(peffect->category);
+	ar.io(peffect->label);
+	ar.io(peffect->hint_timing);
+	ar.io(peffect->card_type);
+	ar.io(peffect->active_type);
+	ar.io(peffect->field_ref);
+	ar.io(peffect->status);
+	ar.io(peffect->label_object);
+	// the functions are references of the registry, which keep their numbers
+	ar.io(peffect->condition);
+	ar.io(peffect->cost);
+	ar.io(peffect->target);
+	ar.io(peffect->value);
+	ar.io(peffect->operation);
+}
+template<class A>
+static void transfer_field(A& ar, field* pfield) {
+	for(int32 p = 0; p < 2; ++p) {
+		player_info& info = pfield->player[p];
+		ar.io(info.lp);
+		ar.io(info.start_count);
+		ar.io(info.draw_count);
+		ar.io(info.used_location);
+		ar.io(info.disabled_location);
+		ar.io(info.list_mzone);
+		ar.io(info.list_szone);
+		ar.io(info.list_main);
+		ar.io(info.list_grave);
+		ar.io(info.list_hand);
+		ar.io(info.list_remove);
+		ar.io(info.list_extra);
+		ar.io(info.tag_list_main);
+		ar.io(info.tag_list_hand);
+		ar.io(info.tag_list_extra);
+	}
+	ar.io(pfield->temp_card);
+	ar.io(pfield->infos);
+	ar.io(pfield->cost);
+	field_effect& effects = pfield->effects;
+	transfer_index(ar, effects.aura_effect);
+	transfer_index(ar, effects.ignition_effect);
+	transfer_index(ar, effects.activate_effect);
+	transfer_index(ar, effects.trigger_o_effect);
+	transfer_index(ar, effects.trigger_f_effect);
+	transfer_index(ar, effects.quick_o_effect);
+	transfer_index(ar, effects.quick_f_effect);
+	transfer_index(ar, effects.continuous_effect);
+	ar.io(effects.indexer);
+	ar.io(effects.oath);
+	ar.io(effects.pheff);
+	ar.io(effects.cheff);
+	ar.io(effects.rechargeable);
+	ar.io(effects.version);
+	ar.io(effects.disable_check_list);
+	ar.io(effects.disable_check_set);
+	processor& core = pfield->core;
+	// the units by depth, the running unit last
+	std::vector<processor_unit> units;
+	if(!A::reading)
+		for(uint32 i = 0; i < core.units.size(); ++i)
+			units.push_back(core.units.at_depth(i));
+	ar.io(units);
+	if(A::reading) {
+		std::reverse(units.begin(), units.end());
+		core.units.push_front(units);
+	}
+	ar.io(core.subunits);
+	ar.io(core.reserved);
+	ar.io(core.select_cards);
+	ar.io(core.summonable_cards);
+	ar.io(core.spsummonable_cards);
+	ar.io(core.repositionable_cards);
+	ar.io(core.msetable_cards);
+	ar.io(core.ssetable_cards);
+	ar.io(core.attackable_cards);
+	ar.io(core.select_effects);
+	ar.io(core.select_options);
+	ar.io(core.point_event);
+	ar.io(core.instant_event);
+	ar.io(core.queue_event);
+	ar.io(core.used_event);
+	ar.io(core.single_event);
+	ar.io(core.solving_event);
+	ar.io(core.sub_solving_event);
+	ar.io(core.select_chains);
+	ar.io(core.current_chain);
+	ar.io(core.tpchain);
+	ar.io(core.ntpchain);
+	ar.io(core.continuous_chain);
+	ar.io(core.desrep_chain);
+	ar.io(core.new_fchain);
+	ar.io(core.new_fchain_s);
+	ar.io(core.new_ochain);
+	ar.io(core.new_ochain_s);
+	ar.io(core.new_fchain_b);
+	ar.io(core.new_ochain_b);
+	ar.io(core.new_ochain_h);
+	ar.io(core.new_chains);
+	ar.io(core.delayed_quick_tmp);
+	ar.io(core.delayed_quick_break);
+	ar.io(core.delayed_quick);
+	ar.io(core.quick_f_chain);
+	ar.io(core.leave_confirmed);
+	ar.io(core.special_summoning);
+	ar.io(core.equiping_cards);
+	ar.io(core.control_adjust_set[0]);
+	ar.io(core.control_adjust_set[1]);
+	ar.io(core.release_cards);
+	ar.io(core.release_cards_ex);
+	ar.io(core.release_cards_ex_sum);
+	ar.io(core.destroy_set);
+	ar.io(core.battle_destroy_rep);
+	ar.io(core.fusion_materials);
+	ar.io(core.synchro_materials);
+	ar.io(core.operated_set);
+	ar.io(core.discarded_set);
+	ar.io(core.destroy_canceled);
+	ar.io(core.delayed_enable_set);
+	for(int32 p = 0; p < 2; ++p) {
+		ar.io(core.summoned_cards_pt[p]);
+		ar.io(core.normalsummoned_cards_pt[p]);
+		ar.io(core.spsummoned_cards_pt[p]);
+		ar.io(core.flipsummoned_cards_pt[p]);
+	}
+	ar.io(core.disfield_effects);
+	ar.io(core.extraz_effects);
+	ar.io(core.extraz_effects_e);
+	ar.io(core.reseted_effects);
+	ar.io(core.delayed_tp);
+	ar.io(core.delayed_ntp);
+	ar.io(core.delayed_tev);
+	ar.io(core.delayed_ntev);
+	ar.io(core.readjust_map);
+	ar.io(core.unique_cards[0]);
+	ar.io(core.unique_cards[1]);
+	ar.io(core.effect_count_code);
+	ar.io(core.effect_count_code_duel);
+	transfer_ordered<A, std::pair<int32, card*> >(ar, core.xmaterial_lst);
+	for(int32 i = 0; i < 4; ++i)
+		ar.word(core.temp_var[i]);
+	ar.io(core.global_flag);
+	ar.io(core.pre_field);
+	ar.io(core.opp_mzone);
+	ar.io(core.chain_limit);
+	ar.io(core.chain_limp);
+	ar.io(core.chain_limit_p);
+	ar.io(core.chain_limp_p);
+	ar.io(core.chain_solving);
+	ar.io(core.win_player);
+	ar.io(core.win_reason);
+	ar.io(core.re_adjust);
+	ar.io(core.reason_effect);
+	ar.io(core.reason_player);
+	ar.io(core.summoning_card);
+	ar.io(core.summon_depth);
+	ar.io(core.attacker);
+	ar.io(core.sub_attacker);
+	ar.io(core.attack_target);
+	ar.io(core.sub_attack_target);
+	ar.io(core.limit_tuner);
+	ar.io(core.limit_xyz);
+	ar.io(core.limit_syn);
+	ar.io(core.attack_cancelable);
+	ar.io(core.effect_damage_step);
+	ar.io(core.battle_damage);
+	ar.io(core.summon_count);
+	ar.io(core.extra_summon);
+	ar.io(core.spe_effect);
+	ar.io(core.duel_options);
+	ar.io(core.copy_reset);
+	ar.io(core.copy_reset_count);
+	ar.io(core.dice_result);
+	ar.io(core.coin_result);
+	ar.io(core.to_bp);
+	ar.io(core.to_m2);
+	ar.io(core.to_ep);
+	ar.io(core.skip_m2);
+	ar.io(core.chain_attack);
+	ar.io(core.chain_attack_target);
+	ar.io(core.selfdes_disabled);
+	ar.io(core.overdraw);
+	ar.io(core.check_level);
+	ar.io(core.shuffle_check_disabled);
+	ar.io(core.shuffle_hand_check);
+	ar.io(core.shuffle_deck_check);
+	ar.io(core.deck_reversed);
+	ar.io(core.remove_brainwashing);
+	ar.io(core.flip_delayed);
+	ar.io(core.damage_calculated);
+	ar.io(core.summon_state);
+	ar.io(core.normalsummon_state);
+	ar.io(core.flipsummon_state);
+	ar.io(core.spsummon_state);
+	ar.io(core.attack_state);
+	ar.io(core.phase_action);
+	ar.io(core.hint_timing);
+	ar.io(pfield->returns);
+	ar.io(pfield->nil_event);
+}
+// everything but the Lua side, the objects are allocated and numbered
+template<class A>
+static void transfer_duel(A& ar, duel* pduel, std::vector<card*>& cards, std::vector<group*>& groups, std::vector<effect*>& effects) {
+	for(uint32 i = 0; i < cards.size(); ++i)
+		transfer_card(ar, cards[i]);
+	for(uint32 i = 0; i < cards.size(); ++i)
+		transfer_card_sets(ar, cards[i]);
+	for(uint32 i = 0; i < groups.size(); ++i)
+		transfer_group(ar, groups[i]);
+	for(uint32 i = 0; i < effects.size(); ++i)
+		transfer_effect(ar, effects[i]);
+	transfer_field(ar, pduel->game_field);
+	ar.io(pduel->assumes);
+	ar.io(pduel->sgroups);
+	ar.io(pduel->uncopy);
+	std::vector<byte> messages;
+	if(!A::reading)
+		messages.assign(pduel->buffer.begin(), pduel->buffer.begin() + pduel->bufferlen);
+	ar.io(messages);
+	if(A::reading) {
+		pduel->clear_buffer();
+		if(messages.size())
+			pduel->write_buffer(&messages[0], messages.size());
+	}
+	uint32 random[mtrandom::STATE_SIZE];
+	if(!A::reading)
+		pduel->random.save_state(random);
+	ar.io(random);
+	if(A::reading)
+		pduel->random.load_state(random);
+}
+
+/*
+ * The references of the registry, the numbers above those of the main thread, the globals
+ * and the duel (1 to 3), and 0, the first free reference; then the global table.
+ */
+int32 state_writer::write_lua() {
+	int32 top = lua_gettop(L);
+	lua_newtable(L);
+	seen = lua_gettop(L);
+	lua_getfield(L, LUA_REGISTRYINDEX, "permanents");
+	permanents = lua_gettop(L);
+	std::vector<int32> keys;
+	lua_pushnil(L);
+	while(lua_next(L, LUA_REGISTRYINDEX)) {
+		lua_pop(L, 1);
+		if(lua_type(L, -1) == LUA_TNUMBER) {
+			int32 ref = lua_tointeger(L, -1);
+			if(ref == 0 || ref > 3)
+				keys.push_back(ref);
+		}
+	}
+	std::sort(keys.begin(), keys.end());
+	uint32 count = keys.size();
+	io(count);
+	int32 result = TRUE;
+	for(uint32 i = 0; result && i < count; ++i) {
+		io(keys[i]);
+		lua_rawgeti(L, LUA_REGISTRYINDEX, keys[i]);
+		result = write_value(lua_gettop(L));
+		lua_pop(L, 1);
+	}
+	if(result) {
+		lua_pushglobaltable(L);
+		result = write_value(lua_gettop(L));
+	}
+	lua_settop(L, top);
+	return result;
+}
+int32 state_writer::write_value(int32 index) {
+	uint8 tag;
+	switch(lua_type(L, index)) {
+	case LUA_TNIL:
+		tag = STATE_NIL;
+		io(tag);
+		return TRUE;
+	case LUA_TBOOLEAN:
+		tag = lua_toboolean(L, index) ? STATE_TRUE : STATE_FALSE;
+		io(tag);
+		return TRUE;
+	case LUA_TNUMBER: {
+		lua_Number value = lua_tonumber(L, index);
+		tag = STATE_NUMBER;
+		io(tag);
+		io(value);
+		return TRUE;
+	}
+	case LUA_TSTRING: {
+		size_t len;
+		const char* s = lua_tolstring(L, index, &len);
+		tag = STATE_STRING;
+		io(tag);
+		write_string(s, len);
+		return TRUE;
+	}
+	case LUA_TTABLE:
+	case LUA_TFUNCTION:
+	case LUA_TUSERDATA:
+		break;
+	default:
+		// threads and light userdata
+		return FALSE;
+	}
+	if(!lua_checkstack(L, 8))
+		return FALSE;
+	lua_pushvalue(L, index);
+	lua_rawget(L, seen);
+	if(!lua_isnil(L, -1)) {
+		uint32 ref = lua_tointeger(L, -1);
+		lua_pop(L, 1);
+		tag = STATE_REFERENCE;
+		io(tag);
+		io(ref);
+		return TRUE;
+	}
+	lua_pop(L, 1);
+	uint32 ref = ++refs;
+	lua_pushvalue(L, index);
+	lua_pushinteger(L, ref);
+	lua_rawset(L, seen);
+	lua_pushvalue(L, index);
+	lua_rawget(L, permanents);
+	if(lua_type(L, -1) == LUA_TSTRING) {
+		size_t len;
+		const char* name = lua_tolstring(L, -1, &len);
+		tag = STATE_PERMANENT;
+		io(tag);
+		write_string(name, len);
+		lua_pop(L, 1);
+		if(lua_istable(L, index))
+			return write_table(index);
+		if(lua_isfunction(L, index))
+			return write_upvalues(index, ref);
+		return TRUE;
+	}
+	lua_pop(L, 1);
+	if(lua_istable(L, index)) {
+		tag = STATE_TABLE;
+		io(tag);
+		return write_table(index);
+	}
+	if(lua_isfunction(L, index)) {
+		// a C function that is not one of the libraries
+		if(lua_iscfunction(L, index))
+			return FALSE;
+		std::vector<byte> bytecode;
+		lua_pushvalue(L, index);
+		int32 error = lua_dump(L, state_dump_writer, &bytecode);
+		lua_pop(L, 1);
+		if(error || bytecode.empty())
+			return FALSE;
+		tag = STATE_FUNCTION;
+		io(tag);
+		uint32 len = bytecode.size();
+		io(len);
+		bytes(&bytecode[0], len);
+		return write_upvalues(index, ref);
+	}
+	void* ud = lua_touserdata(L, index);
+	size_t len = lua_rawlen(L, index);
+	if(len == sizeof(void*)) {
+		// an object freed while the scripts still hold it is read back as a userdata of nothing
+		id_map::iterator it = ids.find(*(void**)ud);
+		uint8 kind = it == ids.end() ? STATE_WORD : it->second.first;
+		uint32 number = it == ids.end() ? 0 : it->second.second;
+		tag = STATE_OBJECT;
+		io(tag);
+		io(kind);
+		io(number);
+	} else if(len == sizeof(card_filter*) + sizeof(card_filter)) {
+		card_filter filter = **(card_filter**)ud;
+		tag = STATE_FILTER;
+		io(tag);
+		io(filter);
+	} else
+		return FALSE;
+	return write_metatable(index);
+}
+int32 state_writer::write_table(int32 index) {
+	lua_pushnil(L);
+	while(lua_next(L, index)) {
+		int32 top = lua_gettop(L);
+		if(!write_value(top - 1) || !write_value(top)) {
+			lua_pop(L, 2);
+			return FALSE;
+		}
+		lua_pop(L, 1);
+	}
+	uint8 tag = STATE_NIL;
+	io(tag);
+	return write_metatable(index);
+}
+int32 state_writer::write_metatable(int32 index) {
+	if(!lua_getmetatable(L, index))
+		lua_pushnil(L);
+	int32 result = write_value(lua_gettop(L));
+	lua_pop(L, 1);
+	return result;
+}
+// an upvalue of a Lua function that an earlier function shares is written as that function and index
+int32 state_writer::write_upvalues(int32 index, uint32 ref) {
+	lua_Debug ar;
+	lua_pushvalue(L, index);
+	lua_getinfo(L, ">u", &ar);
+	uint8 count = ar.nups;
+	io(count);
+	int32 is_lua = !lua_iscfunction(L, index);
+	for(int32 i = 1; i <= count; ++i) {
+		if(is_lua) {
+			void* id = lua_upvalueid(L, index, i);
+			upvalue_map::iterator it = upvalues.find(id);
+			if(it != upvalues.end()) {
+				uint8 tag = STATE_SHARED;
+				io(tag);
+				io(it->second.first);
+				io(it->second.second);
+				continue;
+			}
+			upvalues[id] = std::make_pair(ref, (uint8)i);
+		}
+		lua_getupvalue(L, index, i);
+		int32 result = write_value(lua_gettop(L));
+		lua_pop(L, 1);
+		if(!result)
+			return FALSE;
+	}
+	return TRUE;
+}
+
+int32 state_reader::read_lua() {
+	int32 top = lua_gettop(L);
+	lua_newtable(L);
+	names = lua_gettop(L);
+	lua_getfield(L, LUA_REGISTRYINDEX, "permanents");
+	lua_pushnil(L);
+	while(lua_next(L, -2)) {
+		lua_pushvalue(L, -2);
+		lua_rawset(L, names);
+	}
+	lua_pop(L, 1);
+	lua_newtable(L);
+	references = lua_gettop(L);
+	// the references of the new duel are dropped, as in interpreter::reset_state()
+	lua_pushnil(L);
+	while(lua_next(L, LUA_REGISTRYINDEX)) {
+		lua_pop(L, 1);
+		if(lua_type(L, -1) == LUA_TNUMBER) {
+			int32 ref = lua_tointeger(L, -1);
+			if(ref == 0 || ref > 3) {
+				lua_pushvalue(L, -1);
+				lua_pushnil(L);
+				lua_rawset(L, LUA_REGISTRYINDEX);
+			}
+		}
+	}
+	uint32 size = count();
+	int32 result = !failed;
+	for(uint32 i = 0; result && i < size; ++i) {
+		int32 ref = 0;
+		io(ref);
+		result = !failed && (ref == 0 || ref > 3) && read_value();
+		if(result)
+			lua_rawseti(L, LUA_REGISTRYINDEX, ref);
+	}
+	if(result)
+		result = read_value();
+	lua_settop(L, top);
+	lua_gc(L, LUA_GCCOLLECT, 0);
+	return result && !failed;
+}
+// pushes the value read, nothing is pushed when it fails
+int32 state_reader::read_value() {
+	if(!lua_checkstack(L, 8))
+		return FALSE;
+	uint8 tag = STATE_NIL;
+	io(tag);
+	if(failed)
+		return FALSE;
+	switch(tag) {
+	case STATE_NIL:
+		lua_pushnil(L);
+		return TRUE;
+	case STATE_FALSE:
+	case STATE_TRUE:
+		lua_pushboolean(L, tag == STATE_TRUE);
+		return TRUE;
+	case STATE_NUMBER: {
+		lua_Number value = 0;
+		io(value);
+		lua_pushnumber(L, value);
+		return !failed;
+	}
+	case STATE_STRING: {
+		uint32 len = count();
+		if(failed)
+			return FALSE;
+		lua_pushlstring(L, (const char*)pos, len);
+		pos += len;
+		return TRUE;
+	}
+	case STATE_REFERENCE: {
+		uint32 ref = 0;
+		io(ref);
+		if(failed || !ref || ref > refs)
+			return FALSE;
+		lua_rawgeti(L, references, ref);
+		return TRUE;
+	}
+	case STATE_TABLE: {
+		lua_newtable(L);
+		add_reference();
+		if(read_table(lua_gettop(L)))
+			return TRUE;
+		lua_pop(L, 1);
+		return FALSE;
+	}
+	case STATE_PERMANENT: {
+		uint32 len = count();
+		if(failed)
+			return FALSE;
+		lua_pushlstring(L, (const char*)pos, len);
+		pos += len;
+		lua_rawget(L, names);
+		int32 index = lua_gettop(L);
+		int32 result = FALSE;
+		if(lua_istable(L, index)) {
+			add_reference();
+			// the contents are replaced by those of the saved table
+			lua_pushnil(L);
+			while(lua_next(L, index)) {
+				lua_pop(L, 1);
+				lua_pushvalue(L, -1);
+				lua_pushnil(L);
+				lua_rawset(L, index);
+			}
+			result = read_table(index);
+		} else if(lua_isfunction(L, index)) {
+			add_reference();
+			result = read_upvalues(index);
+		} else if(lua_isuserdata(L, index)) {
+			add_reference();
+			result = TRUE;
+		}
+		if(!result)
+			lua_pop(L, 1);
+		return result;
+	}
+	case STATE_FUNCTION: {
+		uint32 len = count();
+		if(failed || luaL_loadbufferx(L, (const char*)pos, len, "=state", "b") != LUA_OK)
+			return FALSE;
+		pos += len;
+		add_reference();
+		if(read_upvalues(lua_gettop(L)))
+			return TRUE;
+		lua_pop(L, 1);
+		return FALSE;
+	}
+	case STATE_OBJECT: {
+		uint8 kind = STATE_WORD;
+		uint32 number = 0;
+		io(kind);
+		io(number);
+		void* pobject = 0;
+		if(kind == STATE_CARD && number < cards.size())
+			pobject = cards[number];
+		else if(kind == STATE_GROUP && number < groups.size())
+			pobject = groups[number];
+		else if(kind == STATE_EFFECT && number < effects.size())
+			pobject = effects[number];
+		else if(kind != STATE_WORD)
+			failed = true;
+		if(failed)
+			return FALSE;
+		*(void**)lua_newuserdata(L, sizeof(void*)) = pobject;
+		add_reference();
+		if(read_metatable(lua_gettop(L)))
+			return TRUE;
+		lua_pop(L, 1);
+		return FALSE;
+	}
+	case STATE_FILTER: {
+		card_filter** pp = (card_filter**)lua_newuserdata(L, sizeof(card_filter*) + sizeof(card_filter));
+		card_filter* pfilter = new (pp + 1) card_filter();
+		*pp = pfilter;
+		io(*pfilter);
+		add_reference();
+		if(!failed && read_metatable(lua_gettop(L)))
+			return TRUE;
+		lua_pop(L, 1);
+		return FALSE;
+	}
+	}
+	return FALSE;
+}
+int32 state_reader::read_table(int32 index) {
+	while(true) {
+		if(!read_value())
+			return FALSE;
+		if(lua_isnil(L, -1)) {
+			lua_pop(L, 1);
+			break;
+		}
+		if(!read_value()) {
+			lua_pop(L, 1);
+			return FALSE;
+		}
+		lua_rawset(L, index);
+	}
+	return read_metatable(index);
+}
+int32 state_reader::read_metatable(int32 index) {
+	if(!read_value())
+		return FALSE;
+	if(!lua_isnil(L, -1) && !lua_istable(L, -1)) {
+		lua_pop(L, 1);
+		return FALSE;
+	}
+	lua_setmetatable(L, index);
+	return TRUE;
+}
+int32 state_reader::read_upvalues(int32 index) {
+	uint8 count = 0;
+	io(count);
+	lua_Debug ar;
+	lua_pushvalue(L, index);
+	lua_getinfo(L, ">u", &ar);
+	if(failed || count != ar.nups)
+		return FALSE;
+	int32 is_lua = !lua_iscfunction(L, index);
+	for(int32 i = 1; i <= count; ++i) {
+		if(is_lua && pos < end && *pos == STATE_SHARED) {
+			uint32 ref = 0;
+			uint8 n = 0;
+			pos++;
+			io(ref);
+			io(n);
+			if(failed || !ref || ref > refs)
+				return FALSE;
+			lua_rawgeti(L, references, ref);
+			lua_Debug shared;
+			lua_pushvalue(L, -1);
+			lua_getinfo(L, ">u", &shared);
+			if(!lua_isfunction(L, -1) || lua_iscfunction(L, -1) || !n || n > shared.nups) {
+				lua_pop(L, 1);
+				return FALSE;
+			}
+			lua_upvaluejoin(L, index, i, lua_gettop(L), n);
+			lua_pop(L, 1);
+			continue;
+		}
+		if(!read_value())
+			return FALSE;
+		if(!lua_setupvalue(L, index, i)) {
+			lua_pop(L, 1);
+			return FALSE;
+		}
+	}
+	return TRUE;
+}
+
+/*
+ * Writes the state of the duel, fails while a script is running or waits in a coroutine,
+ * or if the scripts hold a value that cannot be saved: a coroutine, a light userdata
+ * or a C function that is not in the libraries.
+ */
+int32 duel_state::save(duel* pduel, std::vector<byte>* data) {
+	interpreter* lua = pduel->lua;
+	if(lua->call_depth || !lua->coroutines.empty())
+		return FALSE;
+	data->clear();
+	state_writer writer(pduel, data);
+	uint32 header[2] = { DUEL_STATE_MAGIC, DUEL_STATE_VERSION };
+	writer.io(header);
+	std::vector<card*> cards(pduel->cards.begin(), pduel->cards.end());
+	std::vector<group*> groups(pduel->groups.begin(), pduel->groups.end());
+	std::vector<effect*> effects(pduel->effects.begin(), pduel->effects.end());
+	// numbered by address, the loaded objects are allocated in this order so that the sets
+	// ordered by pointer keep their order as far as the slabs of the pools allow
+	std::sort(cards.begin(), cards.end());
+	std::sort(groups.begin(), groups.end());
+	std::sort(effects.begin(), effects.end());
+	for(uint32 i = 0; i < cards.size(); ++i)
+		writer.ids[cards[i]] = std::make_pair((uint8)STATE_CARD, i);
+	for(uint32 i = 0; i < groups.size(); ++i)
+		writer.ids[groups[i]] = std::make_pair((uint8)STATE_GROUP, i);
+	for(uint32 i = 0; i < effects.size(); ++i)
+		writer.ids[effects[i]] = std::make_pair((uint8)STATE_EFFECT, i);
+	uint32 counts[3] = { (uint32)cards.size(), (uint32)groups.size(), (uint32)effects.size() };
+	writer.io(counts);
+	transfer_duel(writer, pduel, cards, groups, effects);
+	return writer.write_lua();
+}
+/*
+ * Reads a state into a new duel, replacing its objects, its field and the references and globals of its scripts.
+ * The duel cannot be used if it fails.
+ */
+int32 duel_state::load(duel* pduel, const byte* data, int32 len) {
+	state_reader reader(pduel, data, len);
+	uint32 header[2];
+	uint32 counts[3];
+	reader.io(header);
+	reader.io(counts);
+	if(reader.failed || header[0] != DUEL_STATE_MAGIC || header[1] != DUEL_STATE_VERSION
+	        || (uint64)counts[0] + counts[1] + counts[2] > (uint64)len)
+		return FALSE;
+	pduel->cards.clear();
+	pduel->groups.clear();
+	pduel->effects.clear();
+	for(uint32 i = 0; i < counts[0]; ++i) {
+		card* pcard = pduel->cards.alloc();
+		pcard->pduel = pduel;
+		reader.cards.push_back(pcard);
+	}
+	for(uint32 i = 0; i < counts[1]; ++i) {
+		group* pgroup = pduel->groups.alloc();
+		pgroup->pduel = pduel;
+		reader.groups.push_back(pgroup);
+	}
+	for(uint32 i = 0; i < counts[2]; ++i) {
+		effect* peffect = pduel->effects.alloc();
+		peffect->pduel = pduel;
+		reader.effects.push_back(peffect);
+	}
+	transfer_duel(reader, pduel, reader.cards, reader.groups, reader.effects);
+	if(reader.failed || !reader.read_lua() || reader.pos != reader.end) {
+		// the references and globals may be half replaced
+		pduel->lua->reusable = FALSE;
+		return FALSE;
+	}
+	return TRUE;
+}
@@ -0,0 +1,31 @@
+/*
+ * duelstate.h
+ * The snapshot of a duel written by save_duel_state(...) and read by load_duel_state(...) of ocgapi.
+ * Cards, groups and effects are numbered by their place in the pools of the duel, a pointer to one
+ * of them is written as its number, also when the processor keeps it in an integer.
+ * The Lua side is the references in the registry, which keep their numbers so that the handles
+ * held by cards and effects stay valid, and the global table. Tables, functions with their upvalues
+ * and the userdata of the script objects are written once and referred to afterwards, the functions
+ * as bytecode. The tables and functions that exist when an interpreter is created are written by
+ * name, see interpreter::name_permanents(), with their contents or upvalues.
+ * A duel can only be saved while no script waits in a coroutine.
+ */
+
+#ifndef DUELSTATE_H_
+#define DUELSTATE_H_
+
+#include "common.h"
+#include <vector>
+
+class duel;
+
+#define DUEL_STATE_MAGIC		0x74736779	//"ygst"
+#define DUEL_STATE_VERSION		2
+
+class duel_state {
+public:
+	static int32 save(duel* pduel, std::vector<byte>* data);
+	static int32 load(duel* pduel, const byte* data, int32 len);
+};
+
+#endif /* DUELSTATE_H_ */
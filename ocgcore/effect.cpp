@@ -50,6 +50,8 @@ effect::effect() {
 	hint_timing[1] = 0;
 	field_ref = 0;
 	status = 0;
+	index_list = 0;
+	index_slot = 0;
 	condition = 0;
 	cost = 0;
 	target = 0;
@@ -54,6 +54,8 @@ public:
 	uint32 active_type; // maybe one of the EFFECT_TYPE_constants below ?
 	uint16 field_ref; // ?
 	uint16 status; // maybe one of the 3 status constants below or one from STATUS_effects in card.h ?
+	effect_list* index_list; // the list of field_effect this effect is stored in, see effectindex.h
+	uint32 index_slot;
 	void* label_object; // ?
 	int32 condition; // condition for the effect to work ?
 	int32 cost; // ?
@@ -0,0 +1,59 @@
+/*
+ * effectindex.cpp
+ */
+
+#include "effectindex.h"
+#include "effect.h"
+#include <algorithm>
+
+void effect_index::insert(effect* peffect) {
+	effect_list& list = lists[peffect->code];
+	peffect->index_list = &list;
+	peffect->index_slot = list.entries.size();
+	list.entries.push_back(std::make_pair(peffect->code, peffect));
+}
+void effect_index::erase(effect* peffect) {
+	effect_list* list = peffect->index_list;
+	if(!list)
+		return;
+	list->entries[peffect->index_slot].second = 0;
+	if(list->holes++ == 0)
+		dirty.push_back(list);
+	peffect->index_list = 0;
+}
+std::pair<effect_index::iterator, effect_index::iterator> effect_index::equal_range(uint32 code) {
+	auto lit = lists.find(code);
+	if(lit == lists.end())
+		return std::make_pair(iterator(), iterator());
+	return std::make_pair(iterator(&lit->second, 0), iterator());
+}
+// all effects ordered by code, then by the order they were added
+void effect_index::collect(std::vector<effect*>* result) {
+	std::vector<uint32> codes;
+	for(auto lit = lists.begin(); lit != lists.end(); ++lit)
+		codes.push_back(lit->first);
+	std::sort(codes.begin(), codes.end());
+	for(auto cit = codes.begin(); cit != codes.end(); ++cit) {
+		effect_list& list = lists[*cit];
+		for(auto eit = list.entries.begin(); eit != list.entries.end(); ++eit)
+			if(eit->second)
+				result->push_back(eit->second);
+	}
+}
+// removes the cleared entries, the effects after them move to a lower slot
+void effect_index::compact() {
+	for(auto dit = dirty.begin(); dit != dirty.end(); ++dit) {
+		effect_list* list = *dit;
+		uint32 count = 0;
+		for(uint32 i = 0; i < list->entries.size(); ++i) {
+			effect* peffect = list->entries[i].second;
+			if(!peffect)
+				continue;
+			peffect->index_slot = count;
+			list->entries[count++] = list->entries[i];
+		}
+		list->entries.resize(count);
+		list->holes = 0;
+	}
+	dirty.clear();
+}
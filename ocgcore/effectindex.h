@@ -0,0 +1,84 @@
+/*
+ * effectindex.h
+ * The field effects of one kind, looked up by effect code.
+ * Each code has a contiguous list of its effects in the order they were added.
+ * An effect keeps the list and slot it is stored in, so it is removed without
+ * a search; the slot is cleared and the list compacted later, at a point where
+ * no iteration over it can be in progress (see field::process).
+ */
+
+#ifndef EFFECTINDEX_H_
+#define EFFECTINDEX_H_
+
+#include "common.h"
+#include <vector>
+#include <unordered_map>
+#include <utility>
+
+class effect;
+
+struct effect_list {
+	typedef std::pair<uint32, effect*> entry;
+	std::vector<entry> entries; // removed effects leave an entry with no effect
+	uint32 holes;
+	effect_list(): holes(0) {}
+};
+
+class effect_index {
+public:
+	// walks one list and skips removed entries; entries added during the walk are visited too
+	class iterator {
+	public:
+		iterator(): list(0), index(0) {}
+		iterator(effect_list* l, uint32 i): list(l), index(i) {}
+		effect_list::entry& operator*() const {
+			return list->entries[index];
+		}
+		effect_list::entry* operator->() const {
+			return &list->entries[index];
+		}
+		iterator& operator++() {
+			++index;
+			return *this;
+		}
+		iterator operator++(int) {
+			skip();
+			iterator it = *this;
+			++index;
+			return it;
+		}
+		// the comparison skips removed entries, an effect may be removed after the iterator passed to it
+		bool operator==(const iterator& it) const {
+			skip();
+			it.skip();
+			if(is_end() || it.is_end())
+				return is_end() && it.is_end();
+			return list == it.list && index == it.index;
+		}
+		bool operator!=(const iterator& it) const {
+			return !(*this == it);
+		}
+	private:
+		bool is_end() const {
+			return !list || index >= list->entries.size();
+		}
+		void skip() const {
+			while(!is_end() && !list->entries[index].second)
+				++index;
+		}
+		effect_list* list;
+		mutable uint32 index;
+	};
+
+	void insert(effect* peffect);
+	void erase(effect* peffect);
+	std::pair<iterator, iterator> equal_range(uint32 code);
+	void collect(std::vector<effect*>* result);
+	void compact();
+
+private:
+	std::unordered_map<uint32, effect_list> lists; // nodes never move, effects keep pointers to their list
+	std::vector<effect_list*> dirty; // lists with removed entries
+};
+
+#endif /* EFFECTINDEX_H_ */
@@ -12,12 +12,13 @@
 #include "group.h"
 #include "effect.h"
 #include "interpreter.h"
+#include "sumcheck.h"
 #include <iostream>
 #include <cstring>
 #include <map>
 
 // I don't even ?
-int32 field::field_used_count[32] = {0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4, 1, 2, 2, 3, 2, 3, 3, 4, 2, 3, 3, 4, 3, 4, 4, 5}; 
+const int32 field::field_used_count[32] = {0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4, 1, 2, 2, 3, 2, 3, 3, 4, 2, 3, 3, 4, 3, 4, 4, 5}; 
 
 /*
  * A comparator for chain operations, sorted by the ID of the effect that triggered the respective chain elements
@@ -44,6 +45,7 @@ field::field(duel* pduel) {
 	infos.turn_id = 0;
 	infos.field_id = 1;
 	infos.card_id = 1;
+	effects.version = 1;
 	for (int i = 0; i < 2; ++i) {
 		cost[i].count = 0;
 		cost[i].amount = 0;
@@ -77,6 +79,7 @@ field::field(duel* pduel) {
 	core.pre_field[1] = 0;
 	for (int i = 0; i < 5; ++i)
 		core.opp_mzone[i] = 0;
+	core.steps = 0;
 	core.summoning_card = 0;
 	core.summon_depth = 0;
 	core.chain_limit = 0;
@@ -821,27 +824,27 @@ void field::add_effect(effect* peffect, uint8 owner_player) {
 		peffect->id = infos.field_id++; // which gets it's own field id
 	}
 	peffect->card_type = peffect->owner->data.type;
-	effect_container::iterator it;
 	// add it to the right effect type list
-	if (!(peffect->type & EFFECT_TYPE_ACTIONS))
-		it = effects.aura_effect.insert(make_pair(peffect->code, peffect));
-	else {
+	if (!(peffect->type & EFFECT_TYPE_ACTIONS)) {
+		effects.aura_effect.insert(peffect);
+		effects.version++;
+	} else {
 		if (peffect->type & EFFECT_TYPE_IGNITION)
-			it = effects.ignition_effect.insert(make_pair(peffect->code, peffect));
+			effects.ignition_effect.insert(peffect);
 		else if (peffect->type & EFFECT_TYPE_ACTIVATE)
-			it = effects.activate_effect.insert(make_pair(peffect->code, peffect));
+			effects.activate_effect.insert(peffect);
 		else if (peffect->type & EFFECT_TYPE_TRIGGER_O && peffect->type & EFFECT_TYPE_FIELD)
-			it = effects.trigger_o_effect.insert(make_pair(peffect->code, peffect));
+			effects.trigger_o_effect.insert(peffect);
 		else if (peffect->type & EFFECT_TYPE_TRIGGER_F && peffect->type & EFFECT_TYPE_FIELD)
-			it = effects.trigger_f_effect.insert(make_pair(peffect->code, peffect));
+			effects.trigger_f_effect.insert(peffect);
 		else if (peffect->type & EFFECT_TYPE_QUICK_O)
-			it = effects.quick_o_effect.insert(make_pair(peffect->code, peffect));
+			effects.quick_o_effect.insert(peffect);
 		else if (peffect->type & EFFECT_TYPE_QUICK_F)
-			it = effects.quick_f_effect.insert(make_pair(peffect->code, peffect));
+			effects.quick_f_effect.insert(peffect);
 		else if (peffect->type & EFFECT_TYPE_CONTINUOUS)
-			it = effects.continuous_effect.insert(make_pair(peffect->code, peffect));
+			effects.continuous_effect.insert(peffect);
 	}
-	effects.indexer.insert(make_pair(peffect, it));
+	effects.indexer.insert(peffect);
 	if((peffect->flag & EFFECT_FLAG_FIELD_ONLY)) { // ?
 		if(peffect->flag & EFFECT_FLAG_OATH)
 			effects.oath.insert(make_pair(peffect, core.reason_effect));
@@ -861,27 +864,27 @@ void field::remove_effect(effect* peffect) {
 	auto eit = effects.indexer.find(peffect);
 	if (eit == effects.indexer.end())
 		return;
-	auto it = eit->second;
 	// remove it from the right type effect list.
-	if (!(peffect->type & EFFECT_TYPE_ACTIONS))
-		effects.aura_effect.erase(it);
-	else {
+	if (!(peffect->type & EFFECT_TYPE_ACTIONS)) {
+		effects.aura_effect.erase(peffect);
+		effects.version++;
+	} else {
 		if (peffect->type & EFFECT_TYPE_IGNITION)
-			effects.ignition_effect.erase(it);
+			effects.ignition_effect.erase(peffect);
 		else if (peffect->type & EFFECT_TYPE_ACTIVATE)
-			effects.activate_effect.erase(it);
+			effects.activate_effect.erase(peffect);
 		else if (peffect->type & EFFECT_TYPE_TRIGGER_O)
-			effects.trigger_o_effect.erase(it);
+			effects.trigger_o_effect.erase(peffect);
 		else if (peffect->type & EFFECT_TYPE_TRIGGER_F)
-			effects.trigger_f_effect.erase(it);
+			effects.trigger_f_effect.erase(peffect);
 		else if (peffect->type & EFFECT_TYPE_QUICK_O)
-			effects.quick_o_effect.erase(it);
+			effects.quick_o_effect.erase(peffect);
 		else if (peffect->type & EFFECT_TYPE_QUICK_F)
-			effects.quick_f_effect.erase(it);
+			effects.quick_f_effect.erase(peffect);
 		else if (peffect->type & EFFECT_TYPE_CONTINUOUS)
-			effects.continuous_effect.erase(it);
+			effects.continuous_effect.erase(peffect);
 	}
-	effects.indexer.erase(peffect);
+	effects.indexer.erase(eit);
 	if((peffect->flag & EFFECT_FLAG_FIELD_ONLY)) { // ?
 		if(peffect->flag & EFFECT_FLAG_OATH)
 			effects.oath.erase(peffect);
@@ -919,8 +922,7 @@ void field::remove_oath_effect(effect* reason_effect) {
 	int32 result;
 	for (auto it = effects.indexer.begin(); it != effects.indexer.end();) {
 		auto rm = it++;
-		auto peffect = rm->first;
-		auto pit = rm->second;
+		auto peffect = *rm;
 		if (!(peffect->flag & EFFECT_FLAG_FIELD_ONLY))
 			continue;
 		result = peffect->reset(id, reset_type);
@@ -928,24 +930,25 @@ void field::remove_oath_effect(effect* reason_effect) {
 			if (!(peffect->type & EFFECT_TYPE_ACTIONS)) {
 				if (peffect->is_disable_related())
 					update_disable_check_list(peffect);
-				effects.aura_effect.erase(pit);
+				effects.aura_effect.erase(peffect);
+				effects.version++;
 			} else {
 				if (peffect->type & EFFECT_TYPE_IGNITION)
-					effects.ignition_effect.erase(pit);
+					effects.ignition_effect.erase(peffect);
 				else if (peffect->type & EFFECT_TYPE_ACTIVATE)
-					effects.activate_effect.erase(pit);
+					effects.activate_effect.erase(peffect);
 				else if (peffect->type & EFFECT_TYPE_TRIGGER_O)
-					effects.trigger_o_effect.erase(pit);
+					effects.trigger_o_effect.erase(peffect);
 				else if (peffect->type & EFFECT_TYPE_TRIGGER_F)
-					effects.trigger_f_effect.erase(pit);
+					effects.trigger_f_effect.erase(peffect);
 				else if (peffect->type & EFFECT_TYPE_QUICK_O)
-					effects.quick_o_effect.erase(pit);
+					effects.quick_o_effect.erase(peffect);
 				else if (peffect->type & EFFECT_TYPE_QUICK_F)
-					effects.quick_f_effect.erase(pit);
+					effects.quick_f_effect.erase(peffect);
 				else if (peffect->type & EFFECT_TYPE_CONTINUOUS)
-					effects.continuous_effect.erase(pit);
+					effects.continuous_effect.erase(peffect);
 			}
-			effects.indexer.erase(peffect);
+			effects.indexer.erase(rm);
 			pduel->delete_effect(peffect);
 		}
 	}
@@ -1100,134 +1103,77 @@ int32 field::filter_matching_card(int32 findex, uint8 self, uint32 location1, ui
 	if(self != 0 && self != 1)
 		return FALSE;
 	card* pcard;
-	int32 count = 0;
+	card_vector cv;
 	uint32 location = location1;
 	for(uint32 p = 0; p < 2; ++p) {
 		if(location & LOCATION_MZONE) {
 			for(uint32 i = 0; i < 5; ++i) {
 				pcard = player[self].list_mzone[i];
-				if(pcard && !pcard->is_status(STATUS_SUMMONING) && !pcard->is_status(STATUS_SUMMON_DISABLED) && pcard != pexception
-				        && pduel->lua->check_matching(pcard, findex, extraargs) && (!is_target || pcard->is_capable_be_effect_target(core.reason_effect, core.reason_player))) {
-					if(pret) {
-						*pret = pcard;
-						return TRUE;
-					}
-					count ++;
-					if(fcount && count >= fcount)
-						return TRUE;
-					if(pgroup) {
-						pgroup->container.insert(pcard);
-					}
-				}
+				if(pcard && !pcard->is_status(STATUS_SUMMONING) && !pcard->is_status(STATUS_SUMMON_DISABLED) && pcard != pexception)
+					cv.push_back(pcard);
 			}
 		}
 		if(location & LOCATION_SZONE) {
 			for(uint32 i = 0; i < 8; ++i) {
 				pcard = player[self].list_szone[i];
-				if(pcard && pcard != pexception && pduel->lua->check_matching(pcard, findex, extraargs)
-				        && (!is_target || pcard->is_capable_be_effect_target(core.reason_effect, core.reason_player))) {
-					if(pret) {
-						*pret = pcard;
-						return TRUE;
-					}
-					count ++;
-					if(fcount && count >= fcount)
-						return TRUE;
-					if(pgroup) {
-						pgroup->container.insert(pcard);
-					}
-				}
+				if(pcard && pcard != pexception)
+					cv.push_back(pcard);
 			}
 		}
 		if(location & LOCATION_DECK) {
-			for(auto cit = player[self].list_main.rbegin(); cit != player[self].list_main.rend(); ++cit) {
-				if(*cit != pexception && pduel->lua->check_matching(*cit, findex, extraargs)
-				        && (!is_target || (*cit)->is_capable_be_effect_target(core.reason_effect, core.reason_player))) {
-					if(pret) {
-						*pret = *cit;
-						return TRUE;
-					}
-					count ++;
-					if(fcount && count >= fcount)
-						return TRUE;
-					if(pgroup) {
-						pgroup->container.insert(*cit);
-					}
-				}
-			}
+			for(auto cit = player[self].list_main.rbegin(); cit != player[self].list_main.rend(); ++cit)
+				if(*cit != pexception)
+					cv.push_back(*cit);
 		}
 		if(location & LOCATION_EXTRA) {
-			for(auto cit = player[self].list_extra.rbegin(); cit != player[self].list_extra.rend(); ++cit) {
-				if(*cit != pexception && pduel->lua->check_matching(*cit, findex, extraargs)
-				        && (!is_target || (*cit)->is_capable_be_effect_target(core.reason_effect, core.reason_player))) {
-					if(pret) {
-						*pret = *cit;
-						return TRUE;
-					}
-					count ++;
-					if(fcount && count >= fcount)
-						return TRUE;
-					if(pgroup) {
-						pgroup->container.insert(*cit);
-					}
-				}
-			}
+			for(auto cit = player[self].list_extra.rbegin(); cit != player[self].list_extra.rend(); ++cit)
+				if(*cit != pexception)
+					cv.push_back(*cit);
 		}
 		if(location & LOCATION_HAND) {
-			for(auto cit = player[self].list_hand.begin(); cit != player[self].list_hand.end(); ++cit) {
-				if(*cit != pexception && pduel->lua->check_matching(*cit, findex, extraargs)
-				        && (!is_target || (*cit)->is_capable_be_effect_target(core.reason_effect, core.reason_player))) {
-					if(pret) {
-						*pret = *cit;
-						return TRUE;
-					}
-					count ++;
-					if(fcount && count >= fcount)
-						return TRUE;
-					if(pgroup) {
-						pgroup->container.insert(*cit);
-					}
-				}
-			}
+			for(auto cit = player[self].list_hand.begin(); cit != player[self].list_hand.end(); ++cit)
+				if(*cit != pexception)
+					cv.push_back(*cit);
 		}
 		if(location & LOCATION_GRAVE) {
-			for(auto cit = player[self].list_grave.rbegin(); cit != player[self].list_grave.rend(); ++cit) {
-				if(*cit != pexception && pduel->lua->check_matching(*cit, findex, extraargs)
-				        && (!is_target || (*cit)->is_capable_be_effect_target(core.reason_effect, core.reason_player))) {
-					if(pret) {
-						*pret = *cit;
-						return TRUE;
-					}
-					count ++;
-					if(fcount && count >= fcount)
-						return TRUE;
-					if(pgroup) {
-						pgroup->container.insert(*cit);
-					}
-				}
-			}
+			for(auto cit = player[self].list_grave.rbegin(); cit != player[self].list_grave.rend(); ++cit)
+				if(*cit != pexception)
+					cv.push_back(*cit);
 		}
 		if(location & LOCATION_REMOVED) {
-			for(auto cit = player[self].list_remove.rbegin(); cit != player[self].list_remove.rend(); ++cit) {
-				if(*cit != pexception && pduel->lua->check_matching(*cit, findex, extraargs)
-				        && (!is_target || (*cit)->is_capable_be_effect_target(core.reason_effect, core.reason_player))) {
-					if(pret) {
-						*pret = *cit;
-						return TRUE;
-					}
-					count ++;
-					if(fcount && count >= fcount)
-						return TRUE;
-					if(pgroup) {
-						pgroup->container.insert(*cit);
-					}
-				}
-			}
+			for(auto cit = player[self].list_remove.rbegin(); cit != player[self].list_remove.rend(); ++cit)
+				if(*cit != pexception)
+					cv.push_back(*cit);
 		}
 		location = location2;
 		self = 1 - self;
 	}
-	return FALSE;
+	if(cv.empty())
+		return FALSE;
+	// the filter is called in the order of the locations above, the candidates are passed to Lua once
+	interpreter* lua = pduel->lua;
+	lua->push_cards(cv, findex);
+	int32 count = 0, result = FALSE;
+	for(uint32 i = lua->find_matching(cv, 0, findex, extraargs); i < cv.size(); i = lua->find_matching(cv, i + 1, findex, extraargs)) {
+		pcard = cv[i];
+		if(is_target && !pcard->is_capable_be_effect_target(core.reason_effect, core.reason_player))
+			continue;
+		if(pret) {
+			*pret = pcard;
+			result = TRUE;
+			break;
+		}
+		count ++;
+		if(fcount && count >= fcount) {
+			result = TRUE;
+			break;
+		}
+		if(pgroup) {
+			pgroup->container.insert(pcard);
+		}
+	}
+	lua_pop(lua->current_state, 1);
+	return result;
 }
 
 /*
@@ -2011,13 +1957,19 @@ int32 field::check_tuner_material(card* pcard, card* tuner, int32 findex1, int32
 int32 field::check_with_sum_limit(card_vector* mats, int32 acc, int32 index, int32 count, int32 min, int32 max) {
 	if((uint32)index >= mats->size())
 		return FALSE;
-	int32 op1 = mats->at(index)->operation_param & 0xffff;
-	int32 op2 = (mats->at(index)->operation_param >> 16) & 0xffff;
-	if((op1 == acc || op2 == acc) && count >= min && count <= max)
-		return TRUE;
-	return (acc > op1 && check_with_sum_limit(mats, acc - op1, index + 1, count + 1, min, max))
-	       || (op2 && acc > op2 && check_with_sum_limit(mats, acc - op2, index + 1, count + 1, min, max))
-	       || check_with_sum_limit(mats, acc, index + 1, count, min, max);
+	std::vector<uint32> params;
+	for(auto cit = mats->begin() + index; cit != mats->end(); ++cit)
+		params.push_back((*cit)->operation_param);
+	if(acc == 0) {
+		// a card without a second value matched a sum of 0 on its own
+		if(count < min || count > max)
+			return FALSE;
+		for(auto pit = params.begin(); pit != params.end(); ++pit)
+			if(!(*pit & 0xffff) || !(*pit >> 16))
+				return TRUE;
+		return FALSE;
+	}
+	return check_sum_limit(&params[0], params.size(), acc, count - 1, min, max);
 }
 
 /*
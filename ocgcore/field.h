@@ -14,6 +14,8 @@
 #include "memory.h"
 #include "common.h"
 #include "effectset.h"
+#include "effectindex.h"
+#include "cardset.h"
 #include <vector>
 #include <set>
 #include <map>
@@ -104,8 +106,7 @@ struct player_info {
  * Structure for field effect.
  */
 struct field_effect {
-	typedef std::multimap<uint32, effect*> effect_container; // ?
-	typedef std::map<effect*, effect_container::iterator > effect_indexer; // ?
+	typedef effect_index effect_container; // effects by code
 	typedef std::map<effect*, effect*> oath_effects; // what ?
 	typedef std::set<effect*> effect_collection; // a list of effects
 
@@ -117,14 +118,26 @@ struct field_effect {
 	effect_container quick_o_effect;
 	effect_container quick_f_effect;
 	effect_container continuous_effect;
-	effect_indexer indexer;
+	effect_collection indexer; // all field effects, in the order they are reset
 	oath_effects oath;
 	effect_collection pheff;
 	effect_collection cheff;
 	effect_collection rechargeable;
+	uint32 version; // changes whenever aura_effect, a card's single_effect or equip_effect, or a card's equiping_cards change
 
 	std::list<card*> disable_check_list;
-	std::set<card*, card_sort> disable_check_set;
+	card_id_set disable_check_set;
+
+	void compact() {
+		aura_effect.compact();
+		ignition_effect.compact();
+		activate_effect.compact();
+		trigger_o_effect.compact();
+		trigger_f_effect.compact();
+		quick_o_effect.compact();
+		quick_f_effect.compact();
+		continuous_effect.compact();
+	}
 };
 
 /*
@@ -161,6 +174,40 @@ struct processor_unit {
 	ptr arg2; // ?
 };
 
+/*
+ * The processor queue. The running unit is the front, it is kept at the back
+ * of a vector so that stepping, finishing and adding units does not allocate.
+ */
+class processor_stack {
+public:
+	typedef processor_unit* iterator;
+	typedef std::vector<processor_unit> unit_vector;
+
+	iterator begin() {
+		return &units.back();
+	}
+	processor_unit& front() {
+		return units.back();
+	}
+	void pop_front() {
+		units.pop_back();
+	}
+	uint32 size() const {
+		return units.size();
+	}
+	// the unit at depth i of the queue, 0 is the unit that runs last
+	processor_unit& at_depth(uint32 i) {
+		return units[i];
+	}
+	// puts the subunits, in order, before the current front
+	void push_front(unit_vector& subunits) {
+		units.insert(units.end(), subunits.rbegin(), subunits.rend());
+		subunits.clear();
+	}
+private:
+	unit_vector units;
+};
+
 /*
  * Structure for ?
  */
@@ -183,13 +230,14 @@ struct processor {
 	typedef std::list<chain> chain_list; // a list of chains ?
 	typedef std::map<effect*, chain> instant_f_list; // ?
 	typedef std::vector<chain> chain_array; // another type of list of changes ?
-	typedef std::list<processor_unit> processor_list; // a list of processor units ?
-	typedef std::set<card*, card_sort> card_set; // a list of cards with a comparator
+	typedef processor_stack processor_list; // the processor queue
+	typedef card_id_set card_set; // a list of cards ordered by cardid
 	typedef std::set<effect*> effect_collection; // a list of effects (?)
 	typedef std::set<std::pair<effect*, tevent> > delayed_effect_collection; // ?
 
 	processor_list units; // units I guess
-	processor_list subunits; // subroutines ?
+	uint64 steps; // processor steps run so far, read by the replay runner
+	processor_stack::unit_vector subunits; // units added by the current step, run before the rest
 	processor_unit reserved; // ?
 	card_vector select_cards; // a selection of cards ?
 	card_vector summonable_cards; // saves summonable cards
@@ -321,10 +369,9 @@ struct processor {
  */
 class field {
 public:
-	typedef std::multimap<uint32, effect*> effect_container; // ?
+	typedef effect_index effect_container; // effects by code
 	typedef std::list<card*> check_list; // a list of cards (for checking, I suppose ?)
-	typedef std::map <effect*, effect_container::iterator> effect_indexer;
-	typedef std::set<card*, card_sort> card_set; // a list of cards with a comparisator
+	typedef card_id_set card_set; // a list of cards ordered by cardid
 	typedef std::vector<effect*> effect_vector; // a list of effects
 	typedef std::vector<card*> card_vector; // a list of cards
 	typedef std::vector<uint32> option_vector; // a list of options ?
@@ -333,7 +380,7 @@ public:
 	typedef std::list<chain> chain_list; // a list of chains
 	typedef std::map<effect*, chain> instant_f_list; // ?
 	typedef std::vector<chain> chain_array; // another kind of list of chains
-	typedef std::list<processor_unit> processor_list; // ?
+	typedef processor_stack processor_list; // ?
 	typedef std::map<effect*, effect*> oath_effects; // ?
 
 	duel* pduel; // the current duel
@@ -346,7 +393,7 @@ public:
 	return_value returns; // ??
 	tevent nil_event; // no idea ?
 
-	static int32 field_used_count[32]; // ?
+	static const int32 field_used_count[32]; // number of used zones for a 5 bit zone flag
 	field(duel* pduel); // the constructor
 	~field(); // the destructor
 	void reload_field_info(); // ?
@@ -440,6 +487,7 @@ public:
 
 	void add_process(uint16 type, uint16 step, effect* peffect, group* target, ptr arg1, ptr arg2);
 	int32 process();
+	int32 process_unit();
 	int32 execute_cost(uint16 step, effect* peffect, uint8 triggering_player);
 	int32 execute_operation(uint16 step, effect* peffect, uint8 triggering_player);
 	int32 execute_target(uint16 step, effect* peffect, uint8 triggering_player);
@@ -9,6 +9,7 @@
 #define GROUP_H_
 
 #include "common.h"
+#include "cardset.h"
 #include <set>
 #include <list>
 
@@ -17,7 +18,7 @@ class duel;
 
 class group {
 public:
-	typedef std::set<card*, card_sort> card_set; // a list of cards with a comparator
+	typedef card_id_set card_set; // a list of cards ordered by cardid
 	int32 scrtype; // ?
 	int32 ref_handle; // ?
 	duel* pduel; // the current duel
@@ -11,9 +11,35 @@
 #include "group.h"
 #include "card.h"
 #include "effect.h"
+#include "cardfilter.h"
+#include "profiler.h"
 #include "scriptlib.h"
 #include "ocgapi.h"
 #include "interpreter.h"
+#include "mtlock.h"
+#include <stdlib.h>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+/*
+ * Compiled chunks shared by all duels in the process, keyed by script name.
+ * The hash of the source decides whether the cached bytecode is still valid.
+ */
+struct script_chunk {
+	uint32 hash;
+	std::vector<char> bytecode;
+};
+static std::unordered_map<std::string, script_chunk> script_cache;
+static mtlock script_cache_lock;
+
+/*
+ * Lua states of ended duels. They are reset to the base state (libraries, constant.lua
+ * and utility.lua) and handed to new duels instead of building a new state.
+ */
+#define STATE_POOL_SIZE 32
+static std::vector<lua_State*> state_pool;
+static mtlock state_pool_lock;
 
 static const struct luaL_Reg cardlib[] = {
 	{ "GetCode", scriptlib::card_get_code },
@@ -489,6 +515,7 @@ static const struct luaL_Reg duellib[] = {
 	{ "VenomSwampCheck", scriptlib::duel_venom_swamp_check },
 	{ "SwapDeckAndGrave", scriptlib::duel_swap_deck_and_grave },
 	{ "MajesticCopy", scriptlib::duel_majestic_copy },
+	{ "CreateFilter", scriptlib::duel_create_filter },
 	{ NULL, NULL }
 };
 
@@ -507,11 +534,29 @@ static const struct luaL_Reg debuglib[] = {
 };
 
 interpreter::interpreter(duel* pd): coroutines(256) {
-	lua_state = luaL_newstate();
-	current_state = lua_state;
 	pduel = pd;
 	no_action = 0;
 	call_depth = 0;
+	profiler = 0;
+	reusable = TRUE;
+	lua_state = 0;
+	//duels with their own script reader may load different common scripts
+	if(!pd->sreader) {
+		state_pool_lock.lock();
+		if(!state_pool.empty()) {
+			lua_state = state_pool.back();
+			state_pool.pop_back();
+		}
+		state_pool_lock.unlock();
+	}
+	if(lua_state) {
+		current_state = lua_state;
+		lua_pushlightuserdata(lua_state, pd);
+		lua_rawseti(lua_state, LUA_REGISTRYINDEX, 3);
+		return;
+	}
+	lua_state = luaL_newstate();
+	current_state = lua_state;
 	set_duel_info(lua_state, pd);
 	//Initial
 	luaL_openlibs(lua_state);
@@ -543,13 +588,218 @@ interpreter::interpreter(duel* pd): coroutines(256) {
 	lua_setglobal(lua_state, "Duel");
 	luaL_newlib(lua_state, debuglib);
 	lua_setglobal(lua_state, "Debug");
+	luaL_newmetatable(lua_state, "CardFilter");
+	lua_pushcfunction(lua_state, scriptlib::card_filter_call);
+	lua_setfield(lua_state, -2, "__call");
+	lua_pop(lua_state, 1);
+	//the loop of find_matching, it returns to C only for a matching card or a failed filter, with its position
+	//negated and the error, and restores the duel after each card
+	luaL_loadstring(lua_state, "local restore, pcall = ... return function(f, list, i, n, ...) for j = i, n do local ok, r = pcall(f, list[j], ...) restore() if not ok then return -j, r end if r then return j end end return 0 end");
+	lua_pushcfunction(lua_state, scriptlib::filter_restore);
+	lua_getglobal(lua_state, "pcall");
+	lua_call(lua_state, 2, 1);
+	lua_setfield(lua_state, LUA_REGISTRYINDEX, "find_matching");
 	//extra scripts
 	load_script((char*) "./script/constant.lua");
 	load_script((char*) "./script/utility.lua");
+	//copy the globals and the base tables they hold (Duel, Card, aux, string...) for reset_state
+	lua_newtable(lua_state);
+	int32 copies = lua_gettop(lua_state);
+	lua_pushglobaltable(lua_state);
+	copy_base_table(lua_state, copies, copies + 1);
+	lua_pushnil(lua_state);
+	while (lua_next(lua_state, copies + 1)) {
+		if(lua_istable(lua_state, -1))
+			copy_base_table(lua_state, copies, lua_gettop(lua_state));
+		lua_pop(lua_state, 1);
+	}
+	lua_pop(lua_state, 1);
+	lua_setfield(lua_state, LUA_REGISTRYINDEX, "base_tables");
+	name_permanents();
 }
 interpreter::~interpreter() {
+	set_profiling(FALSE);
+	bool reuse = false;
+	if(reusable && !pduel->sreader) {
+		state_pool_lock.lock();
+		reuse = state_pool.size() < STATE_POOL_SIZE;
+		state_pool_lock.unlock();
+	}
+	if(reuse) {
+		reset_state();
+		state_pool_lock.lock();
+		state_pool.push_back(lua_state);
+		state_pool_lock.unlock();
+		return;
+	}
 	lua_close(lua_state);
 }
+/*
+ * Keeps a shallow copy of the table at index table in the table at index copies, keyed by the table.
+ */
+void interpreter::copy_base_table(lua_State* L, int32 copies, int32 table) {
+	lua_pushvalue(L, table);
+	lua_rawget(L, copies);
+	int32 copied = !lua_isnil(L, -1);
+	lua_pop(L, 1);
+	if(copied)
+		return;
+	lua_pushvalue(L, table);
+	lua_newtable(L);
+	lua_pushnil(L);
+	while (lua_next(L, table)) {
+		lua_pushvalue(L, -2);
+		lua_insert(L, -2);
+		lua_rawset(L, -4);
+	}
+	lua_rawset(L, copies);
+}
+/*
+ * Drops everything the duel added to the state: card tables and other new globals,
+ * the references of cards, groups and effects, and the coroutines left on the stack.
+ * The globals and the base tables get back the fields they had when the state was built,
+ * so a script that wrote into Duel, aux or string does not change the next duel.
+ */
+void interpreter::reset_state() {
+	lua_settop(lua_state, 0);
+	lua_getfield(lua_state, LUA_REGISTRYINDEX, "base_tables");
+	lua_pushnil(lua_state);
+	while (lua_next(lua_state, 1)) {
+		//2 is the table, 3 its copy; fields the duel set or changed first, then the ones it removed
+		lua_pushnil(lua_state);
+		while (lua_next(lua_state, 2)) {
+			lua_pop(lua_state, 1);
+			lua_pushvalue(lua_state, -1);
+			lua_pushvalue(lua_state, -1);
+			lua_rawget(lua_state, 3);
+			lua_rawset(lua_state, 2);
+		}
+		lua_pushnil(lua_state);
+		while (lua_next(lua_state, 3)) {
+			lua_pushvalue(lua_state, -2);
+			lua_insert(lua_state, -2);
+			lua_rawset(lua_state, 2);
+		}
+		lua_pop(lua_state, 1);
+	}
+	lua_pop(lua_state, 1);
+	//1 and 2 are the main thread and the globals, 3 is the duel info
+	lua_pushnil(lua_state);
+	while (lua_next(lua_state, LUA_REGISTRYINDEX)) {
+		lua_pop(lua_state, 1);
+		if(lua_type(lua_state, -1) == LUA_TNUMBER) {
+			lua_Integer ref = lua_tointeger(lua_state, -1);
+			if(ref == 0 || ref > 3) {
+				lua_pushvalue(lua_state, -1);
+				lua_pushnil(lua_state);
+				lua_rawset(lua_state, LUA_REGISTRYINDEX);
+			}
+		}
+	}
+	lua_gc(lua_state, LUA_GCCOLLECT, 0);
+}
+/*
+ * Names the tables, functions and userdata like io.stdout reachable from the globals and the CardFilter metatable
+ * by their path, like _G.Card.GetCode or _G.package.searchers[1], for the snapshots of duel_state. Keys are visited
+ * in sorted order so that every state gives the same names.
+ */
+void interpreter::name_permanents() {
+	lua_State* L = lua_state;
+	lua_newtable(L);
+	int32 names = lua_gettop(L);
+	std::vector<std::string> queue;
+	lua_pushglobaltable(L);
+	lua_pushstring(L, "_G");
+	lua_rawset(L, names);
+	queue.push_back("_G");
+	luaL_getmetatable(L, "CardFilter");
+	lua_pushstring(L, "CardFilter");
+	lua_rawset(L, names);
+	queue.push_back("CardFilter");
+	// the tables are found again by name, a name to table index is kept while naming
+	lua_newtable(L);
+	int32 tables = lua_gettop(L);
+	lua_pushglobaltable(L);
+	lua_setfield(L, tables, "_G");
+	luaL_getmetatable(L, "CardFilter");
+	lua_setfield(L, tables, "CardFilter");
+	for(uint32 i = 0; i < queue.size(); ++i) {
+		std::string prefix = queue[i];
+		lua_getfield(L, tables, prefix.c_str());
+		int32 table = lua_gettop(L);
+		std::vector<std::pair<int32, std::string> > keys;
+		lua_pushnil(L);
+		while(lua_next(L, table)) {
+			lua_pop(L, 1);
+			// numbers first, then strings, other keys are not named
+			if(lua_type(L, -1) == LUA_TNUMBER) {
+				char num[32];
+				sprintf(num, "%.17g", lua_tonumber(L, -1));
+				keys.push_back(std::make_pair(0, std::string(num)));
+			} else if(lua_type(L, -1) == LUA_TSTRING)
+				keys.push_back(std::make_pair(1, std::string(lua_tostring(L, -1))));
+		}
+		std::sort(keys.begin(), keys.end());
+		for(uint32 k = 0; k < keys.size(); ++k) {
+			if(keys[k].first == 0)
+				lua_pushnumber(L, atof(keys[k].second.c_str()));
+			else
+				lua_pushstring(L, keys[k].second.c_str());
+			lua_rawget(L, table);
+			int32 type = lua_type(L, -1);
+			if(type != LUA_TTABLE && type != LUA_TFUNCTION && type != LUA_TUSERDATA) {
+				lua_pop(L, 1);
+				continue;
+			}
+			lua_pushvalue(L, -1);
+			lua_rawget(L, names);
+			int32 named = !lua_isnil(L, -1);
+			lua_pop(L, 1);
+			if(named) {
+				lua_pop(L, 1);
+				continue;
+			}
+			std::string name = keys[k].first == 0 ? prefix + "[" + keys[k].second + "]" : prefix + "." + keys[k].second;
+			lua_pushvalue(L, -1);
+			lua_pushstring(L, name.c_str());
+			lua_rawset(L, names);
+			if(type == LUA_TTABLE) {
+				lua_setfield(L, tables, name.c_str());
+				queue.push_back(name);
+			} else
+				lua_pop(L, 1);
+		}
+		lua_pop(L, 1);
+	}
+	lua_pop(L, 1);
+	lua_setfield(L, LUA_REGISTRYINDEX, "permanents");
+}
+/*
+ * Starts profiling the calls into Lua with nothing recorded, or stops it and drops what was recorded.
+ */
+void interpreter::set_profiling(int32 enable) {
+	if(profiler) {
+		lua_sethook(lua_state, 0, 0, 0);
+		for(auto cit = coroutines.begin(); cit != coroutines.end(); ++cit)
+			lua_sethook(cit->second, 0, 0, 0);
+		delete profiler;
+		profiler = 0;
+	}
+	if(!enable)
+		return;
+	static const struct {
+		const luaL_Reg* lib;
+		const char* name;
+	} libs[] = { { cardlib, "Card" }, { effectlib, "Effect" }, { grouplib, "Group" }, { duellib, "Duel" }, { debuglib, "Debug" } };
+	profiler = new lua_profiler;
+	for(uint32 i = 0; i < sizeof(libs) / sizeof(libs[0]); ++i)
+		for(const luaL_Reg* reg = libs[i].lib; reg->name; ++reg)
+			profiler->add_lib(reg->func, std::string(libs[i].name) + "." + reg->name);
+	profiler->add_lib(scriptlib::card_filter_call, "CardFilter.__call");
+	lua_sethook(lua_state, lua_profiler::count_hook, LUA_MASKCALL, 0);
+	for(auto cit = coroutines.begin(); cit != coroutines.end(); ++cit)
+		lua_sethook(cit->second, lua_profiler::count_hook, LUA_MASKCALL, 0);
+}
 int32 interpreter::register_card(card *pcard) {
 	//create a card in by userdata
 	card ** ppcard = (card**) lua_newuserdata(lua_state, sizeof(card*));
@@ -623,14 +873,50 @@ void interpreter::unregister_group(group *pgroup) {
 	luaL_unref(lua_state, LUA_REGISTRYINDEX, pgroup->ref_handle);
 	pgroup->ref_handle = 0;
 }
+static int chunk_writer(lua_State* L, const void* p, size_t sz, void* ud) {
+	std::vector<char>* bytecode = (std::vector<char>*)ud;
+	bytecode->insert(bytecode->end(), (const char*)p, (const char*)p + sz);
+	return 0;
+}
+/*
+ * Loads the script as a function on top of the stack, from the bytecode cache if the source is unchanged.
+ */
+int32 interpreter::load_chunk(const char* script_name, const byte* buffer, int32 len) {
+	uint32 hash = 2166136261u;
+	for(int32 i = 0; i < len; ++i)
+		hash = (hash ^ buffer[i]) * 16777619u;
+	std::string key(script_name);
+	//the bytecode is copied under the lock and undumped outside it, other duels may load scripts meanwhile
+	std::vector<char> bytecode;
+	script_cache_lock.lock();
+	auto cit = script_cache.find(key);
+	if(cit != script_cache.end() && cit->second.hash == hash)
+		bytecode = cit->second.bytecode;
+	script_cache_lock.unlock();
+	if(bytecode.size())
+		return luaL_loadbufferx(current_state, &bytecode[0], bytecode.size(), script_name, "b");
+	int32 error = luaL_loadbuffer(current_state, (const char*) buffer, len, script_name);
+	if(error)
+		return error;
+	script_chunk chunk;
+	chunk.hash = hash;
+	if(lua_dump(current_state, chunk_writer, &chunk.bytecode) || chunk.bytecode.empty())
+		return 0;
+	script_cache_lock.lock();
+	script_chunk& cached = script_cache[key];
+	cached.hash = hash;
+	cached.bytecode.swap(chunk.bytecode);
+	script_cache_lock.unlock();
+	return 0;
+}
 int32 interpreter::load_script(char* script_name) {
 	int32 error;
 	int32 len = 0;
-	byte* buffer = read_script(script_name, &len);
+	byte* buffer = read_script(pduel, script_name, &len);
 	if (!buffer)
 		return OPERATION_FAIL;
 	no_action++;
-	error = luaL_loadbuffer(current_state, (const char*) buffer, len, (const char*) script_name) || lua_pcall(current_state, 0, 0, 0);
+	error = load_chunk(script_name, buffer, len) || lua_pcall(current_state, 0, 0, 0);
 	if (error) {
 		sprintf(pduel->strbuffer, lua_tostring(current_state, -1));
 		handle_message(pduel, 1);
@@ -762,8 +1048,13 @@ int32 interpreter::call_function(int32 f, uint32 param_count, uint32 ret_count)
 	}
 	no_action++;
 	call_depth++;
+	if(profiler)
+		profiler->begin(current_state, -1);
 	push_param(current_state);
-	if (lua_pcall(current_state, param_count, ret_count, 0)) {
+	int32 error = lua_pcall(current_state, param_count, ret_count, 0);
+	if(profiler)
+		profiler->end();
+	if (error) {
 		sprintf(pduel->strbuffer, lua_tostring(current_state, -1));
 		handle_message(pduel, 1);
 		lua_pop(current_state, 1);
@@ -802,8 +1093,13 @@ int32 interpreter::call_card_function(card* pcard, char* f, uint32 param_count,
 	no_action++;
 	call_depth++;
 	lua_remove(current_state, -2);
+	if(profiler)
+		profiler->begin(pcard->data.code, f);
 	push_param(current_state);
-	if (lua_pcall(current_state, param_count, ret_count, 0)) {
+	int32 error = lua_pcall(current_state, param_count, ret_count, 0);
+	if(profiler)
+		profiler->end();
+	if (error) {
 		sprintf(pduel->strbuffer, lua_tostring(current_state, -1));
 		handle_message(pduel, 1);
 		lua_pop(current_state, 1);
@@ -842,8 +1138,13 @@ int32 interpreter::call_code_function(uint32 code, char* f, uint32 param_count,
 	lua_remove(current_state, -2);
 	no_action++;
 	call_depth++;
+	if(profiler)
+		profiler->begin(code, f);
 	push_param(current_state);
-	if (lua_pcall(current_state, param_count, ret_count, 0)) {
+	int32 error = lua_pcall(current_state, param_count, ret_count, 0);
+	if(profiler)
+		profiler->end();
+	if (error) {
 		sprintf(pduel->strbuffer, lua_tostring(current_state, -1));
 		handle_message(pduel, 1);
 		lua_pop(current_state, 1);
@@ -894,13 +1195,21 @@ int32 interpreter::check_matching(card* pcard, int32 findex, int32 extraargs) {
 	int32 result;
 	if(!findex || lua_isnil(current_state, findex))
 		return TRUE;
+	card_filter* pfilter = get_filter(current_state, findex);
+	if(pfilter)
+		return match_filter(pfilter, pcard);
 	no_action++;
 	call_depth++;
+	if(profiler)
+		profiler->begin(current_state, findex);
 	lua_pushvalue(current_state, findex);
 	interpreter::card2value(current_state, pcard);
 	for(int32 i = 0; i < extraargs; ++i)
 		lua_pushvalue(current_state, (int32)(-extraargs - 2));
-	if (lua_pcall(current_state, 1 + extraargs, 1, 0)) {
+	int32 error = lua_pcall(current_state, 1 + extraargs, 1, 0);
+	if(profiler)
+		profiler->end();
+	if (error) {
 		sprintf(pduel->strbuffer, lua_tostring(current_state, -1));
 		handle_message(pduel, 1);
 		lua_pop(current_state, 1);
@@ -922,17 +1231,117 @@ int32 interpreter::check_matching(card* pcard, int32 findex, int32 extraargs) {
 	}
 	return result;
 }
+/*
+ * Checks a card filter in the scope of a Lua filter, the conditions may call the functions of effects.
+ */
+int32 interpreter::match_filter(card_filter* pfilter, card* pcard) {
+	no_action++;
+	call_depth++;
+	int32 result = pfilter->is_match(pcard);
+	no_action--;
+	call_depth--;
+	if(call_depth == 0) {
+		pduel->release_script_group();
+		pduel->restore_assumes();
+	}
+	return result;
+}
+/*
+ * Pushes a table of the cards, for find_matching(...).
+ * Only a Lua filter needs the table, nil is pushed for no filter or a card filter.
+ */
+void interpreter::push_cards(const std::vector<card*>& cards, int32 findex) {
+	if(!findex || !lua_isfunction(current_state, findex)) {
+		lua_pushnil(current_state);
+		return;
+	}
+	lua_createtable(current_state, cards.size(), 0);
+	for(uint32 i = 0; i < cards.size(); ++i) {
+		card2value(current_state, cards[i]);
+		lua_rawseti(current_state, -2, i + 1);
+	}
+}
+/*
+ * Returns the first of the cards from index on that matches the filter at findex, the size of cards if none does.
+ * The filter sees the same cards in the same order as with check_matching(...) on each of them,
+ * but the loop runs in Lua, so there is one call into Lua for each match instead of one for each card.
+ * A card the filter fails on does not match, the error is reported and the loop goes on after it.
+ * The table of push_cards(cards) is on the top of the stack and the extra arguments are below it.
+ */
+uint32 interpreter::find_matching(const std::vector<card*>& cards, uint32 index, int32 findex, int32 extraargs) {
+	uint32 size = cards.size();
+	if(index >= size)
+		return size;
+	if(!findex || lua_isnil(current_state, findex))
+		return index;
+	card_filter* pfilter = get_filter(current_state, findex);
+	if(pfilter) {
+		for(uint32 i = index; i < size; ++i)
+			if(match_filter(pfilter, cards[i]))
+				return i;
+		return size;
+	}
+	int32 list = lua_gettop(current_state);
+	uint32 result = size;
+	no_action++;
+	call_depth++;
+	uint32 start = index;
+	while(true) {
+		lua_getfield(current_state, LUA_REGISTRYINDEX, "find_matching");
+		lua_pushvalue(current_state, findex);
+		lua_pushvalue(current_state, list);
+		lua_pushinteger(current_state, start + 1);
+		lua_pushinteger(current_state, size);
+		for(int32 i = 0; i < extraargs; ++i)
+			lua_pushvalue(current_state, list - extraargs + i);
+		if(profiler)
+			profiler->begin(current_state, findex);
+		int32 error = lua_pcall(current_state, 4 + extraargs, 2, 0);
+		if(profiler)
+			profiler->end();
+		if (error) {
+			sprintf(pduel->strbuffer, lua_tostring(current_state, -1));
+			handle_message(pduel, 1);
+			lua_pop(current_state, 1);
+			break;
+		}
+		int32 pos = lua_tointeger(current_state, -2);
+		if(pos >= 0) {
+			lua_pop(current_state, 2);
+			if(pos)
+				result = pos - 1;
+			break;
+		}
+		//the filter failed on the card at -pos, report it and go on with the next card
+		sprintf(pduel->strbuffer, lua_tostring(current_state, -1));
+		handle_message(pduel, 1);
+		lua_pop(current_state, 2);
+		start = -pos;
+	}
+	no_action--;
+	call_depth--;
+	if(call_depth == 0) {
+		pduel->release_script_group();
+		pduel->restore_assumes();
+	}
+	return result;
+}
 int32 interpreter::get_operation_value(card* pcard, int32 findex, int32 extraargs) {
 	int32 result;
 	if(!findex || lua_isnil(current_state, findex))
 		return 0;
 	no_action++;
 	call_depth++;
+	if(profiler)
+		profiler->begin(current_state, findex);
 	lua_pushvalue(current_state, findex);
 	interpreter::card2value(current_state, pcard);
 	for(int32 i = 0; i < extraargs; ++i)
 		lua_pushvalue(current_state, (int32)(-extraargs - 2));
-	if (lua_pcall(current_state, 1 + extraargs, 1, 0)) {
+	int32 error = lua_pcall(current_state, 1 + extraargs, 1, 0);
+	if(profiler)
+		profiler->end();
+	if (error) {
 		sprintf(pduel->strbuffer, lua_tostring(current_state, -1));
 		handle_message(pduel, 1);
 		lua_pop(current_state, 1);
@@ -1026,9 +1435,16 @@ int32 interpreter::call_coroutine(int32 f, uint32 param_count, uint32 * yield_va
 			return OPERATION_FAIL;
 		}
 	}
+	if(profiler) {
+		function2value(lua_state, f);
+		profiler->begin(lua_state, -1);
+		lua_pop(lua_state, 1);
+	}
 	push_param(rthread, true);
 	current_state = rthread;
 	int32 result = lua_resume(rthread, 0, param_count);
+	if(profiler)
+		profiler->end();
 	if (result == 0) {
 		coroutines.erase(f);
 		if(yield_value)
@@ -1086,6 +1502,14 @@ int32 interpreter::get_function_handle(lua_State* L, int32 index) {
 	int32 ref = luaL_ref(L, LUA_REGISTRYINDEX);
 	return ref;
 }
+card_filter* interpreter::get_filter(lua_State* L, int32 index) {
+	if(lua_type(L, index) != LUA_TUSERDATA)
+		return 0;
+	card_filter* pfilter = *(card_filter**)lua_touserdata(L, index);
+	if(pfilter->scrtype != 4)
+		return 0;
+	return pfilter;
+}
 void interpreter::set_duel_info(lua_State* L, duel* pduel) {
 	lua_pushlightuserdata(L, pduel);
 	luaL_ref(L, LUA_REGISTRYINDEX);
@@ -22,11 +22,14 @@ extern "C" {
 #include "common.h"
 #include <unordered_map>
 #include <list>
+#include <vector>
 
 class card;
 class effect;
 class group;
 class duel;
+class card_filter;
+class lua_profiler;
 
 class interpreter {
 public:
@@ -42,8 +45,14 @@ public:
 	coroutine_map coroutines;
 	int32 no_action;
 	int32 call_depth;
+	lua_profiler* profiler;
+	int32 reusable; // the state goes back to the pool when the duel ends
 	interpreter(duel* pd);
 	~interpreter();
+	void reset_state();
+	static void copy_base_table(lua_State* L, int32 copies, int32 table);
+	void name_permanents();
+	void set_profiling(int32 enable);
 
 	int32 register_card(card *pcard);
 	void register_effect(effect* peffect);
@@ -51,6 +60,7 @@ public:
 	void register_group(group* pgroup);
 	void unregister_group(group* pgroup);
 	
+	int32 load_chunk(const char* script_name, const byte* buffer, int32 len);
 	int32 load_script(char* buffer);
 	int32 load_card_script(uint32 code);
 	void add_param(void* param, int32 type, bool front = false);
@@ -61,6 +71,9 @@ public:
 	int32 call_code_function(uint32 code, char *f, uint32 param_count, uint32 ret_count);
 	int32 check_condition(int32 f, uint32 param_count);
 	int32 check_matching(card* pcard, int32 findex, int32 extraargs);
+	int32 match_filter(card_filter* pfilter, card* pcard);
+	void push_cards(const std::vector<card*>& cards, int32 findex);
+	uint32 find_matching(const std::vector<card*>& cards, uint32 index, int32 findex, int32 extraargs);
 	int32 get_operation_value(card* pcard, int32 findex, int32 extraargs);
 	int32 get_function_value(int32 f, uint32 param_count);
 	int32 call_coroutine(int32 f, uint32 param_count, uint32* yield_value, uint16 step);
@@ -70,6 +83,7 @@ public:
 	static void effect2value(lua_State* L, effect* peffect);
 	static void function2value(lua_State* L, int32 pointer);
 	static int32 get_function_handle(lua_State* L, int32 index);
+	static card_filter* get_filter(lua_State* L, int32 index);
 	static void set_duel_info(lua_State* L, duel* pduel);
 	static duel* get_duel_info(lua_State* L);
 };
@@ -82,6 +96,7 @@ public:
 #define	PARAM_TYPE_FUNCTION	0x20
 #define PARAM_TYPE_BOOLEAN	0x40
 #define PARAM_TYPE_INDEX	0x80
+#define PARAM_TYPE_FILTER	0x100	//a function or a card filter
 
 #define COROUTINE_FINISH	1
 #define COROUTINE_YIELD		2
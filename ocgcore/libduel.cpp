@@ -11,6 +11,7 @@
 #include "card.h"
 #include "effect.h"
 #include "group.h"
+#include "cardfilter.h"
 
 int32 scriptlib::duel_enable_global_flag(lua_State *L) {
 	check_param_count(L, 1);
@@ -1023,7 +1024,7 @@ int32 scriptlib::duel_discard_hand(lua_State *L) {
 	check_action_permission(L);
 	check_param_count(L, 5);
 	if(!lua_isnil(L, 2))
-		check_param(L, PARAM_TYPE_FUNCTION, 2);
+		check_param(L, PARAM_TYPE_FILTER, 2);
 	card* pexception = 0;
 	uint32 extraargs = 0;
 	if(lua_gettop(L) >= 6) {
@@ -1610,7 +1611,7 @@ int32 scriptlib::duel_get_decktop_group(lua_State *L) {
 int32 scriptlib::duel_get_matching_group(lua_State *L) {
 	check_param_count(L, 5);
 	if(!lua_isnil(L, 1))
-		check_param(L, PARAM_TYPE_FUNCTION, 1);
+		check_param(L, PARAM_TYPE_FILTER, 1);
 	card* pexception = 0;
 	uint32 extraargs = 0;
 	if(!lua_isnil(L, 5)) {
@@ -1635,7 +1636,7 @@ int32 scriptlib::duel_get_matching_group(lua_State *L) {
 int32 scriptlib::duel_get_matching_count(lua_State *L) {
 	check_param_count(L, 5);
 	if(!lua_isnil(L, 1))
-		check_param(L, PARAM_TYPE_FUNCTION, 1);
+		check_param(L, PARAM_TYPE_FILTER, 1);
 	card* pexception = 0;
 	uint32 extraargs = 0;
 	if(!lua_isnil(L, 5)) {
@@ -1661,7 +1662,7 @@ int32 scriptlib::duel_get_matching_count(lua_State *L) {
 int32 scriptlib::duel_get_first_matching_card(lua_State *L) {
 	check_param_count(L, 5);
 	if(!lua_isnil(L, 1))
-		check_param(L, PARAM_TYPE_FUNCTION, 1);
+		check_param(L, PARAM_TYPE_FILTER, 1);
 	card* pexception = 0;
 	uint32 extraargs = 0;
 	if(!lua_isnil(L, 5)) {
@@ -1688,7 +1689,7 @@ int32 scriptlib::duel_get_first_matching_card(lua_State *L) {
 int32 scriptlib::duel_is_existing_matching_card(lua_State *L) {
 	check_param_count(L, 6);
 	if(!lua_isnil(L, 1))
-		check_param(L, PARAM_TYPE_FUNCTION, 1);
+		check_param(L, PARAM_TYPE_FILTER, 1);
 	card* pexception = 0;
 	uint32 extraargs = 0;
 	if(!lua_isnil(L, 6)) {
@@ -1713,7 +1714,7 @@ int32 scriptlib::duel_select_matching_cards(lua_State *L) {
 	check_action_permission(L);
 	check_param_count(L, 8);
 	if(!lua_isnil(L, 2))
-		check_param(L, PARAM_TYPE_FUNCTION, 2);
+		check_param(L, PARAM_TYPE_FILTER, 2);
 	card* pexception = 0;
 	uint32 extraargs = 0;
 	if(!lua_isnil(L, 8)) {
@@ -1936,7 +1937,7 @@ int32 scriptlib::duel_select_tribute(lua_State *L) {
 int32 scriptlib::duel_get_target_count(lua_State *L) {
 	check_param_count(L, 5);
 	if(!lua_isnil(L, 1))
-		check_param(L, PARAM_TYPE_FUNCTION, 1);
+		check_param(L, PARAM_TYPE_FILTER, 1);
 	card* pexception = 0;
 	uint32 extraargs = 0;
 	if(!lua_isnil(L, 5)) {
@@ -1963,7 +1964,7 @@ int32 scriptlib::duel_get_target_count(lua_State *L) {
 int32 scriptlib::duel_is_existing_target(lua_State *L) {
 	check_param_count(L, 6);
 	if(!lua_isnil(L, 1))
-		check_param(L, PARAM_TYPE_FUNCTION, 1);
+		check_param(L, PARAM_TYPE_FILTER, 1);
 	card* pexception = 0;
 	uint32 extraargs = 0;
 	if(!lua_isnil(L, 6)) {
@@ -1988,7 +1989,7 @@ int32 scriptlib::duel_select_target(lua_State *L) {
 	check_action_permission(L);
 	check_param_count(L, 8);
 	if(!lua_isnil(L, 2))
-		check_param(L, PARAM_TYPE_FUNCTION, 2);
+		check_param(L, PARAM_TYPE_FILTER, 2);
 	card* pexception = 0;
 	uint32 extraargs = 0;
 	if(!lua_isnil(L, 8)) {
@@ -3247,3 +3248,58 @@ int32 scriptlib::duel_majestic_copy(lua_State *L) {
 	}
 	return 0;
 }
+/**
+* \brief Duel.CreateFilter
+* \param table of conditions: code, setcode, type, race, attribute, faceup, abletohand, abletograve
+* \return CardFilter, a filter the matching card functions check without calling into Lua
+*/
+int32 scriptlib::duel_create_filter(lua_State *L) {
+	check_param_count(L, 1);
+	luaL_checktype(L, 1, LUA_TTABLE);
+	static const char* const keys[] = { "code", "setcode", "type", "race", "attribute" };
+	card_filter** pp = (card_filter**)lua_newuserdata(L, sizeof(card_filter*) + sizeof(card_filter));
+	card_filter* pfilter = new (pp + 1) card_filter();
+	*pp = pfilter;
+	uint32* values[] = { &pfilter->code, &pfilter->setcode, &pfilter->type, &pfilter->race, &pfilter->attribute };
+	for(int32 i = 0; i < 5; ++i) {
+		lua_getfield(L, 1, keys[i]);
+		if(!lua_isnil(L, -1)) {
+			pfilter->flag |= CARD_FILTER_CODE << i;
+			*values[i] = lua_tointeger(L, -1);
+		}
+		lua_pop(L, 1);
+	}
+	static const char* const flags[] = { "faceup", "abletohand", "abletograve" };
+	for(int32 i = 0; i < 3; ++i) {
+		lua_getfield(L, 1, flags[i]);
+		if(lua_toboolean(L, -1))
+			pfilter->flag |= CARD_FILTER_FACEUP << i;
+		lua_pop(L, 1);
+	}
+	luaL_setmetatable(L, "CardFilter");
+	return 1;
+}
+/**
+* \brief CardFilter(c), the filter called from Lua
+* \return boolean
+*/
+int32 scriptlib::card_filter_call(lua_State *L) {
+	check_param_count(L, 2);
+	check_param(L, PARAM_TYPE_CARD, 2);
+	card_filter* pfilter = interpreter::get_filter(L, 1);
+	card* pcard = *(card**) lua_touserdata(L, 2);
+	lua_pushboolean(L, pfilter && pfilter->is_match(pcard));
+	return 1;
+}
+/*
+ * Called by the loop of interpreter::find_matching(...) after each card. At the top level it releases
+ * the groups and assumptions of the filter like check_matching(...) does after each call.
+ */
+int32 scriptlib::filter_restore(lua_State *L) {
+	duel* pduel = interpreter::get_duel_info(L);
+	if(pduel->lua->call_depth == 1) {
+		pduel->release_script_group();
+		pduel->restore_assumes();
+	}
+	return 0;
+}
@@ -145,7 +145,7 @@ int32 scriptlib::group_for_each(lua_State *L) {
 int32 scriptlib::group_filter(lua_State *L) {
 	check_param_count(L, 3);
 	check_param(L, PARAM_TYPE_GROUP, 1);
-	check_param(L, PARAM_TYPE_FUNCTION, 2);
+	check_param(L, PARAM_TYPE_FILTER, 2);
 	card* pexception = 0;
 	if(!lua_isnil(L, 3)) {
 		check_param(L, PARAM_TYPE_CARD, 3);
@@ -167,7 +167,7 @@ int32 scriptlib::group_filter(lua_State *L) {
 int32 scriptlib::group_filter_count(lua_State *L) {
 	check_param_count(L, 3);
 	check_param(L, PARAM_TYPE_GROUP, 1);
-	check_param(L, PARAM_TYPE_FUNCTION, 2);
+	check_param(L, PARAM_TYPE_FILTER, 2);
 	card* pexception = 0;
 	if(!lua_isnil(L, 3)) {
 		check_param(L, PARAM_TYPE_CARD, 3);
@@ -189,7 +189,7 @@ int32 scriptlib::group_filter_select(lua_State *L) {
 	check_action_permission(L);
 	check_param_count(L, 6);
 	check_param(L, PARAM_TYPE_GROUP, 1);
-	check_param(L, PARAM_TYPE_FUNCTION, 3);
+	check_param(L, PARAM_TYPE_FILTER, 3);
 	card* pexception = 0;
 	if(!lua_isnil(L, 6)) {
 		check_param(L, PARAM_TYPE_CARD, 6);
@@ -249,7 +249,7 @@ int32 scriptlib::group_random_select(lua_State *L) {
 int32 scriptlib::group_is_exists(lua_State *L) {
 	check_param_count(L, 4);
 	check_param(L, PARAM_TYPE_GROUP, 1);
-	check_param(L, PARAM_TYPE_FUNCTION, 2);
+	check_param(L, PARAM_TYPE_FILTER, 2);
 	card* pcard = 0;
 	if(!lua_isnil(L, 4)) {
 		check_param(L, PARAM_TYPE_CARD, 4);
@@ -464,7 +464,7 @@ int32 scriptlib::group_get_class_count(lua_State *L) {
 int32 scriptlib::group_remove(lua_State *L) {
 	check_param_count(L, 3);
 	check_param(L, PARAM_TYPE_GROUP, 1);
-	check_param(L, PARAM_TYPE_FUNCTION, 2);
+	check_param(L, PARAM_TYPE_FILTER, 2);
 	card* pexception = 0;
 	if(!lua_isnil(L, 3)) {
 		check_param(L, PARAM_TYPE_CARD, 3);
@@ -545,7 +545,7 @@ int32 scriptlib::group_is_contains(lua_State *L) {
 int32 scriptlib::group_search_card(lua_State *L) {
 	check_param_count(L, 2);
 	check_param(L, PARAM_TYPE_GROUP, 1);
-	check_param(L, PARAM_TYPE_FUNCTION, 2);
+	check_param(L, PARAM_TYPE_FILTER, 2);
 	group* pgroup = *(group**) lua_touserdata(L, 1);
 	duel* pduel = pgroup->pduel;
 	uint32 extraargs = lua_gettop(L) - 2;
@@ -0,0 +1,50 @@
+/*
+ * mtlock.h
+ * A plain mutex for the state shared between duels running on different threads.
+ */
+
+#ifndef MTLOCK_H_
+#define MTLOCK_H_
+
+#ifdef WIN32
+#include <windows.h>
+#else
+#include <pthread.h>
+#endif
+
+class mtlock {
+public:
+#ifdef WIN32
+	mtlock() {
+		InitializeCriticalSection(&cs);
+	}
+	~mtlock() {
+		DeleteCriticalSection(&cs);
+	}
+	void lock() {
+		EnterCriticalSection(&cs);
+	}
+	void unlock() {
+		LeaveCriticalSection(&cs);
+	}
+private:
+	CRITICAL_SECTION cs;
+#else
+	mtlock() {
+		pthread_mutex_init(&mutex, NULL);
+	}
+	~mtlock() {
+		pthread_mutex_destroy(&mutex);
+	}
+	void lock() {
+		pthread_mutex_lock(&mutex);
+	}
+	void unlock() {
+		pthread_mutex_unlock(&mutex);
+	}
+private:
+	pthread_mutex_t mutex;
+#endif
+};
+
+#endif /* MTLOCK_H_ */
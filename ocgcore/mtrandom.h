@@ -71,6 +71,20 @@ public:
 		unsigned int a = rand() >> 5, b = rand() >> 6;
 		return (a * 67108864.0 + b) / 9007199254740992.0;
 	}
+	// the generator state, for the snapshots of a duel
+	enum { STATE_SIZE = 626 };
+	void save_state(unsigned int* out) const {
+		for (int i = 0; i < N; ++i)
+			out[i] = state[i];
+		out[N] = left;
+		out[N + 1] = next - state;
+	}
+	void load_state(const unsigned int* in) {
+		for (int i = 0; i < N; ++i)
+			state[i] = in[i];
+		left = (in[N] && in[N] <= (unsigned int)N) ? in[N] : 1;
+		next = state + (in[N + 1] > (unsigned int)N ? N : in[N + 1]);
+	}
 	void init(unsigned int seed = 19650218UL) {
 		state[0] = seed & 4294967295UL;
 		for (int j = 1; j < N; ++j) {
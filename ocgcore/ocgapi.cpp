@@ -13,13 +13,17 @@
 #include "effect.h"
 #include "field.h"
 #include "interpreter.h"
+#include "profiler.h"
+#include "tracer.h"
+#include "duelstate.h"
+#include "mtlock.h"
 #include <set>
 
 script_reader sreader = default_script_reader;
 card_reader creader = default_card_reader;
 message_handler mhandler = default_message_handler;
-byte buffer[0x10000];
 std::set<duel*> duel_set;
+mtlock duel_set_lock; // duels may be created and ended from several threads
 
 extern "C" DECL_DLLEXPORT void set_script_reader(script_reader f) {
 	sreader = f;
@@ -30,16 +34,24 @@ extern "C" DECL_DLLEXPORT void set_card_reader(card_reader f) {
 extern "C" DECL_DLLEXPORT void set_message_handler(message_handler f) {
 	mhandler = f;
 }
-byte* read_script(const char* script_name, int* len) {
+byte* read_script(duel* pduel, const char* script_name, int* len) {
+	if(pduel->sreader)
+		return pduel->sreader(pduel->handler_payload, script_name, len);
 	return sreader(script_name, len);
 }
-uint32 read_card(uint32 code, card_data* data) {
+uint32 read_card(duel* pduel, uint32 code, card_data* data) {
+	if(pduel->creader)
+		return pduel->creader(pduel->handler_payload, code, data);
 	return creader(code, data);
 }
-uint32 handle_message(void* pduel, uint32 msg_type) {
+uint32 handle_message(duel* pduel, uint32 msg_type) {
+	if(pduel->mhandler)
+		return pduel->mhandler(pduel->handler_payload, pduel, msg_type);
 	return mhandler(pduel, msg_type);
 }
 byte* default_script_reader(const char* script_name, int* slen) {
+	// one buffer per thread, the script is loaded before the reader is called again
+	static THREAD_LOCAL byte buffer[0x10000];
 	FILE *fp;
 	fp = fopen(script_name, "rb");
 	if (!fp)
@@ -63,8 +75,13 @@ uint32 default_message_handler(void* pduel, uint32 message_type) {
 	return 0;
 }
 extern "C" DECL_DLLEXPORT ptr create_duel(uint32 seed) {
-	duel* pduel = new duel();
+	return create_duel_ex(seed, 0, 0, 0, 0);
+}
+extern "C" DECL_DLLEXPORT ptr create_duel_ex(uint32 seed, script_reader_ex sreader, card_reader_ex creader, message_handler_ex mhandler, void* payload) {
+	duel* pduel = new duel(sreader, creader, mhandler, payload);
+	duel_set_lock.lock();
 	duel_set.insert(pduel);
+	duel_set_lock.unlock();
 	pduel->random.reset(seed);
 	return (ptr)pduel;
 }
@@ -101,10 +118,11 @@ extern "C" DECL_DLLEXPORT void start_duel(ptr pduel, int options) {
 }
 extern "C" DECL_DLLEXPORT void end_duel(ptr pduel) {
 	duel* pd = (duel*)pduel;
-	if(duel_set.count(pd)) {
-		duel_set.erase(pd);
+	duel_set_lock.lock();
+	int32 found = duel_set.erase(pd);
+	duel_set_lock.unlock();
+	if(found)
 		delete pd;
-	}
 }
 extern "C" DECL_DLLEXPORT void set_player_info(ptr pduel, int32 playerid, int32 lp, int32 startcount, int32 drawcount) {
 	duel* pd = (duel*)pduel;
@@ -118,17 +136,42 @@ extern "C" DECL_DLLEXPORT void set_player_info(ptr pduel, int32 playerid, int32
 extern "C" DECL_DLLEXPORT void get_log_message(ptr pduel, byte* buf) {
 	strcpy((char*)buf, ((duel*)pduel)->strbuffer);
 }
+//the length of the messages get_message copies, which process caps at 0xffff
+extern "C" DECL_DLLEXPORT int32 get_message_length(ptr pduel) {
+	return ((duel*)pduel)->bufferlen;
+}
 extern "C" DECL_DLLEXPORT int32 get_message(ptr pduel, byte* buf) {
 	int32 len = ((duel*)pduel)->read_buffer(buf);
 	((duel*)pduel)->clear_buffer();
 	return len;
 }
+/*
+ * Runs the processor until it writes messages, waits for a response or ends the duel.
+ * Returns the processor flags and the length of the messages, 0xffff if they are longer,
+ * so the buffer for get_message is sized with get_message_length.
+ * With a message sink the messages of every step go to the sink, and the processor runs
+ * on until it waits or ends, or the sink asks to return; the length is 0 then.
+ */
 extern "C" DECL_DLLEXPORT int32 process(ptr pduel) {
 	duel* pd = (duel*)pduel;
-	int result = pd->game_field->process();
-	while((result & 0xffff) == 0 && (result & 0xf0000) == 0)
-		result = pd->game_field->process();
-	return result;
+	int32 flags = 0;
+	while(true) {
+		flags = pd->game_field->process() - pd->bufferlen;
+		if(pd->bufferlen && pd->msink) {
+			int32 stop = pd->msink(pd->sink_payload, &pd->buffer[0], pd->bufferlen);
+			pd->clear_buffer();
+			if(stop || flags)
+				return flags;
+			continue;
+		}
+		if(pd->bufferlen || flags)
+			break;
+	}
+	return flags + (pd->bufferlen > 0xffff ? 0xffff : pd->bufferlen);
+}
+extern "C" DECL_DLLEXPORT void set_message_sink(ptr pduel, message_sink sink, void* payload) {
+	((duel*)pduel)->msink = sink;
+	((duel*)pduel)->sink_payload = payload;
 }
 extern "C" DECL_DLLEXPORT void new_card(ptr pduel, uint32 code, uint8 owner, uint8 playerid, uint8 location, uint8 sequence, uint8 position) {
 	duel* ptduel = (duel*)pduel;
@@ -284,6 +327,38 @@ extern "C" DECL_DLLEXPORT int32 query_field_card(ptr pduel, uint8 playerid, uint
 	}
 	return ct;
 }
+/*
+ * Writes the field id of each card of the location, in the order of query_field_card, and 0 for an empty zone.
+ * A card gets a new field id whenever it moves. Returns the number of ids, buf is only written when len is large enough.
+ */
+extern "C" DECL_DLLEXPORT int32 query_field_ids(ptr pduel, uint8 playerid, uint8 location, uint32* buf, int32 len) {
+	if(playerid != 0 && playerid != 1)
+		return 0;
+	field* pfield = ((duel*)pduel)->game_field;
+	field::card_vector* lst;
+	if(location == LOCATION_MZONE)
+		lst = &pfield->player[playerid].list_mzone;
+	else if(location == LOCATION_SZONE)
+		lst = &pfield->player[playerid].list_szone;
+	else if(location == LOCATION_HAND)
+		lst = &pfield->player[playerid].list_hand;
+	else if(location == LOCATION_GRAVE)
+		lst = &pfield->player[playerid].list_grave;
+	else if(location == LOCATION_REMOVED)
+		lst = &pfield->player[playerid].list_remove;
+	else if(location == LOCATION_EXTRA)
+		lst = &pfield->player[playerid].list_extra;
+	else if(location == LOCATION_DECK)
+		lst = &pfield->player[playerid].list_main;
+	else
+		return 0;
+	int32 count = lst->size();
+	if(!buf || len < count)
+		return count;
+	for(int32 i = 0; i < count; ++i)
+		buf[i] = (*lst)[i] ? (*lst)[i]->fieldid : 0;
+	return count;
+}
 extern "C" DECL_DLLEXPORT int32 query_field_info(ptr pduel, byte* buf) {
 	duel* ptduel = (duel*)pduel;
 	*buf++ = MSG_RELOAD_FIELD;
@@ -340,3 +415,71 @@ extern "C" DECL_DLLEXPORT void set_responseb(ptr pduel, byte* buf) {
 extern "C" DECL_DLLEXPORT int32 preload_script(ptr pduel, char* script, int32 len) {
 	return ((duel*)pduel)->lua->load_script(script);
 }
+/*
+ * Writes the state of the duel, see duelstate.h: the field, the cards, groups and effects, the processor,
+ * the random state, the pending messages and the references and globals of the scripts.
+ * Returns the size of the state, buf is only written when len is large enough.
+ * Returns 0 if the duel cannot be saved now, while a script waits in a coroutine,
+ * or if the scripts hold a value that cannot be saved.
+ */
+extern "C" DECL_DLLEXPORT int32 save_duel_state(ptr pduel, byte* buf, int32 len) {
+	std::vector<byte> data;
+	if(!duel_state::save((duel*)pduel, &data))
+		return 0;
+	int32 size = data.size();
+	if(!buf || len < size)
+		return size;
+	memcpy(buf, &data[0], size);
+	return size;
+}
+/*
+ * Creates a duel from a state written by save_duel_state(...), with the given callbacks.
+ * The duel continues where the saved one was, with the same messages pending.
+ * Returns 0 if the state is not valid.
+ */
+extern "C" DECL_DLLEXPORT ptr load_duel_state(byte* buf, int32 len, script_reader_ex sreader, card_reader_ex creader, message_handler_ex mhandler, void* payload) {
+	if(len <= 0)
+		return 0;
+	ptr pduel = create_duel_ex(0, sreader, creader, mhandler, payload);
+	if(!duel_state::load((duel*)pduel, buf, len)) {
+		end_duel(pduel);
+		return 0;
+	}
+	return pduel;
+}
+/*
+ * Starts timing the calls into the scripts of the duel, or stops it. Starting again drops what was recorded.
+ * The profiling is not part of the duel state and does not change the duel.
+ */
+extern "C" DECL_DLLEXPORT void set_profiling(ptr pduel, int32 enable) {
+	((duel*)pduel)->lua->set_profiling(enable);
+}
+/*
+ * Writes the report of the profiler as text or binary, see lua_profiler::write_report(...).
+ * Returns the size of the report, nothing is written if len is less than it. Returns 0 if the duel is not profiled.
+ */
+extern "C" DECL_DLLEXPORT int32 get_profile_report(ptr pduel, byte* buf, int32 len, int32 text) {
+	lua_profiler* profiler = ((duel*)pduel)->lua->profiler;
+	if(!profiler)
+		return 0;
+	return profiler->write_report(buf, len, text);
+}
+/*
+ * Starts tracing the processor steps of the duel, or stops it and drops the trace.
+ * Starting again drops what was recorded, the tracing is not part of the duel state.
+ */
+extern "C" DECL_DLLEXPORT void set_tracing(ptr pduel, int32 enable) {
+	duel* pd = (duel*)pduel;
+	delete pd->tracer;
+	pd->tracer = enable ? new processor_tracer : 0;
+}
+/*
+ * Writes the trace in the format TRACE_FORMAT_CHROME, TRACE_FORMAT_FOLDED or TRACE_FORMAT_STEPS, see processor_tracer::write_report(...).
+ * Returns the size of the report, nothing is written if len is less than it. Returns 0 if the duel is not traced.
+ */
+extern "C" DECL_DLLEXPORT int32 get_trace_report(ptr pduel, byte* buf, int32 len, int32 format) {
+	processor_tracer* tracer = ((duel*)pduel)->tracer;
+	if(!tracer)
+		return 0;
+	return tracer->write_report(buf, len, format);
+}
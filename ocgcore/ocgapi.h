@@ -22,35 +22,53 @@ struct card_info;
 class group;
 class effect;
 class interpreter;
+class duel;
 
 typedef byte* (*script_reader)(const char*, int*);
 typedef uint32 (*card_reader)(uint32, card_data*);
 typedef uint32 (*message_handler)(void*, uint32);
+//per duel callbacks, the first argument is the payload given to create_duel_ex
+typedef byte* (*script_reader_ex)(void*, const char*, int*);
+typedef uint32 (*card_reader_ex)(void*, uint32, card_data*);
+typedef uint32 (*message_handler_ex)(void*, void*, uint32);
+//receives the messages of a processor step: payload, messages, length; a nonzero return makes process return
+//the duel must not be ended in the sink
+typedef int32 (*message_sink)(void*, byte*, uint32);
 
 extern "C" DECL_DLLEXPORT void set_script_reader(script_reader f);
 extern "C" DECL_DLLEXPORT void set_card_reader(card_reader f);
 extern "C" DECL_DLLEXPORT void set_message_handler(message_handler f);
 
-byte* read_script(const char* script_name, int* len);
-uint32 read_card(uint32 code, card_data* data);
-uint32 handle_message(void* pduel, uint32 message_type);
+byte* read_script(duel* pduel, const char* script_name, int* len);
+uint32 read_card(duel* pduel, uint32 code, card_data* data);
+uint32 handle_message(duel* pduel, uint32 message_type);
 
 extern "C" DECL_DLLEXPORT ptr create_duel(uint32 seed);
+extern "C" DECL_DLLEXPORT ptr create_duel_ex(uint32 seed, script_reader_ex sreader, card_reader_ex creader, message_handler_ex mhandler, void* payload);
 extern "C" DECL_DLLEXPORT void start_duel(ptr pduel, int32 options);
 extern "C" DECL_DLLEXPORT void end_duel(ptr pduel);
 extern "C" DECL_DLLEXPORT void set_player_info(ptr pduel, int32 playerid, int32 lp, int32 startcount, int32 drawcount);
 extern "C" DECL_DLLEXPORT void get_log_message(ptr pduel, byte* buf);
+extern "C" DECL_DLLEXPORT int32 get_message_length(ptr pduel);
 extern "C" DECL_DLLEXPORT int32 get_message(ptr pduel, byte* buf);
 extern "C" DECL_DLLEXPORT int32 process(ptr pduel);
+extern "C" DECL_DLLEXPORT void set_message_sink(ptr pduel, message_sink sink, void* payload);
 extern "C" DECL_DLLEXPORT void new_card(ptr pduel, uint32 code, uint8 owner, uint8 playerid, uint8 location, uint8 sequence, uint8 position);
 extern "C" DECL_DLLEXPORT void new_tag_card(ptr pduel, uint32 code, uint8 owner, uint8 location);
 extern "C" DECL_DLLEXPORT int32 query_card(ptr pduel, uint8 playerid, uint8 location, uint8 sequence, int32 query_flag, byte* buf, int32 use_cache);
 extern "C" DECL_DLLEXPORT int32 query_field_count(ptr pduel, uint8 playerid, uint8 location);
 extern "C" DECL_DLLEXPORT int32 query_field_card(ptr pduel, uint8 playerid, uint8 location, int32 query_flag, byte* buf, int32 use_cache);
+extern "C" DECL_DLLEXPORT int32 query_field_ids(ptr pduel, uint8 playerid, uint8 location, uint32* buf, int32 len);
 extern "C" DECL_DLLEXPORT int32 query_field_info(ptr pduel, byte* buf);
 extern "C" DECL_DLLEXPORT void set_responsei(ptr pduel, int32 value);
 extern "C" DECL_DLLEXPORT void set_responseb(ptr pduel, byte* buf);
 extern "C" DECL_DLLEXPORT int32 preload_script(ptr pduel, char* script, int32 len);
+extern "C" DECL_DLLEXPORT int32 save_duel_state(ptr pduel, byte* buf, int32 len);
+extern "C" DECL_DLLEXPORT ptr load_duel_state(byte* buf, int32 len, script_reader_ex sreader, card_reader_ex creader, message_handler_ex mhandler, void* payload);
+extern "C" DECL_DLLEXPORT void set_profiling(ptr pduel, int32 enable);
+extern "C" DECL_DLLEXPORT int32 get_profile_report(ptr pduel, byte* buf, int32 len, int32 text);
+extern "C" DECL_DLLEXPORT void set_tracing(ptr pduel, int32 enable);
+extern "C" DECL_DLLEXPORT int32 get_trace_report(ptr pduel, byte* buf, int32 len, int32 format);
 byte* default_script_reader(const char* script_name, int* len);
 uint32 default_card_reader(uint32 code, card_data* data);
 uint32 default_message_handler(void* pduel, uint32 msg_type);
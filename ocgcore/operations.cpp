@@ -309,7 +309,8 @@ int32 field::draw(uint16 step, effect* reason_effect, uint32 reason, uint8 reaso
 			return TRUE;
 		}
 		core.overdraw[playerid] = FALSE;
-		group* drawed_set = new group;
+		group* drawed_set = pduel->new_group();
+		drawed_set->is_readonly = TRUE;
 		core.units.begin()->ptarget = drawed_set;
 		for(uint32 i = 0; i < count; ++i) {
 			if(player[playerid].list_main.size() == 0) {
@@ -388,7 +389,7 @@ int32 field::draw(uint16 step, effect* reason_effect, uint32 reason, uint8 reaso
 	case 1: {
 		group* drawed_set = core.units.begin()->ptarget;
 		core.operated_set = drawed_set->container;
-		delete drawed_set;
+		pduel->delete_group(drawed_set);
 		returns.ivalue[0] = count;
 		return TRUE;
 	}
@@ -1846,7 +1847,8 @@ int32 field::sset(uint16 step, uint8 setplayer, uint8 toplayer, card * target) {
 int32 field::sset_g(uint16 step, uint8 setplayer, uint8 toplayer, group* ptarget) {
 	switch(step) {
 	case 0: {
-		card_set* set_cards = new card_set;
+		group* set_cards = pduel->new_group();
+		set_cards->is_readonly = TRUE;
 		core.operated_set.clear();
 		for(auto cit = ptarget->container.begin(); cit != ptarget->container.end(); ++cit) {
 			card* target = *cit;
@@ -1857,27 +1859,25 @@ int32 field::sset_g(uint16 step, uint8 setplayer, uint8 toplayer, group* ptarget
 			        || (target->is_affected_by_effect(EFFECT_CANNOT_SSET))) {
 				continue;
 			}
-			set_cards->insert(target);
+			set_cards->container.insert(target);
 		}
-		if(set_cards->empty()) {
-			delete set_cards;
+		if(set_cards->container.empty()) {
+			pduel->delete_group(set_cards);
 			returns.ivalue[0] = 0;
 			return TRUE;
 		}
 		core.phase_action = TRUE;
-		core.units.begin()->ptarget = (group*)set_cards;
+		core.units.begin()->ptarget = set_cards;
 		return FALSE;
 	}
 	case 1: {
-		card_set* set_cards = (card_set*)ptarget;
-		card* target = *set_cards->begin();
+		card* target = *ptarget->container.begin();
 		target->enable_field_effect(FALSE);
 		move_to_field(target, setplayer, toplayer, LOCATION_SZONE, POS_FACEDOWN, FALSE);
 		return FALSE;
 	}
 	case 2: {
-		card_set* set_cards = (card_set*)ptarget;
-		card* target = *set_cards->begin();
+		card* target = *ptarget->container.begin();
 		target->set_status(STATUS_SET_TURN, TRUE);
 		if(target->data.type & TYPE_MONSTER) {
 			effect* peffect = target->is_affected_by_effect(EFFECT_MONSTER_SSET);
@@ -1897,11 +1897,11 @@ int32 field::sset_g(uint16 step, uint8 setplayer, uint8 toplayer, group* ptarget
 		pduel->write_buffer8(target->current.sequence);
 		pduel->write_buffer8(target->current.position);
 		core.operated_set.insert(target);
-		set_cards->erase(target);
-		if(!set_cards->empty())
+		ptarget->container.erase(target);
+		if(!ptarget->container.empty())
 			core.units.begin()->step = 0;
 		else
-			delete set_cards;
+			pduel->delete_group(ptarget);
 		return FALSE;
 	}
 	case 3: {
@@ -12,6 +12,7 @@
 #include "effect.h"
 #include "interpreter.h"
 #include "ocgapi.h"
+#include "tracer.h"
 #include <iterator>
 
 void field::add_process(uint16 type, uint16 step, effect* peffect, group* target, ptr arg1, ptr arg2) {
@@ -25,10 +26,23 @@ void field::add_process(uint16 type, uint16 step, effect* peffect, group* target
 	core.subunits.push_back(new_unit);
 }
 int32 field::process() {
+	// no lookup of the field effects is in progress between two steps
+	effects.compact();
 	if (core.subunits.size())
-		core.units.splice(core.units.begin(), core.subunits);
+		core.units.push_front(core.subunits);
 	if (core.units.size() == 0)
 		return PROCESSOR_END + pduel->bufferlen;
+	core.steps++;
+	processor_tracer* tracer = pduel->tracer;
+	if (!tracer)
+		return process_unit();
+	tracer->begin_step(core.units);
+	int32 result = process_unit();
+	tracer->end_step(core.units);
+	return result;
+}
+// runs a step of the front unit
+int32 field::process_unit() {
 	processor_list::iterator it = core.units.begin();
 	switch (it->type) {
 	case PROCESSOR_ADJUST: {
@@ -1963,8 +1977,10 @@ int32 field::process_point_event(int16 step, int32 special, int32 skip_new) {
 			e.reason_effect = 0;
 			e.reason = 0;
 			e.reason_player = PLAYER_NONE;
-			for(auto eit = effects.ignition_effect.begin(); eit != effects.ignition_effect.end(); ++eit) {
-				effect* peffect = eit->second;
+			effect_vector ignition_effects;
+			effects.ignition_effect.collect(&ignition_effects);
+			for(auto eit = ignition_effects.begin(); eit != ignition_effects.end(); ++eit) {
+				effect* peffect = *eit;
 				e.event_code = peffect->code;
 				if(peffect->handler->current.location == LOCATION_MZONE && peffect->is_chainable(infos.turn_player)
 				        && peffect->is_activateable(infos.turn_player, e)) {
@@ -2566,8 +2582,10 @@ int32 field::process_idle_command(uint16 step) {
 			if(peffect->is_activateable(infos.turn_player, nil_event))
 				core.select_chains.push_back(newchain);
 		}
-		for(eit = effects.ignition_effect.begin(); eit != effects.ignition_effect.end(); ++eit) {
-			peffect = eit->second;
+		effect_vector ignition_effects;
+		effects.ignition_effect.collect(&ignition_effects);
+		for(auto igit = ignition_effects.begin(); igit != ignition_effects.end(); ++igit) {
+			peffect = *igit;
 			peffect->s_range = peffect->handler->current.location;
 			peffect->o_range = peffect->handler->current.sequence;
 			newchain.triggering_effect = peffect;
@@ -0,0 +1,158 @@
+/*
+ * profiler.cpp
+ */
+
+#include "profiler.h"
+#include "duel.h"
+#include "interpreter.h"
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+
+void lua_profiler::add_lib(lua_CFunction f, const std::string& name) {
+	lib_stat& stat = libs[f];
+	stat.name = name;
+	stat.count = 0;
+}
+void lua_profiler::begin(uint32 code, const char* name) {
+	pending_call call;
+	call.code = code;
+	call.name = name;
+	call.start = now();
+	pending.push_back(call);
+}
+// the call of the function at index, which is not called yet
+void lua_profiler::begin(lua_State* L, int32 index) {
+	pending_call call;
+	call.code = 0;
+	lua_Debug ar;
+	lua_pushvalue(L, index);
+	lua_getinfo(L, ">S", &ar);
+	if(ar.what[0] == 'C') {
+		lib_map::iterator it = libs.find(lua_tocfunction(L, index));
+		call.name = it != libs.end() ? it->second.name : "[C]";
+	} else {
+		const char* script = strrchr(ar.source, '/');
+		script = script ? script + 1 : ar.source;
+		sscanf(script, "c%u.lua", &call.code);
+		char line[16];
+		sprintf(line, ":%d", ar.linedefined);
+		call.name = std::string(script) + line;
+	}
+	call.start = now();
+	pending.push_back(call);
+}
+void lua_profiler::end() {
+	uint64 time = now();
+	if(pending.empty())
+		return;
+	pending_call& call = pending.back();
+	time -= call.start;
+	call_map::iterator it = calls.find(std::make_pair(call.code, call.name));
+	if(it == calls.end()) {
+		call_stat stat = { 0, 0, 0 };
+		it = calls.insert(std::make_pair(std::make_pair(call.code, call.name), stat)).first;
+	}
+	it->second.count++;
+	it->second.total += time;
+	if(time > it->second.max)
+		it->second.max = time;
+	pending.pop_back();
+}
+static void write_bytes(std::vector<byte>* report, const void* data, uint32 size) {
+	const byte* p = (const byte*)data;
+	report->insert(report->end(), p, p + size);
+}
+static bool longer_call(const std::pair<const std::pair<uint32, std::string>, lua_profiler::call_stat>* a,
+                        const std::pair<const std::pair<uint32, std::string>, lua_profiler::call_stat>* b) {
+	return a->second.total > b->second.total;
+}
+static bool more_calls(const lua_profiler::lib_stat* a, const lua_profiler::lib_stat* b) {
+	return a->count > b->count || (a->count == b->count && a->name < b->name);
+}
+/*
+ * Writes the calls by total time and the library functions that were called by count, returns the size of the report.
+ * Nothing is written if len is less than the size.
+ * binary: [calls:4] then for each call [code:4][count:4][total ns:8][max ns:8][name length:2][name],
+ * [functions:4] then for each function [count:4][name length:2][name]
+ * text: a tab separated line for each call and each function, the times in microseconds
+ */
+int32 lua_profiler::write_report(byte* buf, int32 len, int32 text) {
+	std::vector<const call_map::value_type*> call_list;
+	for(call_map::iterator it = calls.begin(); it != calls.end(); ++it)
+		call_list.push_back(&*it);
+	std::stable_sort(call_list.begin(), call_list.end(), longer_call);
+	std::vector<const lib_stat*> lib_list;
+	for(lib_map::iterator it = libs.begin(); it != libs.end(); ++it)
+		if(it->second.count)
+			lib_list.push_back(&it->second);
+	std::sort(lib_list.begin(), lib_list.end(), more_calls);
+	std::vector<byte> report;
+	if(text) {
+		char line[64];
+		const char* header = "code\tfunction\tcalls\ttotal_us\tmax_us\n";
+		write_bytes(&report, header, strlen(header));
+		for(uint32 i = 0; i < call_list.size(); ++i) {
+			const call_stat& stat = call_list[i]->second;
+			sprintf(line, "%u\t", call_list[i]->first.first);
+			write_bytes(&report, line, strlen(line));
+			write_bytes(&report, call_list[i]->first.second.c_str(), call_list[i]->first.second.size());
+			sprintf(line, "\t%llu\t%.3f\t%.3f\n", (unsigned long long)stat.count, stat.total / 1000.0, stat.max / 1000.0);
+			write_bytes(&report, line, strlen(line));
+		}
+		header = "\nlibrary function\tcalls\n";
+		write_bytes(&report, header, strlen(header));
+		for(uint32 i = 0; i < lib_list.size(); ++i) {
+			write_bytes(&report, lib_list[i]->name.c_str(), lib_list[i]->name.size());
+			sprintf(line, "\t%llu\n", (unsigned long long)lib_list[i]->count);
+			write_bytes(&report, line, strlen(line));
+		}
+	} else {
+		uint32 count = call_list.size();
+		write_bytes(&report, &count, 4);
+		for(uint32 i = 0; i < call_list.size(); ++i) {
+			const call_stat& stat = call_list[i]->second;
+			const std::string& name = call_list[i]->first.second;
+			uint16 length = name.size();
+			count = stat.count;
+			write_bytes(&report, &call_list[i]->first.first, 4);
+			write_bytes(&report, &count, 4);
+			write_bytes(&report, &stat.total, 8);
+			write_bytes(&report, &stat.max, 8);
+			write_bytes(&report, &length, 2);
+			write_bytes(&report, name.c_str(), length);
+		}
+		count = lib_list.size();
+		write_bytes(&report, &count, 4);
+		for(uint32 i = 0; i < lib_list.size(); ++i) {
+			uint16 length = lib_list[i]->name.size();
+			count = lib_list[i]->count;
+			write_bytes(&report, &count, 4);
+			write_bytes(&report, &length, 2);
+			write_bytes(&report, lib_list[i]->name.c_str(), length);
+		}
+	}
+	int32 size = report.size();
+	if(!buf || len < size)
+		return size;
+	memcpy(buf, &report[0], size);
+	return size;
+}
+uint64 lua_profiler::now() {
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+// set with LUA_MASKCALL on the states of a profiled duel, coroutines get it from the main state
+void lua_profiler::count_hook(lua_State* L, lua_Debug* ar) {
+	lua_profiler* profiler = interpreter::get_duel_info(L)->lua->profiler;
+	if(!profiler)
+		return;
+	lua_getinfo(L, "f", ar);
+	lua_CFunction f = lua_tocfunction(L, -1);
+	lua_pop(L, 1);
+	if(!f)
+		return;
+	lib_map::iterator it = profiler->libs.find(f);
+	if(it != profiler->libs.end())
+		it->second.count++;
+}
@@ -0,0 +1,60 @@
+/*
+ * profiler.h
+ * Timing of the calls into Lua, enabled per duel with set_profiling(...) of ocgapi.
+ * A call is keyed by the card code and the function: the name for card functions like
+ * initial_effect, the script and the line it is defined at for other functions.
+ * The time of a call includes the calls nested in it. A find_matching(...) loop counts as one call of its filter.
+ * The functions of the script libraries (Card, Duel, ...) are counted with a call hook of Lua.
+ */
+
+#ifndef PROFILER_H_
+#define PROFILER_H_
+
+extern "C" {
+#ifdef WIN32
+#include <lua/lua.h>
+#else
+#include <lua.h>
+#endif
+}
+#include "common.h"
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+class lua_profiler {
+public:
+	struct call_stat {
+		uint64 count;
+		uint64 total; // nanoseconds
+		uint64 max;
+	};
+	struct lib_stat {
+		std::string name;
+		uint64 count;
+	};
+	struct pending_call {
+		uint32 code;
+		std::string name;
+		uint64 start;
+	};
+	typedef std::map<std::pair<uint32, std::string>, call_stat> call_map;
+	typedef std::unordered_map<lua_CFunction, lib_stat> lib_map;
+
+	call_map calls;
+	lib_map libs;
+	std::vector<pending_call> pending;
+
+	void add_lib(lua_CFunction f, const std::string& name);
+	void begin(uint32 code, const char* name);
+	void begin(lua_State* L, int32 index);
+	void end();
+	int32 write_report(byte* buf, int32 len, int32 text);
+
+	static uint64 now();
+	static void count_hook(lua_State* L, lua_Debug* ar);
+};
+
+#endif /* PROFILER_H_ */
@@ -47,6 +47,13 @@ int32 scriptlib::check_param(lua_State* L, int32 param_type, int32 index, int32
 			return FALSE;
 		luaL_error(L, "Parameter %d should be \"Function\".", index);
 		break;
+	case PARAM_TYPE_FILTER:
+		if (lua_isfunction(L, index) || interpreter::get_filter(L, index))
+			return TRUE;
+		if(retfalse)
+			return FALSE;
+		luaL_error(L, "Parameter %d should be \"Function\" or \"CardFilter\".", index);
+		break;
 	case PARAM_TYPE_STRING:
 		if (lua_isstring(L, index))
 			return TRUE;
@@ -491,6 +491,9 @@ public:
 	static int32 duel_venom_swamp_check(lua_State *L);
 	static int32 duel_swap_deck_and_grave(lua_State *L);
 	static int32 duel_majestic_copy(lua_State *L);
+	static int32 duel_create_filter(lua_State *L);
+	static int32 card_filter_call(lua_State *L);
+	static int32 filter_restore(lua_State *L);
 	
 	//preload
 	static int32 debug_message(lua_State *L);
@@ -0,0 +1,95 @@
+/*
+ * slabpool.h
+ * A per duel pool for the cards, groups and effects of a duel.
+ * Objects are placed in slabs of fixed size, freed slots are reused,
+ * and the live objects are tracked in a vector so that the whole pool
+ * can be released at once when the duel ends.
+ */
+
+#ifndef SLABPOOL_H_
+#define SLABPOOL_H_
+
+#include "common.h"
+#include <new>
+#include <vector>
+
+template<class T, int32 SLAB_SIZE = 128>
+class slab_pool {
+public:
+	typedef typename std::vector<T*>::iterator iterator;
+
+	slab_pool(): current(0), used(0), free_list(0) {}
+	~slab_pool() {
+		clear();
+		for(auto sit = slabs.begin(); sit != slabs.end(); ++sit)
+			delete[] *sit;
+	}
+	T* alloc() {
+		slot* s = free_list;
+		if(s)
+			free_list = s->next_free;
+		else {
+			if(used == SLAB_SIZE) {
+				current++;
+				used = 0;
+			}
+			if(current == slabs.size())
+				slabs.push_back(new slot[SLAB_SIZE]);
+			s = &slabs[current][used++];
+		}
+		T* obj = new (s->storage.data) T();
+		s->live_index = live.size();
+		live.push_back(obj);
+		return obj;
+	}
+	void free(T* obj) {
+		slot* s = (slot*)obj;
+		T* last = live.back();
+		live[s->live_index] = last;
+		((slot*)last)->live_index = s->live_index;
+		live.pop_back();
+		obj->~T();
+		s->next_free = free_list;
+		free_list = s;
+	}
+	// destroys all live objects, the slabs are kept for the next use
+	void clear() {
+		for(auto it = live.begin(); it != live.end(); ++it)
+			(*it)->~T();
+		live.clear();
+		current = 0;
+		used = 0;
+		free_list = 0;
+	}
+	uint32 size() const {
+		return live.size();
+	}
+	iterator begin() {
+		return live.begin();
+	}
+	iterator end() {
+		return live.end();
+	}
+
+private:
+	struct slot {
+		// storage must stay the first member, a T* is cast back to its slot
+		union {
+			char data[sizeof(T)];
+			int64 align_int;
+			double align_double;
+			void* align_ptr;
+		} storage;
+		union {
+			uint32 live_index;
+			slot* next_free;
+		};
+	};
+	std::vector<slot*> slabs;
+	std::vector<T*> live;
+	uint32 current; // the slab new slots are taken from
+	int32 used; // slots handed out from the current slab
+	slot* free_list;
+};
+
+#endif /* SLABPOOL_H_ */
@@ -0,0 +1,120 @@
+/*
+ * sumcheck.cpp
+ */
+
+#include "sumcheck.h"
+#include <vector>
+
+// dst |= src << shift, both with words words; src may be dst
+static void shift_or(uint64* dst, const uint64* src, uint32 words, uint32 shift) {
+	uint32 ws = shift >> 6, bs = shift & 63;
+	for(uint32 j = words; j-- > ws;) {
+		uint64 w = src[j - ws] << bs;
+		if(bs && j > ws)
+			w |= src[j - ws - 1] >> (64 - bs);
+		dst[j] |= w;
+	}
+}
+static int32 test_bit(const uint64* bits, uint32 i) {
+	return (bits[i >> 6] >> (i & 63)) & 1;
+}
+// whether a bit from 'from' to 'to' is set
+static int32 test_range(const uint64* bits, uint32 from, uint32 to) {
+	for(uint32 w = from >> 6; w <= to >> 6; ++w) {
+		uint64 mask = ~0ULL;
+		if(w == from >> 6)
+			mask &= ~0ULL << (from & 63);
+		if(w == to >> 6)
+			mask &= ~0ULL >> (63 - (to & 63));
+		if(bits[w] & mask)
+			return TRUE;
+	}
+	return FALSE;
+}
+/*
+ * The cards are taken in order, as the recursive search did: reach[k] holds the sums
+ * below acc of k cards from the ones before, a card ends the check if it makes up the
+ * rest of acc, otherwise it is added to every sum that stays below acc.
+ */
+int32 check_sum_limit(const uint32* params, uint32 size, int32 acc, int32 chosen, int32 min, int32 max) {
+	if(acc <= 0 || size == 0)
+		return FALSE;
+	int32 hi = max - chosen;
+	if(hi > (int32)size)
+		hi = size;
+	int32 lo = min - chosen;
+	if(lo < 1)
+		lo = 1;
+	if(hi < lo)
+		return FALSE;
+	int64 total = 0;
+	for(uint32 i = 0; i < size; ++i) {
+		uint32 o1 = params[i] & 0xffff;
+		uint32 o2 = params[i] >> 16;
+		total += o1 > o2 ? o1 : o2;
+	}
+	if(total < acc)
+		return FALSE;
+	uint32 words = ((uint32)acc + 63) >> 6;
+	uint64 last_mask = (acc & 63) ? (1ULL << (acc & 63)) - 1 : ~0ULL;
+	std::vector<uint64> reach(words * hi, 0);
+	reach[0] = 1;
+	for(uint32 i = 0; i < size; ++i) {
+		uint32 o1 = params[i] & 0xffff;
+		uint32 o2 = params[i] >> 16;
+		int32 top = (int32)i < hi - 1 ? (int32)i : hi - 1;
+		for(int32 k = lo - 1; k <= top; ++k) {
+			const uint64* bits = &reach[k * words];
+			if((o1 && o1 <= (uint32)acc && test_bit(bits, acc - o1))
+			        || (o2 && o2 <= (uint32)acc && test_bit(bits, acc - o2)))
+				return TRUE;
+		}
+		if(top > hi - 2)
+			top = hi - 2;
+		for(int32 k = top; k >= 0; --k) {
+			uint64* dst = &reach[(k + 1) * words];
+			const uint64* src = &reach[k * words];
+			if(o1 < (uint32)acc)
+				shift_or(dst, src, words, o1);
+			if(o2 && o2 < (uint32)acc)
+				shift_or(dst, src, words, o2);
+			dst[words - 1] &= last_mask;
+		}
+	}
+	return FALSE;
+}
+/*
+ * A sum reaching min already matches if it is not above max, so only the sums below min
+ * are kept while adding the values.
+ */
+int32 check_sum_range(const uint32* values, uint32 size, int32 min, int32 max) {
+	if(min <= 0) {
+		for(uint32 i = 0; i < size; ++i)
+			if((int32)values[i] <= max)
+				return TRUE;
+		return FALSE;
+	}
+	int64 total = 0;
+	for(uint32 i = 0; i < size; ++i)
+		total += values[i];
+	if(total < min || max < min)
+		return FALSE;
+	uint32 words = ((uint32)min + 63) >> 6;
+	uint64 last_mask = (min & 63) ? (1ULL << (min & 63)) - 1 : ~0ULL;
+	std::vector<uint64> reach(words, 0);
+	reach[0] = 1;
+	for(uint32 i = 0; i < size; ++i) {
+		int32 m = values[i];
+		if(m <= max) {
+			int32 from = m >= min ? 0 : min - m;
+			int32 to = max - m < min - 1 ? max - m : min - 1;
+			if(from <= to && test_range(&reach[0], from, to))
+				return TRUE;
+		}
+		if(m < min) {
+			shift_or(&reach[0], &reach[0], words, m);
+			reach[words - 1] &= last_mask;
+		}
+	}
+	return FALSE;
+}
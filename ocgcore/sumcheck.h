@@ -0,0 +1,20 @@
+/*
+ * sumcheck.h
+ * Subset sum checks over operation params, shared by the core and the client.
+ * A param holds one value in the low 16 bits and an optional second value in the
+ * high 16 bits (e.g. the two synchro levels of a card); a chosen card counts with one of them.
+ * The sums reachable with each number of chosen cards are kept as bitsets, so a check
+ * takes size * count * acc / 64 steps instead of trying every subset.
+ */
+
+#ifndef SUMCHECK_H_
+#define SUMCHECK_H_
+
+#include "common.h"
+
+// whether some of the params, added to the chosen ones, sum exactly to acc with min to max cards in total
+int32 check_sum_limit(const uint32* params, uint32 size, int32 acc, int32 chosen, int32 min, int32 max);
+// whether some of the values sum to at least min and at most max
+int32 check_sum_range(const uint32* values, uint32 size, int32 min, int32 max);
+
+#endif /* SUMCHECK_H_ */
@@ -0,0 +1,242 @@
+/*
+ * tracer.cpp
+ */
+
+#include "tracer.h"
+#include "field.h"
+#include <stdio.h>
+#include <string.h>
+#include <chrono>
+#include <map>
+#include <string>
+
+processor_tracer::processor_tracer() {
+	start = now();
+	step_start = start;
+	step_type = 0;
+	step = 0;
+	dropped = 0;
+}
+// enters the units below the front that were added before the tracing started, and the front if it is new
+void processor_tracer::begin_step(processor_stack& units) {
+	uint64 time = now() - start;
+	while(open.size() < units.size()) {
+		uint16 type = units.at_depth(open.size()).type;
+		open.push_back(type);
+		record(time, 0, type, 0, open.size(), TRACE_ENTER);
+	}
+	step_type = units.begin()->type;
+	step = units.begin()->step;
+	step_start = now();
+}
+// a unit is exited when the queue gets shorter than its depth, the units added by the step are not in it yet
+void processor_tracer::end_step(processor_stack& units) {
+	uint64 time = now();
+	record(step_start - start, time - step_start, step_type, step, open.size(), TRACE_STEP);
+	time -= start;
+	while(open.size() > units.size()) {
+		record(time, 0, open.back(), 0, open.size(), TRACE_EXIT);
+		open.pop_back();
+	}
+}
+void processor_tracer::record(uint64 time, uint64 duration, uint16 type, uint16 step, uint16 depth, uint8 phase) {
+	if(events.size() >= TRACE_MAX_EVENTS) {
+		dropped++;
+		return;
+	}
+	trace_event event;
+	event.time = time;
+	event.duration = duration;
+	event.type = type;
+	event.step = step;
+	event.depth = depth;
+	event.phase = phase;
+	events.push_back(event);
+}
+/*
+ * Returns the size of the report, nothing is written if len is less than it.
+ * TRACE_FORMAT_CHROME: a JSON object of trace events, a unit is a duration event and a step
+ * a complete event in it, for chrome://tracing or Perfetto.
+ * TRACE_FORMAT_FOLDED: one line for each stack of units and step with the nanoseconds spent in the step,
+ * for flamegraph.pl and similar tools. The time between two calls of process() is not in the steps.
+ * TRACE_FORMAT_STEPS: one "<unit> <step> <runs> <nanoseconds>" line for each step of each unit type,
+ * the time of a step whatever unit it ran in.
+ */
+int32 processor_tracer::write_report(byte* buf, int32 len, int32 format) {
+	std::string report;
+	char line[128];
+	char name[32];
+	if(format == TRACE_FORMAT_STEPS) {
+		std::map<std::pair<uint16, uint16>, std::pair<uint64, uint64> > steps;
+		for(uint32 i = 0; i < events.size(); ++i) {
+			const trace_event& event = events[i];
+			if(event.phase != TRACE_STEP)
+				continue;
+			std::pair<uint64, uint64>& total = steps[std::make_pair(event.type, event.step)];
+			total.first++;
+			total.second += event.duration;
+		}
+		for(std::map<std::pair<uint16, uint16>, std::pair<uint64, uint64> >::iterator it = steps.begin(); it != steps.end(); ++it) {
+			sprintf(line, "%s %d %llu %llu\n", unit_name(it->first.first, name), it->first.second,
+			        (unsigned long long)it->second.first, (unsigned long long)it->second.second);
+			report += line;
+		}
+	} else if(format == TRACE_FORMAT_FOLDED) {
+		std::map<std::string, uint64> stacks;
+		std::vector<std::string> path;
+		for(uint32 i = 0; i < events.size(); ++i) {
+			const trace_event& event = events[i];
+			if(event.phase == TRACE_ENTER) {
+				std::string frame = path.empty() ? std::string() : path.back() + ";";
+				path.push_back(frame + unit_name(event.type, name));
+			} else if(event.phase == TRACE_EXIT) {
+				if(!path.empty())
+					path.pop_back();
+			} else {
+				sprintf(line, "step %d", event.step);
+				stacks[(path.empty() ? std::string() : path.back() + ";") + line] += event.duration;
+			}
+		}
+		for(std::map<std::string, uint64>::iterator it = stacks.begin(); it != stacks.end(); ++it) {
+			sprintf(line, " %llu\n", (unsigned long long)it->second);
+			report += it->first + line;
+		}
+	} else {
+		report = "{\"traceEvents\":[";
+		for(uint32 i = 0; i < events.size(); ++i) {
+			const trace_event& event = events[i];
+			const char* separator = i ? ",\n" : "\n";
+			const char* uname = unit_name(event.type, name);
+			if(event.phase == TRACE_STEP)
+				sprintf(line, "%s{\"name\":\"step %d\",\"cat\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":1,\"tid\":1}",
+				        separator, event.step, uname, event.time / 1000.0, event.duration / 1000.0);
+			else
+				sprintf(line, "%s{\"name\":\"%s\",\"ph\":\"%c\",\"ts\":%.3f,\"pid\":1,\"tid\":1,\"args\":{\"depth\":%d}}",
+				        separator, uname, event.phase == TRACE_ENTER ? 'B' : 'E', event.time / 1000.0, event.depth);
+			report += line;
+		}
+		sprintf(line, "\n],\"otherData\":{\"dropped_events\":\"%u\"}}\n", dropped);
+		report += line;
+	}
+	int32 size = report.size();
+	if(!buf || len < size)
+		return size;
+	memcpy(buf, report.c_str(), size);
+	return size;
+}
+uint64 processor_tracer::now() {
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+#define UNIT_NAME(t) case PROCESSOR_##t: return #t;
+// the name of the PROCESSOR_ constant without the prefix, buf is used for an unknown type
+const char* processor_tracer::unit_name(uint16 type, char* buf) {
+	switch(type) {
+	UNIT_NAME(ADJUST)
+	UNIT_NAME(HINT)
+	UNIT_NAME(TURN)
+	UNIT_NAME(WAIT)
+	UNIT_NAME(REFRESH_LOC)
+	UNIT_NAME(SELECT_IDLECMD)
+	UNIT_NAME(SELECT_EFFECTYN)
+	UNIT_NAME(SELECT_BATTLECMD)
+	UNIT_NAME(SELECT_YESNO)
+	UNIT_NAME(SELECT_OPTION)
+	UNIT_NAME(SELECT_CARD)
+	UNIT_NAME(SELECT_CHAIN)
+	UNIT_NAME(SELECT_PLACE)
+	UNIT_NAME(SELECT_POSITION)
+	UNIT_NAME(SELECT_TRIBUTE_P)
+	UNIT_NAME(SORT_CHAIN)
+	UNIT_NAME(SELECT_COUNTER)
+	UNIT_NAME(SELECT_SUM)
+	UNIT_NAME(SELECT_DISFIELD)
+	UNIT_NAME(SORT_CARD)
+	UNIT_NAME(SELECT_RELEASE)
+	UNIT_NAME(SELECT_TRIBUTE)
+	UNIT_NAME(POINT_EVENT)
+	UNIT_NAME(QUICK_EFFECT)
+	UNIT_NAME(IDLE_COMMAND)
+	UNIT_NAME(PHASE_EVENT)
+	UNIT_NAME(BATTLE_COMMAND)
+	UNIT_NAME(DAMAGE_STEP)
+	UNIT_NAME(ADD_CHAIN)
+	UNIT_NAME(SOLVE_CHAIN)
+	UNIT_NAME(SOLVE_CONTINUOUS)
+	UNIT_NAME(EXECUTE_COST)
+	UNIT_NAME(EXECUTE_OPERATION)
+	UNIT_NAME(EXECUTE_TARGET)
+	UNIT_NAME(DESTROY)
+	UNIT_NAME(RELEASE)
+	UNIT_NAME(SENDTO)
+	UNIT_NAME(MOVETOFIELD)
+	UNIT_NAME(CHANGEPOS)
+	UNIT_NAME(OPERATION_REPLACE)
+	UNIT_NAME(DESTROY_STEP)
+	UNIT_NAME(RELEASE_STEP)
+	UNIT_NAME(SENDTO_STEP)
+	UNIT_NAME(SUMMON_RULE)
+	UNIT_NAME(SPSUMMON_RULE)
+	UNIT_NAME(SPSUMMON)
+	UNIT_NAME(FLIP_SUMMON)
+	UNIT_NAME(MSET)
+	UNIT_NAME(SSET)
+	UNIT_NAME(SPSUMMON_STEP)
+	UNIT_NAME(SSET_G)
+	UNIT_NAME(DRAW)
+	UNIT_NAME(DAMAGE)
+	UNIT_NAME(RECOVER)
+	UNIT_NAME(EQUIP)
+	UNIT_NAME(GET_CONTROL)
+	UNIT_NAME(SWAP_CONTROL)
+	UNIT_NAME(CONTROL_ADJUST)
+	UNIT_NAME(PAY_LPCOST)
+	UNIT_NAME(REMOVE_COUNTER)
+	UNIT_NAME(ATTACK_DISABLE)
+	UNIT_NAME(DESTROY_S)
+	UNIT_NAME(RELEASE_S)
+	UNIT_NAME(SENDTO_S)
+	UNIT_NAME(CHANGEPOS_S)
+	UNIT_NAME(ANNOUNCE_RACE)
+	UNIT_NAME(ANNOUNCE_ATTRIB)
+	UNIT_NAME(ANNOUNCE_LEVEL)
+	UNIT_NAME(ANNOUNCE_CARD)
+	UNIT_NAME(ANNOUNCE_TYPE)
+	UNIT_NAME(ANNOUNCE_NUMBER)
+	UNIT_NAME(ANNOUNCE_COIN)
+	UNIT_NAME(TOSS_DICE)
+	UNIT_NAME(TOSS_COIN)
+	UNIT_NAME(SELECT_YESNO_S)
+	UNIT_NAME(SELECT_OPTION_S)
+	UNIT_NAME(SELECT_CARD_S)
+	UNIT_NAME(SELECT_EFFECTYN_S)
+	UNIT_NAME(SELECT_PLACE_S)
+	UNIT_NAME(SELECT_POSITION_S)
+	UNIT_NAME(SELECT_TRIBUTE_S)
+	UNIT_NAME(SORT_CARDS_S)
+	UNIT_NAME(SELECT_RELEASE_S)
+	UNIT_NAME(SELECT_TARGET)
+	UNIT_NAME(SELECT_FUSION)
+	UNIT_NAME(SELECT_SYNCHRO)
+	UNIT_NAME(SELECT_SUM_S)
+	UNIT_NAME(SELECT_DISFIELD_S)
+	UNIT_NAME(SPSUMMON_S)
+	UNIT_NAME(SPSUMMON_STEP_S)
+	UNIT_NAME(SPSUMMON_COMP_S)
+	UNIT_NAME(RANDOM_SELECT_S)
+	UNIT_NAME(SELECT_XMATERIAL)
+	UNIT_NAME(DRAW_S)
+	UNIT_NAME(DAMAGE_S)
+	UNIT_NAME(RECOVER_S)
+	UNIT_NAME(EQUIP_S)
+	UNIT_NAME(GET_CONTROL_S)
+	UNIT_NAME(SWAP_CONTROL_S)
+	UNIT_NAME(DISCARD_HAND_S)
+	UNIT_NAME(DISCARD_DECK_S)
+	UNIT_NAME(SORT_DECK_S)
+	UNIT_NAME(REMOVEOL_S)
+	UNIT_NAME(MOVETOFIELD_S)
+	}
+	sprintf(buf, "UNIT_%d", type);
+	return buf;
+}
+#undef UNIT_NAME
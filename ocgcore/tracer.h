@@ -0,0 +1,58 @@
+/*
+ * tracer.h
+ * Tracing of the processor, enabled per duel with set_tracing(...) of ocgapi.
+ * Every step of field::process() is recorded with the type of the unit, its step and the
+ * depth of the unit in the processor queue. A unit is entered at its first traced step
+ * and exited when it is removed from the queue, the units it added run inside it.
+ * The trace is written as Chrome trace events, as folded stacks for flame graphs or as totals per step.
+ */
+
+#ifndef TRACER_H_
+#define TRACER_H_
+
+#include "common.h"
+#include <vector>
+
+class processor_stack;
+
+#define TRACE_ENTER		1
+#define TRACE_EXIT		2
+#define TRACE_STEP		3
+
+#define TRACE_FORMAT_CHROME	0
+#define TRACE_FORMAT_FOLDED	1
+#define TRACE_FORMAT_STEPS	2
+
+#define TRACE_MAX_EVENTS	0x400000
+
+class processor_tracer {
+public:
+	struct trace_event {
+		uint64 time; // nanoseconds since the tracing started
+		uint64 duration; // of a step
+		uint16 type;
+		uint16 step;
+		uint16 depth;
+		uint8 phase;
+	};
+
+	std::vector<trace_event> events;
+	std::vector<uint16> open; // the types of the entered units, by depth
+	uint64 start;
+	uint64 step_start;
+	uint16 step_type;
+	uint16 step;
+	uint32 dropped; // events not recorded after TRACE_MAX_EVENTS
+
+	processor_tracer();
+	void begin_step(processor_stack& units);
+	void end_step(processor_stack& units);
+	int32 write_report(byte* buf, int32 len, int32 format);
+
+	static uint64 now();
+	static const char* unit_name(uint16 type, char* buf);
+private:
+	void record(uint64 time, uint64 duration, uint16 type, uint16 step, uint16 depth, uint8 phase);
+};
+
+#endif /* TRACER_H_ */
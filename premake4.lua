@@ -50,6 +50,8 @@ solution "ygo"
 
     include "ocgcore"
     include "gframe"
+    include "replayrunner"
+    include "scriptscan"
     if os.is("windows") then
     include "event"
     include "freetype"
@@ -0,0 +1,206 @@
+#include "benchmark.h"
+#include "../ocgcore/field.h"
+#include "../ocgcore/sumcheck.h"
+#include "../ocgcore/mtrandom.h"
+#include <stdio.h>
+#include <string.h>
+#include <chrono>
+
+namespace ygo {
+
+#define START_ROUNDS	5
+#define SUMCHECK_CASES	300000
+#define SUMCHECK_REPEAT	10000
+#define FILTER_DUELS	10
+
+static double Seconds(std::chrono::high_resolution_clock::time_point start) {
+	return std::chrono::duration_cast<std::chrono::duration<double> >(std::chrono::high_resolution_clock::now() - start).count();
+}
+
+int Benchmark::Run(const char* name, const std::vector<std::string>& files) {
+	if(!strcmp(name, "sumcheck"))
+		return SumCheck();
+	if(strcmp(name, "start") && strcmp(name, "filter")) {
+		fprintf(stderr, "unknown benchmark %s\n", name);
+		return 1;
+	}
+	std::vector<ReplayFile> replays;
+	for(size_t f = 0; f < files.size(); ++f) {
+		replays.push_back(ReplayFile());
+		if(!replays.back().Open(files[f].c_str())) {
+			fprintf(stderr, "%s: cannot read replay\n", files[f].c_str());
+			replays.pop_back();
+		}
+	}
+	if(replays.empty()) {
+		fprintf(stderr, "no readable replays\n");
+		return 2;
+	}
+	if(!strcmp(name, "filter"))
+		return MatchingFilter(replays);
+	return DuelStart(replays);
+}
+/*
+ * create_duel + start_duel latency with a new Lua state for every duel, as before the state pool,
+ * and with pooled states. The duels are built from the decks of the replays; the time to the first
+ * response also counts the first processor steps, which load the rest of the card scripts.
+ */
+int Benchmark::DuelStart(std::vector<ReplayFile>& replays) {
+	const char* modes[2] = { "new state", "pooled state" };
+	double start_avg[2];
+	for(int m = 0; m < 2; ++m) {
+		script_reader_ex sreader = m ? 0 : (script_reader_ex)ReplayRunner::ScriptReader;
+		double start_total = 0, start_min = 0, start_max = 0, first_total = 0;
+		unsigned int duels = 0;
+		//one duel first, it fills the script cache and leaves a state in the pool
+		DuelResult result;
+		memset(&result, 0, sizeof(result));
+		replays[0].pos = 0;
+		end_duel(ReplayRunner::CreateDuel(replays[0], result, sreader));
+		for(int round = 0; round < START_ROUNDS; ++round) {
+			for(size_t r = 0; r < replays.size(); ++r) {
+				memset(&result, 0, sizeof(result));
+				replays[r].pos = 0;
+				std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+				ptr pduel = ReplayRunner::CreateDuel(replays[r], result, sreader);
+				double start_time = Seconds(start);
+				while(!(process(pduel) & (PROCESSOR_END | PROCESSOR_WAITING)))
+					;
+				double first_time = Seconds(start);
+				end_duel(pduel);
+				if(!duels || start_time < start_min)
+					start_min = start_time;
+				if(start_time > start_max)
+					start_max = start_time;
+				start_total += start_time;
+				first_total += first_time;
+				duels++;
+			}
+		}
+		start_avg[m] = start_total / duels;
+		printf("%s: %u duels, create_duel + start_duel avg %.3f ms, min %.3f ms, max %.3f ms, to the first response avg %.3f ms\n",
+		       modes[m], duels, start_avg[m] * 1000, start_min * 1000, start_max * 1000, first_total * 1000 / duels);
+	}
+	if(start_avg[1] > 0)
+		printf("create_duel + start_duel speedup with pooled states: %.2fx\n", start_avg[0] / start_avg[1]);
+	return 0;
+}
+
+//field::check_with_sum_limit before the bitset solver, every card is skipped or taken with one of its values
+static int RecursiveSumLimit(const std::vector<uint32>& params, int acc, size_t index, int count, int min, int max) {
+	if(index >= params.size())
+		return FALSE;
+	int op1 = params[index] & 0xffff;
+	int op2 = (params[index] >> 16) & 0xffff;
+	if((op1 == acc || op2 == acc) && count >= min && count <= max)
+		return TRUE;
+	return (acc > op1 && RecursiveSumLimit(params, acc - op1, index + 1, count + 1, min, max))
+	       || (op2 && acc > op2 && RecursiveSumLimit(params, acc - op2, index + 1, count + 1, min, max))
+	       || RecursiveSumLimit(params, acc, index + 1, count, min, max);
+}
+/*
+ * check_sum_limit against the recursive search it replaced: both have to agree on random groups,
+ * then both are timed on the worst case of the recursion, materials with two even levels
+ * (2 or 4, like a card whose level can be changed) and an odd sum that nothing reaches.
+ */
+int Benchmark::SumCheck() {
+	mtrandom rnd(0x5e7c4ec);
+	unsigned int mismatches = 0;
+	for(int c = 0; c < SUMCHECK_CASES; ++c) {
+		std::vector<uint32> params(1 + rnd.rand() % 12);
+		for(size_t p = 0; p < params.size(); ++p) {
+			uint32 op1 = 1 + rnd.rand() % 12;
+			uint32 op2 = (rnd.rand() & 1) ? 1 + rnd.rand() % 12 : 0;
+			params[p] = op1 | (op2 << 16);
+		}
+		int acc = 1 + rnd.rand() % 60;
+		int count = 1 + rnd.rand() % 3;
+		int min = 1 + rnd.rand() % params.size();
+		int max = min + rnd.rand() % 3;
+		//field::check_with_sum_limit passes the cards chosen before the group
+		if(!RecursiveSumLimit(params, acc, 0, count, min, max) != !check_sum_limit(&params[0], params.size(), acc, count - 1, min, max))
+			mismatches++;
+	}
+	printf("%d random groups, %u results differ from the recursive search\n", SUMCHECK_CASES, mismatches);
+	for(int size = 10; size <= 18; size += 2) {
+		std::vector<uint32> params(size, 2 | (4 << 16));
+		int acc = size * 3 + 1;
+		std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+		int old_result = RecursiveSumLimit(params, acc, 0, 1, 1, size);
+		double old_time = Seconds(start);
+		int result = 0;
+		start = std::chrono::high_resolution_clock::now();
+		for(int r = 0; r < SUMCHECK_REPEAT; ++r)
+			result |= check_sum_limit(&params[0], params.size(), acc, 0, 1, size);
+		double new_time = Seconds(start) / SUMCHECK_REPEAT;
+		if(!old_result != !result)
+			mismatches++;
+		printf("%d materials of level 2/4, sum %d: recursive %.3f ms, bitset %.3f us, %.0fx\n",
+		       size, acc, old_time * 1000, new_time * 1e6, new_time > 0 ? old_time / new_time : 0.0);
+	}
+	return mismatches ? 3 : 0;
+}
+
+//the scans of the filter benchmark, the same condition as a Lua closure and as a CardFilter
+static const char closure_script[] =
+	"local f = function(c) return c:IsType(TYPE_MONSTER) and c:IsAbleToHand() end\n"
+	"for i = 1, 2000 do Duel.GetMatchingGroup(f, 0, LOCATION_DECK + LOCATION_HAND, LOCATION_DECK + LOCATION_HAND, nil) end\n";
+static const char filter_script[] =
+	"local f = Duel.CreateFilter{ type = TYPE_MONSTER, abletohand = true }\n"
+	"local g = function(c) return c:IsType(TYPE_MONSTER) and c:IsAbleToHand() end\n"
+	"if Duel.GetMatchingGroupCount(f, 0, LOCATION_DECK + LOCATION_HAND, LOCATION_DECK + LOCATION_HAND, nil)\n"
+	"  ~= Duel.GetMatchingGroupCount(g, 0, LOCATION_DECK + LOCATION_HAND, LOCATION_DECK + LOCATION_HAND, nil) then\n"
+	"  error(\"the filter and the closure match different cards\")\n"
+	"end\n"
+	"for i = 1, 2000 do Duel.GetMatchingGroup(f, 0, LOCATION_DECK + LOCATION_HAND, LOCATION_DECK + LOCATION_HAND, nil) end\n";
+static byte* FilterScriptReader(void* payload, const char* script_name, int* len) {
+	if(!strcmp(script_name, "closure_scan")) {
+		*len = sizeof(closure_script) - 1;
+		return (byte*)closure_script;
+	}
+	if(!strcmp(script_name, "filter_scan")) {
+		*len = sizeof(filter_script) - 1;
+		return (byte*)filter_script;
+	}
+	return default_script_reader(script_name, len);
+}
+/*
+ * Duel.GetMatchingGroup over both decks and hands, 2000 times with a Lua closure and 2000 times with
+ * the equivalent CardFilter, in the duels of the first replays once they wait for their first response.
+ */
+int Benchmark::MatchingFilter(std::vector<ReplayFile>& replays) {
+	char closure_name[] = "closure_scan";
+	char filter_name[] = "filter_scan";
+	double closure_time = 0, filter_time = 0;
+	unsigned int duels = 0, errors = 0;
+	for(size_t r = 0; r < replays.size() && r < FILTER_DUELS; ++r) {
+		DuelResult result;
+		memset(&result, 0, sizeof(result));
+		replays[r].pos = 0;
+		ptr pduel = ReplayRunner::CreateDuel(replays[r], result, (script_reader_ex)FilterScriptReader);
+		while(!(process(pduel) & (PROCESSOR_END | PROCESSOR_WAITING)))
+			;
+		std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+		preload_script(pduel, closure_name, 0);
+		closure_time += Seconds(start);
+		start = std::chrono::high_resolution_clock::now();
+		preload_script(pduel, filter_name, 0);
+		filter_time += Seconds(start);
+		end_duel(pduel);
+		errors += result.script_errors;
+		duels++;
+	}
+	unsigned int scans = duels * 2000;
+	printf("Duel.GetMatchingGroup on both decks and hands, %u scans in %u duels\n", scans, duels);
+	printf("Lua closure: %.3f ms, %.3f us per scan\n", closure_time * 1000, closure_time * 1e6 / scans);
+	printf("CardFilter: %.3f ms, %.3f us per scan\n", filter_time * 1000, filter_time * 1e6 / scans);
+	if(filter_time > 0)
+		printf("speedup: %.2fx\n", closure_time / filter_time);
+	if(errors) {
+		printf("%u script errors, the timings are not valid\n", errors);
+		return 3;
+	}
+	return 0;
+}
+
+}
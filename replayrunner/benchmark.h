@@ -0,0 +1,21 @@
+#ifndef BENCHMARK_H
+#define BENCHMARK_H
+
+#include "replay_runner.h"
+#include <string>
+#include <vector>
+
+namespace ygo {
+
+//timings of parts of the engine, run on one thread, most of them with the duels of the replays
+class Benchmark {
+public:
+	static int Run(const char* name, const std::vector<std::string>& files);
+	static int DuelStart(std::vector<ReplayFile>& replays);
+	static int SumCheck();
+	static int MatchingFilter(std::vector<ReplayFile>& replays);
+};
+
+}
+
+#endif //BENCHMARK_H
@@ -0,0 +1,302 @@
+#include "replay_runner.h"
+#include "benchmark.h"
+#include <errno.h>
+#include "../gframe/mythread.h"
+#include "../gframe/mymutex.h"
+#include "../gframe/mysignal.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <map>
+#include <algorithm>
+#include <chrono>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <dirent.h>
+#include <strings.h>
+#endif
+
+//replays shared by the worker threads, each worker takes the next one
+struct RunQueue {
+	bool check_states;
+	bool trace_adjust;
+	std::vector<std::string> files;
+	std::vector<ygo::DuelResult> results;
+	std::vector<char> loaded;
+	size_t next;
+	Mutex mutex;
+};
+struct RunWorker {
+	RunQueue* queue;
+	Signal done;
+};
+
+static void ListReplays(const char* dir, std::vector<std::string>& files) {
+	std::string path(dir);
+	if(!path.empty() && path[path.size() - 1] != '/' && path[path.size() - 1] != '\\')
+		path += '/';
+#ifdef _WIN32
+	WIN32_FIND_DATAA fdata;
+	HANDLE fh = FindFirstFileA((path + "*.yrp").c_str(), &fdata);
+	if(fh == INVALID_HANDLE_VALUE)
+		return;
+	do {
+		if(!(fdata.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY))
+			files.push_back(path + fdata.cFileName);
+	} while(FindNextFileA(fh, &fdata));
+	FindClose(fh);
+#else
+	DIR * pdir;
+	struct dirent * dirp;
+	if((pdir = opendir(path.c_str())) == NULL)
+		return;
+	while((dirp = readdir(pdir)) != NULL) {
+		size_t len = strlen(dirp->d_name);
+		if(len < 5 || strcasecmp(dirp->d_name + len - 4, ".yrp") != 0)
+			continue;
+		files.push_back(path + dirp->d_name);
+	}
+	closedir(pdir);
+#endif
+	std::sort(files.begin(), files.end());
+}
+static std::string BaseName(const std::string& file) {
+	size_t pos = file.find_last_of("/\\");
+	return pos == std::string::npos ? file : file.substr(pos + 1);
+}
+//digest files have one "<digest in hex> <replay file name>" line per replay
+static bool LoadDigests(const char* file, std::map<std::string, unsigned int>& digests) {
+	FILE* fp = fopen(file, "r");
+	if(!fp)
+		return false;
+	char linebuf[512];
+	while(fgets(linebuf, 512, fp)) {
+		char* name = strchr(linebuf, ' ');
+		if(!name)
+			continue;
+		*name++ = 0;
+		size_t len = strlen(name);
+		while(len && (name[len - 1] == '\n' || name[len - 1] == '\r'))
+			name[--len] = 0;
+		digests[name] = strtoul(linebuf, 0, 16);
+	}
+	fclose(fp);
+	return true;
+}
+static int RunReplays(void* param) {
+	RunWorker* worker = (RunWorker*)param;
+	RunQueue* queue = worker->queue;
+	while(true) {
+		queue->mutex.Lock();
+		size_t index = queue->next++;
+		queue->mutex.Unlock();
+		if(index >= queue->files.size())
+			break;
+		queue->loaded[index] = ygo::ReplayRunner::RunReplay(queue->files[index].c_str(), queue->results[index], queue->check_states, queue->trace_adjust);
+	}
+	worker->done.Set();
+	return 0;
+}
+//runs every replay of the queue once on this many threads, returns the wall time
+static double RunAll(RunQueue& queue, int threads) {
+	queue.next = 0;
+	std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+	std::vector<RunWorker*> workers;
+	for(int t = 0; t < threads; ++t) {
+		RunWorker* worker = new RunWorker;
+		worker->queue = &queue;
+		workers.push_back(worker);
+		Thread::NewThread(RunReplays, worker);
+	}
+	for(size_t t = 0; t < workers.size(); ++t) {
+		workers[t]->done.Wait();
+		delete workers[t];
+	}
+	return std::chrono::duration_cast<std::chrono::duration<double> >(std::chrono::high_resolution_clock::now() - start).count();
+}
+
+int main(int argc, char* argv[]) {
+	int threads = 1;
+	const char* write_file = 0;
+	const char* check_file = 0;
+	bool check_states = false;
+	bool trace_adjust = false;
+	const char* benchmark = 0;
+	int stress_rounds = 0;
+	int i = 1;
+	for(; i < argc && argv[i][0] == '-'; ++i) {
+		if(!strcmp(argv[i], "-t") && i + 1 < argc)
+			threads = atoi(argv[++i]);
+		else if(!strcmp(argv[i], "-w") && i + 1 < argc)
+			write_file = argv[++i];
+		else if(!strcmp(argv[i], "-c") && i + 1 < argc)
+			check_file = argv[++i];
+		else if(!strcmp(argv[i], "-s"))
+			check_states = true;
+		else if(!strcmp(argv[i], "-a"))
+			trace_adjust = true;
+		else if(!strcmp(argv[i], "-b") && i + 1 < argc)
+			benchmark = argv[++i];
+		else if(!strcmp(argv[i], "-x") && i + 1 < argc)
+			stress_rounds = atoi(argv[++i]);
+		else
+			break;
+	}
+	//the benchmarks of the engine alone run without replays
+	if(benchmark && i >= argc)
+		return ygo::Benchmark::Run(benchmark, std::vector<std::string>());
+	if(i >= argc) {
+		fprintf(stderr, "usage: %s [-t threads] [-w digest file | -c digest file] [-s] [-a] [-x rounds] [-b benchmark] <replay dir> [cards.cdb]\n", argv[0]);
+		fprintf(stderr, "  -t  run the replays on this many threads\n");
+		fprintf(stderr, "  -w  write the final state digest of every replay\n");
+		fprintf(stderr, "  -c  compare the final state of every replay with the digests and report divergences\n");
+		fprintf(stderr, "  -s  save and restore the duel before every response and compare the continuations (slow)\n");
+		fprintf(stderr, "  -a  trace the processor and report the time spent in each step of PROCESSOR_ADJUST\n");
+		fprintf(stderr, "  -x  stress test: take the digests on one thread, then run and check the replays this many times on -t threads\n");
+		fprintf(stderr, "  -b  time a part of the engine with the duels of the replays instead of running them:\n");
+		fprintf(stderr, "      start     create_duel + start_duel with new and with pooled Lua states\n");
+		fprintf(stderr, "      filter    Duel.GetMatchingGroup with a Lua closure and with the same CardFilter\n");
+		fprintf(stderr, "      sumcheck  the level sum solver against the recursive search it replaced, needs no replays\n");
+		fprintf(stderr, "scripts are loaded from ./script/ in the working directory\n");
+		return 1;
+	}
+	if(threads < 1)
+		threads = 1;
+	const char* dir = argv[i];
+	const char* db = i + 1 < argc ? argv[i + 1] : "cards.cdb";
+	if(!ygo::ReplayRunner::LoadCards(db)) {
+		fprintf(stderr, "cannot load card database %s\n", db);
+		return 1;
+	}
+	std::map<std::string, unsigned int> expected;
+	if(check_file && !LoadDigests(check_file, expected)) {
+		fprintf(stderr, "cannot read digest file %s\n", check_file);
+		return 1;
+	}
+	RunQueue queue;
+	ListReplays(dir, queue.files);
+	if(queue.files.empty()) {
+		fprintf(stderr, "no replays found in %s\n", dir);
+		return 1;
+	}
+	if(benchmark)
+		return ygo::Benchmark::Run(benchmark, queue.files);
+	queue.results.resize(queue.files.size());
+	queue.loaded.resize(queue.files.size());
+	queue.check_states = check_states;
+	queue.trace_adjust = trace_adjust;
+	bool checking = check_file != 0;
+	unsigned int stress_diverged = 0;
+	if(stress_rounds > 0) {
+		//the expected digests come from duels that never run next to another one
+		RunAll(queue, 1);
+		expected.clear();
+		for(size_t f = 0; f < queue.files.size(); ++f)
+			if(queue.loaded[f])
+				expected[BaseName(queue.files[f])] = queue.results[f].digest;
+		checking = true;
+		//all rounds but the last are only checked, the last one is reported below
+		for(int round = 1; round < stress_rounds; ++round) {
+			RunAll(queue, threads);
+			unsigned int round_diverged = 0;
+			for(size_t f = 0; f < queue.files.size(); ++f) {
+				auto eit = expected.find(BaseName(queue.files[f]));
+				if(queue.loaded[f] && eit != expected.end() && eit->second != queue.results[f].digest) {
+					printf("%s: DIVERGED in round %d: expected %08x, got %08x\n", queue.files[f].c_str(), round, eit->second, queue.results[f].digest);
+					round_diverged++;
+				}
+			}
+			printf("stress round %d of %d on %d threads: %u diverged\n", round, stress_rounds, threads, round_diverged);
+			stress_diverged += round_diverged;
+		}
+	}
+	double total = RunAll(queue, threads);
+	FILE* digest_fp = 0;
+	if(write_file && !(digest_fp = fopen(write_file, "w")))
+		fprintf(stderr, "cannot write digest file %s\n", write_file);
+	unsigned int duels = 0, failed = 0, diverged = 0, unchecked = 0, state_checks = 0, state_mismatches = 0;
+	unsigned long long messages = 0, batches = 0, bytes = 0, allocations = 0, responses = 0, steps = 0;
+	double duel_time = 0, max_time = 0, max_response = 0;
+	unsigned long long traced = 0, adjust_runs[ADJUST_STEPS] = { 0 }, adjust_nanoseconds[ADJUST_STEPS] = { 0 };
+	for(size_t f = 0; f < queue.files.size(); ++f) {
+		const std::string& file = queue.files[f];
+		ygo::DuelResult& result = queue.results[f];
+		if(!queue.loaded[f]) {
+			printf("%s: cannot read replay\n", file.c_str());
+			failed++;
+			continue;
+		}
+		printf("%s: %.3f ms, %u responses, %llu processor steps, %llu messages in %u batches, %llu bytes, %u script errors, %llu allocations, max response %.3f ms, digest %08x\n", file.c_str(),
+		       result.seconds * 1000, result.responses, result.steps, result.messages, result.batches, result.bytes, result.script_errors, result.allocations,
+		       result.max_response_seconds * 1000, result.digest);
+		if(digest_fp)
+			fprintf(digest_fp, "%08x %s\n", result.digest, BaseName(file).c_str());
+		if(checking) {
+			auto eit = expected.find(BaseName(file));
+			if(eit == expected.end()) {
+				printf("  no expected digest\n");
+				unchecked++;
+			} else if(eit->second != result.digest) {
+				printf("  DIVERGED: expected %08x, winner %d reason %d\n", eit->second, result.winner, result.win_reason);
+				diverged++;
+			}
+		}
+		if(check_states) {
+			if(result.state_mismatches)
+				printf("  RESTORE MISMATCH: %u of %u restored states continued differently\n", result.state_mismatches, result.state_checks);
+			state_checks += result.state_checks;
+			state_mismatches += result.state_mismatches;
+		}
+		duels++;
+		messages += result.messages;
+		batches += result.batches;
+		bytes += result.bytes;
+		allocations += result.allocations;
+		responses += result.responses;
+		steps += result.steps;
+		duel_time += result.seconds;
+		if(result.seconds > max_time)
+			max_time = result.seconds;
+		if(result.max_response_seconds > max_response)
+			max_response = result.max_response_seconds;
+		traced += result.traced_nanoseconds;
+		for(int s = 0; s < ADJUST_STEPS; ++s) {
+			adjust_runs[s] += result.adjust_runs[s];
+			adjust_nanoseconds[s] += result.adjust_nanoseconds[s];
+		}
+	}
+	if(digest_fp)
+		fclose(digest_fp);
+	printf("\n%u duels, %u unreadable, %.3f s total on %d threads\n", duels, failed, total, threads);
+	if(duels && total > 0) {
+		printf("duels/sec: %.2f\n", duels / total);
+		printf("processor steps/sec: %.0f (%.0f per thread while a duel runs)\n", steps / total, duel_time > 0 ? steps / duel_time : 0.0);
+		printf("messages/sec: %.0f (%.0f batches/sec), message bytes/sec: %.0f\n", messages / total, batches / total, bytes / total);
+		printf("per duel: avg %.3f ms, max %.3f ms\n", duel_time * 1000 / duels, max_time * 1000);
+		printf("allocations: %.0f per duel, %.1f per response; longest response %.3f ms\n",
+		       (double)allocations / duels, responses ? (double)allocations / responses : 0.0, max_response * 1000);
+	}
+	if(checking)
+		printf("%u diverged, %u without expected digest\n", diverged, unchecked);
+	if(stress_rounds > 0)
+		printf("stress test: %u divergences in %d rounds on %d threads against one thread\n", stress_diverged + diverged, stress_rounds, threads);
+	if(check_states)
+		printf("%u restored states, %u mismatched\n", state_checks, state_mismatches);
+	if(trace_adjust && traced) {
+		unsigned long long adjust_total = 0;
+		for(int s = 0; s < ADJUST_STEPS; ++s)
+			adjust_total += adjust_nanoseconds[s];
+		printf("PROCESSOR_ADJUST: %.3f ms of %.3f ms traced processor time (%.1f%%)\n",
+		       adjust_total / 1e6, traced / 1e6, adjust_total * 100.0 / traced);
+		printf("  step        runs    total ms   avg us\n");
+		for(int s = 0; s < ADJUST_STEPS; ++s)
+			if(adjust_runs[s])
+				printf("  %4d  %10llu  %10.3f  %7.3f\n", s, adjust_runs[s], adjust_nanoseconds[s] / 1e6, adjust_nanoseconds[s] / 1e3 / adjust_runs[s]);
+	}
+	if(diverged || stress_diverged || state_mismatches)
+		return 3;
+	return failed ? 2 : 0;
+}
@@ -0,0 +1,14 @@
+project "replayrunner"
+    kind "ConsoleApp"
+
+    files { "**.cpp", "**.h" }
+    includedirs { "../ocgcore" }
+    links { "ocgcore", "clzma", "sqlite3", "lua" }
+
+    configuration "windows"
+        includedirs { "../sqlite3" }
+    configuration "not vs*"
+        buildoptions { "-std=gnu++0x" }
+    configuration "not windows"
+        includedirs { "/usr/include/lua", "/usr/include/lua5.2", "/usr/include/lua/5.2" }
+        links { "dl", "pthread" }
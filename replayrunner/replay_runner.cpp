@@ -0,0 +1,468 @@
+#include "replay_runner.h"
+#include "../ocgcore/duel.h"
+#include "../ocgcore/field.h"
+#include "../ocgcore/mtrandom.h"
+#include "../ocgcore/tracer.h"
+#include "../gframe/lzma/LzmaLib.h"
+#include <stdio.h>
+#include <string.h>
+#include <chrono>
+#include <new>
+#include <stdlib.h>
+#include <sqlite3.h>
+
+//counts the heap allocations of the engine and the runner on each thread
+static THREAD_LOCAL unsigned long long allocation_count = 0;
+void* operator new(size_t size) {
+	allocation_count++;
+	void* p = malloc(size ? size : 1);
+	if(!p)
+		throw std::bad_alloc();
+	return p;
+}
+void operator delete(void* p) throw() {
+	free(p);
+}
+
+namespace ygo {
+
+std::unordered_map<unsigned int, card_data> ReplayRunner::cards;
+
+bool ReplayFile::Open(const char* file) {
+	FILE* fp = fopen(file, "rb");
+	if(!fp)
+		return false;
+	fseek(fp, 0, SEEK_END);
+	long size = ftell(fp);
+	fseek(fp, 0, SEEK_SET);
+	if(size < (long)sizeof(header) || fread(&header, sizeof(header), 1, fp) != 1) {
+		fclose(fp);
+		return false;
+	}
+	std::vector<unsigned char> raw(size - sizeof(header));
+	if(raw.size() && fread(&raw[0], raw.size(), 1, fp) != 1) {
+		fclose(fp);
+		return false;
+	}
+	fclose(fp);
+	if(header.id != 0x31707279 || header.version < 0x12d0)
+		return false;
+	if((header.flag & REPLAY_CHUNKED) && header.version < REPLAY_CHUNKED_VERSION)
+		return false;
+	if(header.flag & REPLAY_CHUNKED) {
+		//int raw_size, int comp_size and the compressed block, see gframe/replay.cpp
+		size_t block = 0;
+		data.clear();
+		while(block + 8 <= raw.size()) {
+			size_t block_size = *((int*)&raw[block]);
+			size_t comp_size = *((int*)&raw[block + 4]);
+			if(!block_size || block + 8 + comp_size > raw.size())
+				return false;
+			size_t data_start = data.size();
+			data.resize(data_start + block_size);
+			if(LzmaUncompress(&data[data_start], &block_size, &raw[block + 8], &comp_size, header.props, 5) != SZ_OK)
+				return false;
+			data.resize(data_start + block_size);
+			block += 8 + *((int*)&raw[block + 4]);
+		}
+	} else if(header.flag & REPLAY_COMPRESSED) {
+		size_t replay_size = header.datasize;
+		size_t comp_size = raw.size();
+		data.resize(replay_size);
+		if(!replay_size || LzmaUncompress(&data[0], &replay_size, &raw[0], &comp_size, header.props, 5) != SZ_OK)
+			return false;
+		data.resize(replay_size);
+	} else
+		data.swap(raw);
+	pos = 0;
+	return true;
+}
+void ReplayFile::ReadData(void* dest, unsigned int length) {
+	if(pos + length > data.size()) {
+		memset(dest, 0, length);
+		pos = data.size();
+		return;
+	}
+	memcpy(dest, &data[pos], length);
+	pos += length;
+}
+int ReplayFile::ReadInt32() {
+	int ret;
+	ReadData(&ret, 4);
+	return ret;
+}
+bool ReplayFile::ReadNextResponse(unsigned char resp[64]) {
+	if(pos >= data.size())
+		return false;
+	int len = data[pos++];
+	if(len > 64 || pos + len > data.size())
+		return false;
+	memcpy(resp, &data[pos], len);
+	pos += len;
+	return true;
+}
+
+bool ReplayRunner::LoadCards(const char* file) {
+	sqlite3* pDB;
+	if(sqlite3_open(file, &pDB) != SQLITE_OK) {
+		sqlite3_close(pDB);
+		return false;
+	}
+	sqlite3_stmt* pStmt;
+	const char* sql = "select * from datas";
+	if(sqlite3_prepare_v2(pDB, sql, -1, &pStmt, 0) != SQLITE_OK) {
+		sqlite3_close(pDB);
+		return false;
+	}
+	card_data cd;
+	int step;
+	while((step = sqlite3_step(pStmt)) == SQLITE_ROW) {
+		cd.code = sqlite3_column_int(pStmt, 0);
+		cd.alias = sqlite3_column_int(pStmt, 2);
+		cd.setcode = sqlite3_column_int64(pStmt, 3);
+		cd.type = sqlite3_column_int(pStmt, 4);
+		cd.attack = sqlite3_column_int(pStmt, 5);
+		cd.defence = sqlite3_column_int(pStmt, 6);
+		unsigned int level = sqlite3_column_int(pStmt, 7);
+		cd.level = level & 0xff;
+		cd.lscale = (level >> 24) & 0xff;
+		cd.rscale = (level >> 16) & 0xff;
+		cd.race = sqlite3_column_int(pStmt, 8);
+		cd.attribute = sqlite3_column_int(pStmt, 9);
+		cards[cd.code] = cd;
+	}
+	sqlite3_finalize(pStmt);
+	sqlite3_close(pDB);
+	return step == SQLITE_DONE;
+}
+/*
+ * Builds and starts the duel of a replay read from its start, the way ReplayMode does.
+ * A duel with its own script reader gets a new Lua state instead of a pooled one.
+ */
+ptr ReplayRunner::CreateDuel(ReplayFile& replay, DuelResult& result, script_reader_ex sreader) {
+	mtrandom rnd;
+	rnd.reset(replay.header.seed);
+	//player names
+	replay.pos += (replay.header.flag & REPLAY_TAG) ? 160 : 80;
+	ptr pduel = create_duel_ex(rnd.rand(), sreader, (card_reader_ex)CardReader, (message_handler_ex)MessageHandler, &result);
+	int start_lp = replay.ReadInt32();
+	int start_hand = replay.ReadInt32();
+	int draw_count = replay.ReadInt32();
+	int opt = replay.ReadInt32();
+	set_player_info(pduel, 0, start_lp, start_hand, draw_count);
+	set_player_info(pduel, 1, start_lp, start_hand, draw_count);
+	for(int p = 0; p < 2; ++p) {
+		int main = replay.ReadInt32();
+		for(int i = 0; i < main; ++i)
+			new_card(pduel, replay.ReadInt32(), p, p, LOCATION_DECK, 0, 0);
+		int extra = replay.ReadInt32();
+		for(int i = 0; i < extra; ++i)
+			new_card(pduel, replay.ReadInt32(), p, p, LOCATION_EXTRA, 0, 0);
+		if(opt & DUEL_TAG_MODE) {
+			main = replay.ReadInt32();
+			for(int i = 0; i < main; ++i)
+				new_tag_card(pduel, replay.ReadInt32(), p, LOCATION_DECK);
+			extra = replay.ReadInt32();
+			for(int i = 0; i < extra; ++i)
+				new_tag_card(pduel, replay.ReadInt32(), p, LOCATION_EXTRA);
+		}
+	}
+	start_duel(pduel, opt);
+	return pduel;
+}
+/*
+ * Replays one duel at full speed. Every time the engine waits for a player,
+ * the next recorded response is given; the duel ends with MSG_WIN, when the
+ * engine has nothing left to process or the replay has no responses left.
+ * With check_states, the duel is saved and restored into a second duel before
+ * every response it can be saved at, and both have to produce the same messages
+ * and the same field until the next one.
+ * With trace_adjust, the processor steps are traced and the time of the PROCESSOR_ADJUST steps is collected.
+ */
+bool ReplayRunner::RunReplay(const char* file, DuelResult& result, bool check_states, bool trace_adjust) {
+	memset(&result, 0, sizeof(result));
+	result.winner = 5;
+	ReplayFile replay;
+	if(!replay.Open(file))
+		return false;
+	unsigned long long allocations = allocation_count;
+	std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+	std::chrono::high_resolution_clock::time_point response_time = start;
+	ptr pduel = CreateDuel(replay, result);
+	if(trace_adjust)
+		set_tracing(pduel, 1);
+	std::vector<byte> engineBuffer;
+	unsigned char resp[64];
+	std::vector<unsigned char> messages, expected;
+	unsigned int expected_digest = 0;
+	bool checking = false;
+	while(true) {
+		int flag = process(pduel);
+		if(flag & 0xffff) {
+			int len = get_message_length(pduel);
+			engineBuffer.resize(len);
+			get_message(pduel, &engineBuffer[0]);
+			result.messages += CountMessages(&engineBuffer[0], len);
+			result.batches++;
+			result.bytes += len;
+			if(checking)
+				messages.insert(messages.end(), engineBuffer.begin(), engineBuffer.end());
+			//the win check runs as its own step, so MSG_WIN is always alone in its batch
+			if(len == 3 && engineBuffer[0] == MSG_WIN) {
+				result.winner = engineBuffer[1];
+				result.win_reason = engineBuffer[2];
+				break;
+			}
+		}
+		if(flag & PROCESSOR_END)
+			break;
+		if(flag & PROCESSOR_WAITING) {
+			double response_seconds = std::chrono::duration_cast<std::chrono::duration<double> >(std::chrono::high_resolution_clock::now() - response_time).count();
+			if(response_seconds > result.max_response_seconds)
+				result.max_response_seconds = response_seconds;
+			if(checking && (messages != expected || FieldDigest(pduel, result) != expected_digest))
+				result.state_mismatches++;
+			checking = false;
+			if(!replay.ReadNextResponse(resp))
+				break;
+			//a duel cannot be saved while a script waits in a coroutine
+			std::vector<byte> state(check_states ? save_duel_state(pduel, 0, 0) : 0);
+			if(state.size()) {
+				save_duel_state(pduel, &state[0], state.size());
+				result.state_checks++;
+				if(RunRestored(state, resp, expected, expected_digest)) {
+					messages.clear();
+					checking = true;
+				} else
+					result.state_mismatches++;
+			}
+			set_responseb(pduel, resp);
+			result.responses++;
+			response_time = std::chrono::high_resolution_clock::now();
+		}
+	}
+	result.digest = FieldDigest(pduel, result);
+	result.steps = ((duel*)pduel)->game_field->core.steps;
+	if(trace_adjust)
+		CollectAdjustTrace(pduel, result);
+	if(checking && (messages != expected || result.digest != expected_digest))
+		result.state_mismatches++;
+	end_duel(pduel);
+	result.seconds = std::chrono::duration_cast<std::chrono::duration<double> >(std::chrono::high_resolution_clock::now() - start).count();
+	result.allocations = allocation_count - allocations;
+	return true;
+}
+//adds up the "<unit> <step> <runs> <nanoseconds>" lines of the step totals of the trace
+void ReplayRunner::CollectAdjustTrace(ptr pduel, DuelResult& result) {
+	std::vector<char> report(get_trace_report(pduel, 0, 0, TRACE_FORMAT_STEPS) + 1);
+	get_trace_report(pduel, (byte*)&report[0], report.size(), TRACE_FORMAT_STEPS);
+	report.back() = 0;
+	char* line = &report[0];
+	while(*line) {
+		char unit[32];
+		unsigned int step;
+		unsigned long long runs, nanoseconds;
+		if(sscanf(line, "%31s %u %llu %llu", unit, &step, &runs, &nanoseconds) == 4) {
+			result.traced_nanoseconds += nanoseconds;
+			if(!strcmp(unit, "ADJUST") && step < ADJUST_STEPS) {
+				result.adjust_runs[step] += runs;
+				result.adjust_nanoseconds[step] += nanoseconds;
+			}
+		}
+		char* next = strchr(line, '\n');
+		if(!next)
+			break;
+		line = next + 1;
+	}
+}
+/*
+ * Restores a copy of a duel from its saved state, gives it the response and
+ * collects its messages and the digest of its field until it waits for the next one.
+ * Returns false if the state could not be restored or the copy saves a state of another size.
+ * The states are not compared byte for byte, the tables of the scripts may be written in another order.
+ */
+bool ReplayRunner::RunRestored(std::vector<byte>& state, unsigned char* resp, std::vector<unsigned char>& messages, unsigned int& digest) {
+	DuelResult copy_result;
+	memset(&copy_result, 0, sizeof(copy_result));
+	copy_result.winner = 5;
+	ptr pcopy = load_duel_state(&state[0], state.size(), 0, (card_reader_ex)CardReader, (message_handler_ex)MessageHandler, &copy_result);
+	if(!pcopy)
+		return false;
+	if((size_t)save_duel_state(pcopy, 0, 0) != state.size()) {
+		end_duel(pcopy);
+		return false;
+	}
+	std::vector<byte> engineBuffer;
+	messages.clear();
+	set_responseb(pcopy, resp);
+	while(true) {
+		int flag = process(pcopy);
+		if(flag & 0xffff) {
+			int len = get_message_length(pcopy);
+			engineBuffer.resize(len);
+			get_message(pcopy, &engineBuffer[0]);
+			messages.insert(messages.end(), engineBuffer.begin(), engineBuffer.end());
+			if(len == 3 && engineBuffer[0] == MSG_WIN) {
+				copy_result.winner = engineBuffer[1];
+				copy_result.win_reason = engineBuffer[2];
+				break;
+			}
+		}
+		if(flag & (PROCESSOR_END | PROCESSOR_WAITING))
+			break;
+	}
+	digest = FieldDigest(pcopy, copy_result);
+	end_duel(pcopy);
+	return true;
+}
+/*
+ * Counts the messages in a buffer returned by get_message, the lengths are those of SingleDuel::Analyze.
+ * A selection, an announcement, MSG_RETRY and MSG_WIN make the engine wait or stop,
+ * so they are the last message of their buffer and are not walked.
+ */
+unsigned int ReplayRunner::CountMessages(const byte* msg, int len) {
+	const byte* pbuf = msg;
+	const byte* end = msg + len;
+	unsigned int count = 0;
+	while(pbuf < end) {
+		count++;
+		unsigned char type = *pbuf++;
+		switch(type) {
+		case MSG_HINT:
+			pbuf += 6;
+			break;
+		case MSG_CONFIRM_DECKTOP:
+		case MSG_CONFIRM_CARDS:
+			pbuf += 2 + pbuf[1] * 7;
+			break;
+		case MSG_SHUFFLE_HAND:
+		case MSG_CARD_SELECTED:
+		case MSG_RANDOM_SELECTED:
+		case MSG_DRAW:
+			pbuf += 2 + pbuf[1] * 4;
+			break;
+		case MSG_SHUFFLE_DECK:
+		case MSG_REFRESH_DECK:
+		case MSG_SWAP_GRAVE_DECK:
+		case MSG_NEW_TURN:
+		case MSG_NEW_PHASE:
+		case MSG_CHAINED:
+		case MSG_CHAIN_SOLVING:
+		case MSG_CHAIN_SOLVED:
+		case MSG_CHAIN_NEGATED:
+		case MSG_CHAIN_DISABLED:
+			pbuf += 1;
+			break;
+		case MSG_REVERSE_DECK:
+		case MSG_SUMMONED:
+		case MSG_SPSUMMONED:
+		case MSG_FLIPSUMMONED:
+		case MSG_CHAIN_END:
+		case MSG_ATTACK_DISABLED:
+		case MSG_DAMAGE_STEP_START:
+		case MSG_DAMAGE_STEP_END:
+			break;
+		case MSG_DECK_TOP:
+		case MSG_ADD_COUNTER:
+		case MSG_REMOVE_COUNTER:
+			pbuf += 6;
+			break;
+		case MSG_SHUFFLE_SET_CARD:
+			pbuf += 1 + pbuf[0] * 8;
+			break;
+		case MSG_BECOME_TARGET:
+			pbuf += 1 + pbuf[0] * 4;
+			break;
+		case MSG_TOSS_COIN:
+		case MSG_TOSS_DICE:
+			pbuf += 2 + pbuf[1];
+			break;
+		case MSG_MOVE:
+		case MSG_SWAP:
+		case MSG_CHAINING:
+			pbuf += 16;
+			break;
+		case MSG_POS_CHANGE:
+		case MSG_CARD_HINT:
+			pbuf += 9;
+			break;
+		case MSG_SET:
+		case MSG_SUMMONING:
+		case MSG_SPSUMMONING:
+		case MSG_FLIPSUMMONING:
+		case MSG_EQUIP:
+		case MSG_CARD_TARGET:
+		case MSG_CANCEL_TARGET:
+		case MSG_ATTACK:
+		case MSG_MISSED_EFFECT:
+			pbuf += 8;
+			break;
+		case MSG_FIELD_DISABLED:
+		case MSG_UNEQUIP:
+		case MSG_MATCH_KILL:
+			pbuf += 4;
+			break;
+		case MSG_DAMAGE:
+		case MSG_RECOVER:
+		case MSG_LPUPDATE:
+		case MSG_PAY_LPCOST:
+			pbuf += 5;
+			break;
+		case MSG_BATTLE:
+			pbuf += 26;
+			break;
+		case MSG_TAG_SWAP:
+			pbuf += 8 + pbuf[3] * 4;
+			break;
+		case MSG_AI_NAME:
+		case MSG_SHOW_HINT:
+			pbuf += 3 + (pbuf[0] | (pbuf[1] << 8));
+			break;
+		default:
+			return count;
+		}
+	}
+	return count;
+}
+unsigned int ReplayRunner::FieldDigest(ptr pduel, const DuelResult& result) {
+	static const int locations[] = { LOCATION_DECK, LOCATION_HAND, LOCATION_MZONE, LOCATION_SZONE, LOCATION_GRAVE, LOCATION_REMOVED, LOCATION_EXTRA };
+	unsigned int hash = 2166136261u;
+	unsigned char buf[0x2000];
+	int len = 0;
+	buf[len++] = result.winner;
+	buf[len++] = result.win_reason;
+	for(int p = 0; p < 2; ++p) {
+		int lp = ((duel*)pduel)->game_field->player[p].lp;
+		memcpy(buf + len, &lp, 4);
+		len += 4;
+	}
+	for(int i = 0; i < len; ++i)
+		hash = (hash ^ buf[i]) * 16777619u;
+	for(int p = 0; p < 2; ++p) {
+		for(int l = 0; l < 7; ++l) {
+			len = query_field_card(pduel, p, locations[l], QUERY_CODE | QUERY_POSITION, buf, 0);
+			for(int i = 0; i < len; ++i)
+				hash = (hash ^ buf[i]) * 16777619u;
+		}
+	}
+	return hash;
+}
+byte* ReplayRunner::ScriptReader(void* payload, const char* script_name, int* len) {
+	return default_script_reader(script_name, len);
+}
+uint32 ReplayRunner::CardReader(void* payload, uint32 code, card_data* data) {
+	auto cit = cards.find(code);
+	if(cit == cards.end())
+		memset(data, 0, sizeof(card_data));
+	else
+		*data = cit->second;
+	return 0;
+}
+uint32 ReplayRunner::MessageHandler(void* payload, void* pduel, uint32 type) {
+	DuelResult* result = (DuelResult*)payload;
+	if(type == 1)
+		result->script_errors++;
+	return 0;
+}
+
+}
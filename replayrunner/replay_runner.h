@@ -0,0 +1,82 @@
+#ifndef REPLAY_RUNNER_H
+#define REPLAY_RUNNER_H
+
+#include "../ocgcore/ocgapi.h"
+#include "../ocgcore/card.h"
+#include <vector>
+#include <unordered_map>
+
+namespace ygo {
+
+#define REPLAY_COMPRESSED	0x1
+#define REPLAY_TAG			0x2
+#define REPLAY_CHUNKED		0x8
+#define REPLAY_CHUNKED_VERSION	0x1333
+
+#define ADJUST_STEPS	16 //the steps of field::adjust_step
+
+//same layout as the header in gframe/replay.h
+struct ReplayHeader {
+	unsigned int id;
+	unsigned int version;
+	unsigned int flag;
+	unsigned int seed;
+	unsigned int datasize;
+	unsigned int hash;
+	unsigned char props[8];
+};
+
+//a .yrp file read and decompressed into memory
+class ReplayFile {
+public:
+	ReplayFile(): pos(0) {}
+	bool Open(const char* file);
+	void ReadData(void* data, unsigned int length);
+	int ReadInt32();
+	bool ReadNextResponse(unsigned char resp[64]);
+
+	ReplayHeader header;
+	std::vector<unsigned char> data;
+	size_t pos;
+};
+
+struct DuelResult {
+	unsigned int responses;
+	unsigned long long steps; //processor steps of the duel
+	unsigned long long messages;
+	unsigned int batches; //buffers returned by get_message, each holds one or more messages
+	unsigned long long bytes;
+	unsigned int script_errors;
+	double seconds;
+	double max_response_seconds; //the longest run of the engine from a response to the next wait
+	unsigned long long allocations; //operator new calls on the thread of the duel, with -s also those of the restored copies
+	unsigned char winner; //5 if the replay ended without MSG_WIN
+	unsigned char win_reason;
+	unsigned int digest; //hash of the result, the life points and the cards of both players
+	unsigned int state_checks; //responses at which the duel was saved and restored
+	unsigned int state_mismatches; //restored duels that did not continue with the same messages and field
+	unsigned long long traced_nanoseconds; //the time of all traced processor steps
+	unsigned long long adjust_runs[ADJUST_STEPS]; //how often each PROCESSOR_ADJUST step ran, with trace_adjust
+	unsigned long long adjust_nanoseconds[ADJUST_STEPS];
+};
+
+class ReplayRunner {
+public:
+	static bool LoadCards(const char* file);
+	static ptr CreateDuel(ReplayFile& replay, DuelResult& result, script_reader_ex sreader = 0);
+	static bool RunReplay(const char* file, DuelResult& result, bool check_states = false, bool trace_adjust = false);
+	static void CollectAdjustTrace(ptr pduel, DuelResult& result);
+	static bool RunRestored(std::vector<byte>& state, unsigned char* resp, std::vector<unsigned char>& messages, unsigned int& digest);
+	static byte* ScriptReader(void* payload, const char* script_name, int* len);
+	static uint32 CardReader(void* payload, uint32 code, card_data* data);
+	static uint32 MessageHandler(void* payload, void* pduel, uint32 type);
+	static unsigned int FieldDigest(ptr pduel, const DuelResult& result);
+	static unsigned int CountMessages(const byte* msg, int len);
+
+private:
+	static std::unordered_map<unsigned int, card_data> cards;
+};
+
+}
+
+#endif //REPLAY_RUNNER_H
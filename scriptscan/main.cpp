@@ -0,0 +1,237 @@
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include <string>
+#include <vector>
+#include <map>
+#include <algorithm>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <dirent.h>
+#include <strings.h>
+#endif
+
+/*
+ * Lists the filters of card scripts that Duel.CreateFilter can replace:
+ * functions of one card parameter that return Card conditions the engine checks natively,
+ * joined by "and", with constant arguments.
+ */
+
+struct Condition {
+	const char* method;
+	const char* key; // the key in the table of Duel.CreateFilter
+	bool has_arg;
+};
+static const Condition conditions[] = {
+	{ "IsCode", "code", true },
+	{ "IsSetCard", "setcode", true },
+	{ "IsType", "type", true },
+	{ "IsRace", "race", true },
+	{ "IsAttribute", "attribute", true },
+	{ "IsFaceup", "faceup", false },
+	{ "IsAbleToHand", "abletohand", false },
+	{ "IsAbleToGrave", "abletograve", false },
+};
+//the functions that pass their filter to the matching card scans of the engine, and the argument of the filter
+static const char* const scans[] = {
+	"GetMatchingGroup", "GetMatchingGroupCount", "GetFirstMatchingCard", "IsExistingMatchingCard",
+	"SelectMatchingCard", "IsExistingTarget", "SelectTarget", "DiscardHand",
+	"Filter", "FilterCount", "FilterSelect", "IsExists", "Remove", "SearchCard",
+};
+
+struct Candidate {
+	std::string name;
+	std::string filter;
+	int scans;
+};
+
+static void ListScripts(const char* dir, std::vector<std::string>& files) {
+	std::string path(dir);
+	if(!path.empty() && path[path.size() - 1] != '/' && path[path.size() - 1] != '\\')
+		path += '/';
+#ifdef _WIN32
+	WIN32_FIND_DATAA fdata;
+	HANDLE fh = FindFirstFileA((path + "*.lua").c_str(), &fdata);
+	if(fh == INVALID_HANDLE_VALUE)
+		return;
+	do {
+		if(!(fdata.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY))
+			files.push_back(path + fdata.cFileName);
+	} while(FindNextFileA(fh, &fdata));
+	FindClose(fh);
+#else
+	DIR * pdir;
+	struct dirent * dirp;
+	if((pdir = opendir(path.c_str())) == NULL)
+		return;
+	while((dirp = readdir(pdir)) != NULL) {
+		size_t len = strlen(dirp->d_name);
+		if(len < 5 || strcasecmp(dirp->d_name + len - 4, ".lua") != 0)
+			continue;
+		files.push_back(path + dirp->d_name);
+	}
+	closedir(pdir);
+#endif
+	std::sort(files.begin(), files.end());
+}
+static std::string Trim(const std::string& str) {
+	size_t begin = str.find_first_not_of(" \t\r\n");
+	if(begin == std::string::npos)
+		return std::string();
+	size_t end = str.find_last_not_of(" \t\r\n");
+	return str.substr(begin, end - begin + 1);
+}
+//constants and numbers only, a filter with a local value in its arguments cannot be made once
+static bool IsConstant(const std::string& arg) {
+	if(arg.empty())
+		return false;
+	for(size_t i = 0; i < arg.size(); ++i) {
+		char ch = arg[i];
+		if(!((ch >= 'A' && ch <= 'Z') || (ch >= '0' && ch <= '9') || ch == '_' || ch == '+' || ch == '|' || ch == 'x' || ch == ' '))
+			return false;
+	}
+	return true;
+}
+//"c:IsType(TYPE_MONSTER) and c:IsAbleToHand()" to "type=TYPE_MONSTER, abletohand=true", empty if it cannot be converted
+static std::string ConvertCondition(const std::string& param, const std::string& expr) {
+	std::vector<std::string> terms;
+	size_t pos = 0;
+	while(true) {
+		size_t next = expr.find(" and ", pos);
+		terms.push_back(Trim(expr.substr(pos, next == std::string::npos ? std::string::npos : next - pos)));
+		if(next == std::string::npos)
+			break;
+		pos = next + 5;
+	}
+	std::string result;
+	unsigned int used = 0;
+	for(size_t t = 0; t < terms.size(); ++t) {
+		const std::string& term = terms[t];
+		std::string prefix = param + ":";
+		if(term.compare(0, prefix.size(), prefix) != 0 || term[term.size() - 1] != ')')
+			return std::string();
+		size_t open = term.find('(');
+		if(open == std::string::npos)
+			return std::string();
+		std::string method = term.substr(prefix.size(), open - prefix.size());
+		std::string arg = Trim(term.substr(open + 1, term.size() - open - 2));
+		size_t c = 0;
+		for(; c < sizeof(conditions) / sizeof(conditions[0]); ++c)
+			if(method == conditions[c].method)
+				break;
+		if(c == sizeof(conditions) / sizeof(conditions[0]) || (used & (1 << c)))
+			return std::string();
+		used |= 1 << c;
+		if(conditions[c].has_arg != !arg.empty() || (!arg.empty() && !IsConstant(arg)))
+			return std::string();
+		if(!result.empty())
+			result += ", ";
+		result += conditions[c].key;
+		result += "=";
+		result += arg.empty() ? "true" : arg;
+	}
+	return result;
+}
+//the number of calls that pass the filter name to a matching card scan
+static int CountScans(const std::string& text, const std::string& name) {
+	int count = 0;
+	size_t pos = 0;
+	while((pos = text.find(name, pos)) != std::string::npos) {
+		size_t end = pos + name.size();
+		size_t open = text.find_last_of("(\n", pos);
+		pos = end;
+		if(end < text.size() && text[end] != ',' && text[end] != ')')
+			continue;
+		if(open == std::string::npos || text[open] != '(')
+			continue;
+		if(text.find_first_not_of("abcdefghijklmnopqrstuvwxyz0123456789_, ", open + 1) < pos - name.size())
+			continue;
+		size_t begin = open;
+		while(begin > 0 && (isalnum((unsigned char)text[begin - 1]) || text[begin - 1] == '_'))
+			begin--;
+		std::string call = text.substr(begin, open - begin);
+		for(size_t s = 0; s < sizeof(scans) / sizeof(scans[0]); ++s) {
+			if(call == scans[s]) {
+				count++;
+				break;
+			}
+		}
+	}
+	return count;
+}
+static void ScanScript(const std::string& file, std::vector<Candidate>& candidates, int& filters) {
+	FILE* fp = fopen(file.c_str(), "rb");
+	if(!fp)
+		return;
+	std::string text;
+	char buf[4096];
+	size_t len;
+	while((len = fread(buf, 1, sizeof(buf), fp)) > 0)
+		text.append(buf, len);
+	fclose(fp);
+	std::vector<std::string> lines;
+	size_t pos = 0;
+	while(pos < text.size()) {
+		size_t next = text.find('\n', pos);
+		if(next == std::string::npos)
+			next = text.size();
+		lines.push_back(Trim(text.substr(pos, next - pos)));
+		pos = next + 1;
+	}
+	for(size_t i = 0; i + 2 < lines.size(); ++i) {
+		const std::string& line = lines[i];
+		if(line.compare(0, 9, "function ") != 0 || line[line.size() - 1] != ')')
+			continue;
+		size_t open = line.find('(');
+		std::string param = line.substr(open + 1, line.size() - open - 2);
+		if(open == std::string::npos || param.empty() || param.find(',') != std::string::npos)
+			continue;
+		filters++;
+		if(lines[i + 1].compare(0, 7, "return ") != 0 || lines[i + 2] != "end")
+			continue;
+		std::string filter = ConvertCondition(param, Trim(lines[i + 1].substr(7)));
+		if(filter.empty())
+			continue;
+		Candidate cd;
+		cd.name = Trim(line.substr(9, open - 9));
+		cd.filter = "Duel.CreateFilter({" + filter + "})";
+		cd.scans = CountScans(text, cd.name);
+		candidates.push_back(cd);
+	}
+}
+int main(int argc, char* argv[]) {
+	if(argc < 2) {
+		fprintf(stderr, "usage: scriptscan <script dir>...\n");
+		return 1;
+	}
+	std::vector<std::string> files;
+	for(int i = 1; i < argc; ++i)
+		ListScripts(argv[i], files);
+	int filters = 0, convertible = 0, scanned = 0, scans = 0;
+	std::map<std::string, int> patterns;
+	for(size_t i = 0; i < files.size(); ++i) {
+		std::vector<Candidate> candidates;
+		ScanScript(files[i], candidates, filters);
+		for(size_t c = 0; c < candidates.size(); ++c) {
+			const Candidate& cd = candidates[c];
+			printf("%s: %s -> %s, %d matching scans\n", files[i].c_str(), cd.name.c_str(), cd.filter.c_str(), cd.scans);
+			convertible++;
+			patterns[cd.filter]++;
+			if(cd.scans) {
+				scanned++;
+				scans += cd.scans;
+			}
+		}
+	}
+	printf("\n%d scripts, %d functions of one parameter, %d can use Duel.CreateFilter, %d of them in %d matching scans\n",
+	       (int)files.size(), filters, convertible, scanned, scans);
+	std::vector<std::pair<int, std::string> > common;
+	for(auto pit = patterns.begin(); pit != patterns.end(); ++pit)
+		common.push_back(std::make_pair(-pit->second, pit->first));
+	std::sort(common.begin(), common.end());
+	printf("most common filters:\n");
+	for(size_t i = 0; i < common.size() && i < 20; ++i)
+		printf("%6d %s\n", -common[i].first, common[i].second.c_str());
+	return 0;
+}
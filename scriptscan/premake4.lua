@@ -0,0 +1,7 @@
+project "scriptscan"
+    kind "ConsoleApp"
+
+    files { "**.cpp", "**.h" }
+
+    configuration "not vs*"
+        buildoptions { "-std=gnu++0x" }